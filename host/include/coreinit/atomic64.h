@@ -0,0 +1,14 @@
+#pragma once
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t OSGetAtomic64(uint64_t *ptr);
+uint64_t OSSetAtomic64(uint64_t *ptr, uint64_t value);
+int64_t OSAddAtomic64(int64_t *ptr, int64_t value);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
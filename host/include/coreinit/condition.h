@@ -0,0 +1,24 @@
+#pragma once
+#include <coreinit/mutex.h>
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Only the host implementation state, the layout does not match the console.
+ */
+typedef struct OSCondition {
+    void *hostCondition;
+} OSCondition;
+
+void OSInitCond(OSCondition *condition);
+// The mutex has to be locked exactly once by the calling thread.
+void OSWaitCond(OSCondition *condition, OSMutex *mutex);
+// Wakes every waiting thread.
+void OSSignalCond(OSCondition *condition);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The host maps every thread to one of the three Espresso cores based on its thread id.
+ */
+uint32_t OSGetCoreId();
+uint32_t OSGetCoreCount();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
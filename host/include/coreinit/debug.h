@@ -0,0 +1,15 @@
+#pragma once
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Prints to stderr on the host.
+ */
+void OSReport(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+#include <coreinit/filesystem.h>
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum FSACommandEnum {
+    FSA_COMMAND_RAW_OPEN  = 0x6A,
+    FSA_COMMAND_RAW_READ  = 0x6B,
+    FSA_COMMAND_RAW_WRITE = 0x6C,
+    FSA_COMMAND_RAW_CLOSE = 0x6D,
+} FSACommandEnum;
+
+typedef enum FSAIpcRequestTypeEnum {
+    FSA_IPC_REQUEST_IOCTL  = 0,
+    FSA_IPC_REQUEST_IOCTLV = 1,
+} FSAIpcRequestTypeEnum;
+
+typedef struct FSARequestRawOpen {
+    char path[0x280];
+} FSARequestRawOpen;
+
+typedef struct FSARequestRawClose {
+    int32_t handle;
+} FSARequestRawClose;
+
+typedef struct WUT_PACKED FSARequestRawRead {
+    uint32_t unk0;
+    uint64_t blocks_offset;
+    uint32_t count;
+    uint32_t size;
+    uint32_t device_handle;
+} FSARequestRawRead;
+
+typedef struct WUT_PACKED FSARequestRawWrite {
+    uint32_t unk0;
+    uint64_t blocks_offset;
+    uint32_t count;
+    uint32_t size;
+    uint32_t device_handle;
+} FSARequestRawWrite;
+
+typedef struct FSARequest {
+    FSError emulatedError;
+    union {
+        FSARequestRawOpen rawOpen;
+        FSARequestRawClose rawClose;
+        FSARequestRawRead rawRead;
+        FSARequestRawWrite rawWrite;
+        uint8_t raw[0x51C];
+    };
+} FSARequest;
+
+typedef struct FSAResponseRawOpen {
+    int32_t handle;
+} FSAResponseRawOpen;
+
+typedef struct WUT_PACKED FSAResponse {
+    uint32_t word0;
+    union WUT_PACKED {
+        FSAResponseRawOpen rawOpen;
+        uint8_t raw[0x28F];
+    };
+} FSAResponse;
+
+typedef struct FSAShimBuffer {
+    FSARequest request;
+    uint8_t unk0[0x60];
+    FSAResponse response;
+    uint8_t unk1[0x880 - 0x813];
+    IOSVec ioctlvVec[3];
+    uint8_t unk2[0x900 - 0x8A4];
+    FSACommandEnum command;
+    uint32_t clientHandle;
+    FSAIpcRequestTypeEnum ipcReqType;
+    uint8_t ioctlvVecIn;
+    uint8_t ioctlvVecOut;
+} FSAShimBuffer;
+
+/**
+ * Sends the request of the shim buffer to the simulated /dev/fsa.
+ */
+FSError __FSAShimSend(FSAShimBuffer *shim, uint32_t unk);
+FSError __FSAShimDecodeIosErrorToFsaStatus(IOSHandle handle, IOSError error);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
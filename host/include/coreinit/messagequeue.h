@@ -0,0 +1,34 @@
+#pragma once
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct OSMessage {
+    void *message;
+    uint32_t args[3];
+} OSMessage;
+
+typedef enum OSMessageFlags {
+    OS_MESSAGE_FLAGS_NONE          = 0,
+    OS_MESSAGE_FLAGS_BLOCKING      = 1 << 0,
+    OS_MESSAGE_FLAGS_HIGH_PRIORITY = 1 << 1,
+} OSMessageFlags;
+
+typedef struct OSMessageQueue {
+    uint32_t tag;
+    const char *name;
+    OSMessage *messages;
+    uint32_t size;
+    uint32_t first;
+    uint32_t used;
+} OSMessageQueue;
+
+void OSInitMessageQueue(OSMessageQueue *queue, OSMessage *messages, int32_t size);
+BOOL OSSendMessage(OSMessageQueue *queue, OSMessage *message, OSMessageFlags flags);
+BOOL OSReceiveMessage(OSMessageQueue *queue, OSMessage *message, OSMessageFlags flags);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Only the host implementation state, the layout does not match the console.
+ * Like on the console the mutex is recursive.
+ */
+typedef struct OSMutex {
+    void *hostMutex;
+} OSMutex;
+
+void OSInitMutex(OSMutex *mutex);
+void OSLockMutex(OSMutex *mutex);
+void OSUnlockMutex(OSMutex *mutex);
+BOOL OSTryLockMutex(OSMutex *mutex);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
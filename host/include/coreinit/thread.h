@@ -0,0 +1,39 @@
+#pragma once
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int (*OSThreadEntryPointFn)(int argc, const char **argv);
+
+typedef enum OSThreadAttributes {
+    OS_THREAD_ATTRIB_AFFINITY_CPU0 = 1 << 0,
+    OS_THREAD_ATTRIB_AFFINITY_CPU1 = 1 << 1,
+    OS_THREAD_ATTRIB_AFFINITY_CPU2 = 1 << 2,
+    OS_THREAD_ATTRIB_AFFINITY_ANY  = 7,
+    OS_THREAD_ATTRIB_DETACHED      = 1 << 3,
+} OSThreadAttributes;
+
+/**
+ * Only the host implementation state, the layout does not match the console.
+ */
+typedef struct OSThread {
+    void *hostThread;
+    OSThreadEntryPointFn entry;
+    int32_t argc;
+    const char **argv;
+    uint32_t attributes;
+    int32_t result;
+} OSThread;
+
+BOOL OSCreateThread(OSThread *thread, OSThreadEntryPointFn entry, int32_t argc, char *argv, void *stack, uint32_t stackSize, int32_t priority, OSThreadAttributes attributes);
+int32_t OSResumeThread(OSThread *thread);
+BOOL OSJoinThread(OSThread *thread, int *threadResult);
+void OSSetThreadName(OSThread *thread, const char *name);
+
+void OSYieldThread();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+#include <wut.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int64_t OSTime;
+
+/**
+ * On the host one tick is one nanosecond of the monotonic clock.
+ */
+#define OSTimerClockSpeed                 1000000000ll
+#define OSTicksToSeconds(val)             ((val) / 1000000000ll)
+#define OSTicksToMilliseconds(val)        ((val) / 1000000ll)
+#define OSTicksToMicroseconds(val)        ((val) / 1000ll)
+#define OSTicksToNanoseconds(val)         (val)
+#define OSSecondsToTicks(val)             ((uint64_t) (val) * 1000000000ull)
+#define OSMillisecondsToTicks(val)        ((uint64_t) (val) * 1000000ull)
+#define OSMicrosecondsToTicks(val)        ((uint64_t) (val) * 1000ull)
+#define OSNanosecondsToTicks(val)         ((uint64_t) (val))
+
+OSTime OSGetTime();
+OSTime OSGetSystemTime();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Control interface of the simulated IOS used by the host build.
+ * Every IOS_* call of the library ends up in an in-process /dev/stroopwafel and /dev/fsa backend.
+ * Like on the console, at most 0x30 requests can be outstanding at once (IOS_ERROR_QFULL otherwise) and
+ * output vectors have to start on a 0x40 aligned address.
+ */
+
+/**
+ * Resets the fake IOS address space, all mappings, raw devices, counters and settings.
+ */
+void StroopwafelMock_Reset();
+
+/**
+ * Configures the simulated IPC cost.
+ * @param round_trip_us Time between submitting a request and IOS starting to process it. Overlaps for requests in flight.
+ * @param service_us Time IOS spends processing a request. Requests are processed one after another.
+ */
+void StroopwafelMock_SetLatency(uint32_t round_trip_us, uint32_t service_us);
+
+/**
+ * Sets the API version reported by STROOPWAFEL_IOCTL_GET_API_VERSION.
+ */
+void StroopwafelMock_SetAPIVersion(uint32_t version);
+
+/**
+ * Sets the paths reported by STROOPWAFEL_IOCTL_GET_MINUTE_PATH and STROOPWAFEL_IOCTL_GET_PLUGIN_PATH.
+ */
+void StroopwafelMock_SetMinutePath(uint32_t device, const char *path);
+void StroopwafelMock_SetPluginPath(uint32_t device, const char *path);
+
+/**
+ * Copies the last path set via STROOPWAFEL_IOCTL_SET_FW_PATH into out, truncated to size - 1 characters.
+ * @return length of the full path.
+ */
+uint32_t StroopwafelMock_GetFwPath(char *out, uint32_t size);
+
+/**
+ * Copies data from/into the fake IOS address space. Unwritten memory reads as zero.
+ */
+void StroopwafelMock_ReadMemory(uint32_t addr, void *out, uint32_t len);
+void StroopwafelMock_WriteMemory(uint32_t addr, const void *data, uint32_t len);
+
+/**
+ * Handler for STROOPWAFEL_IOCTLV_EXECUTE. Without a handler for the target address the config buffer is echoed into the output buffer.
+ * @return value returned by the ioctlv.
+ */
+typedef int32_t (*StroopwafelMockExecuteFn)(uint32_t target_addr, const void *config, uint32_t config_len, void *output, uint32_t output_len);
+void StroopwafelMock_SetExecuteHandler(uint32_t target_addr, StroopwafelMockExecuteFn handler);
+
+/**
+ * Number of MAP_MEMORY calls that have been processed and the region of the n-th one.
+ */
+uint32_t StroopwafelMock_GetMappingCount();
+int StroopwafelMock_GetMapping(uint32_t index, uint32_t *paddr, uint32_t *vaddr, uint32_t *size);
+
+/**
+ * Number of requests that have been processed for a command (IOCTL/IOCTLV request id).
+ */
+uint32_t StroopwafelMock_GetCallCount(uint32_t command);
+
+/**
+ * Makes the next <count> requests to /dev/stroopwafel fail with <error>.
+ */
+void StroopwafelMock_InjectError(int32_t error, uint32_t count);
+
+/**
+ * Creates a raw device that can be opened via FSAEx_RawOpenEx on a /dev/fsa handle.
+ * The contents are stored sparsely and read as zero until written.
+ */
+void StroopwafelMock_AddRawDevice(const char *device_path, uint32_t sector_size, uint64_t sector_count);
+
+/**
+ * Copies data from/into a raw device created by StroopwafelMock_AddRawDevice.
+ */
+int StroopwafelMock_ReadRawDevice(const char *device_path, uint64_t offset, void *out, uint32_t len);
+int StroopwafelMock_WriteRawDevice(const char *device_path, uint64_t offset, const void *data, uint32_t len);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+/**
+ * Minimal stand-in for the wut headers that are needed to build libstroopwafel on the host.
+ * Only the declarations used by the library are provided, they mirror the signatures of wut.
+ */
+#include "wut_types.h"
+
+#define WUT_PACKED __attribute__((__packed__))
@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+typedef int32_t BOOL;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
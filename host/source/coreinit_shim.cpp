@@ -0,0 +1,201 @@
+#include <chrono>
+#include <condition_variable>
+#include <coreinit/atomic64.h>
+#include <coreinit/condition.h>
+#include <coreinit/core.h>
+#include <coreinit/debug.h>
+#include <coreinit/filesystem.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/mutex.h>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+#include <cstdarg>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace {
+    // All message queues share one lock, the host build only needs correctness here.
+    // Never destroyed since the simulated IOS thread may still post messages while the process exits.
+    std::mutex &sQueueMutex                 = *new std::mutex;
+    std::condition_variable &sQueueCondition = *new std::condition_variable;
+
+    // Threads created with an affinity report that core, everything else is spread by thread id.
+    thread_local int32_t sThreadCore = -1;
+} // namespace
+
+void OSReport(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+void OSInitMessageQueue(OSMessageQueue *queue, OSMessage *messages, int32_t size) {
+    std::lock_guard<std::mutex> lock(sQueueMutex);
+    queue->tag      = 0x6D536751;
+    queue->name     = nullptr;
+    queue->messages = messages;
+    queue->size     = (uint32_t) size;
+    queue->first    = 0;
+    queue->used     = 0;
+}
+
+BOOL OSSendMessage(OSMessageQueue *queue, OSMessage *message, OSMessageFlags flags) {
+    std::unique_lock<std::mutex> lock(sQueueMutex);
+    while (queue->used == queue->size) {
+        if (!(flags & OS_MESSAGE_FLAGS_BLOCKING)) {
+            return FALSE;
+        }
+        sQueueCondition.wait(lock);
+    }
+    uint32_t index;
+    if (flags & OS_MESSAGE_FLAGS_HIGH_PRIORITY) {
+        queue->first = (queue->first + queue->size - 1) % queue->size;
+        index        = queue->first;
+    } else {
+        index = (queue->first + queue->used) % queue->size;
+    }
+    queue->messages[index] = *message;
+    queue->used++;
+    sQueueCondition.notify_all();
+    return TRUE;
+}
+
+BOOL OSReceiveMessage(OSMessageQueue *queue, OSMessage *message, OSMessageFlags flags) {
+    std::unique_lock<std::mutex> lock(sQueueMutex);
+    while (queue->used == 0) {
+        if (!(flags & OS_MESSAGE_FLAGS_BLOCKING)) {
+            return FALSE;
+        }
+        sQueueCondition.wait(lock);
+    }
+    *message     = queue->messages[queue->first];
+    queue->first = (queue->first + 1) % queue->size;
+    queue->used--;
+    sQueueCondition.notify_all();
+    return TRUE;
+}
+
+FSClientBody *FSGetClientBody(FSClient *client) {
+    return (FSClientBody *) client;
+}
+
+OSTime OSGetTime() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+OSTime OSGetSystemTime() {
+    return OSGetTime();
+}
+
+uint64_t OSGetAtomic64(uint64_t *ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+}
+
+uint64_t OSSetAtomic64(uint64_t *ptr, uint64_t value) {
+    return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+int64_t OSAddAtomic64(int64_t *ptr, int64_t value) {
+    return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+uint32_t OSGetCoreId() {
+    if (sThreadCore >= 0) {
+        return (uint32_t) sThreadCore;
+    }
+    return std::hash<std::thread::id>{}(std::this_thread::get_id()) % 3;
+}
+
+uint32_t OSGetCoreCount() {
+    return 3;
+}
+
+void OSYieldThread() {
+    std::this_thread::yield();
+}
+
+BOOL OSCreateThread(OSThread *thread, OSThreadEntryPointFn entry, int32_t argc, char *argv, void *stack, uint32_t stackSize, int32_t priority, OSThreadAttributes attributes) {
+    if (!thread || !entry) {
+        return FALSE;
+    }
+    // The host thread brings its own stack, the thread is started by OSResumeThread like on the console.
+    thread->hostThread = nullptr;
+    thread->entry      = entry;
+    thread->argc       = argc;
+    thread->argv       = (const char **) argv;
+    thread->attributes = attributes;
+    thread->result     = 0;
+    return TRUE;
+}
+
+int32_t OSResumeThread(OSThread *thread) {
+    if (thread->hostThread) {
+        return 0;
+    }
+    int32_t core = -1;
+    for (int32_t i = 0; i < 3; i++) {
+        if ((thread->attributes & OS_THREAD_ATTRIB_AFFINITY_ANY) == (1u << i)) {
+            core = i;
+        }
+    }
+    thread->hostThread = new std::thread([thread, core]() {
+        sThreadCore    = core;
+        thread->result = thread->entry(thread->argc, thread->argv);
+    });
+    if (thread->attributes & OS_THREAD_ATTRIB_DETACHED) {
+        ((std::thread *) thread->hostThread)->detach();
+    }
+    return 1;
+}
+
+BOOL OSJoinThread(OSThread *thread, int *threadResult) {
+    auto *hostThread = (std::thread *) thread->hostThread;
+    if (!hostThread || !hostThread->joinable()) {
+        return FALSE;
+    }
+    hostThread->join();
+    delete hostThread;
+    thread->hostThread = nullptr;
+    if (threadResult) {
+        *threadResult = thread->result;
+    }
+    return TRUE;
+}
+
+void OSSetThreadName(OSThread *thread, const char *name) {
+}
+
+// Mutexes and conditions are usually globals that live until the process exits, so they are never destroyed.
+void OSInitMutex(OSMutex *mutex) {
+    mutex->hostMutex = new std::recursive_mutex;
+}
+
+void OSLockMutex(OSMutex *mutex) {
+    ((std::recursive_mutex *) mutex->hostMutex)->lock();
+}
+
+void OSUnlockMutex(OSMutex *mutex) {
+    ((std::recursive_mutex *) mutex->hostMutex)->unlock();
+}
+
+BOOL OSTryLockMutex(OSMutex *mutex) {
+    return ((std::recursive_mutex *) mutex->hostMutex)->try_lock();
+}
+
+void OSInitCond(OSCondition *condition) {
+    condition->hostCondition = new std::condition_variable_any;
+}
+
+void OSWaitCond(OSCondition *condition, OSMutex *mutex) {
+    std::unique_lock<std::recursive_mutex> lock(*(std::recursive_mutex *) mutex->hostMutex, std::adopt_lock);
+    ((std::condition_variable_any *) condition->hostCondition)->wait(lock);
+    // Still owned by the caller.
+    lock.release();
+}
+
+void OSSignalCond(OSCondition *condition) {
+    ((std::condition_variable_any *) condition->hostCondition)->notify_all();
+}
@@ -0,0 +1,614 @@
+#include "stroopwafel/commands.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel_mock.h"
+#include <chrono>
+#include <condition_variable>
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/ios.h>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    enum class DeviceType {
+        Stroopwafel,
+        FSA,
+    };
+
+    struct Request {
+        IOSHandle handle;
+        uint32_t command;
+        bool vectored;
+        void *inBuf;
+        uint32_t inLen;
+        void *outBuf;
+        uint32_t outLen;
+        uint32_t vecIn;
+        uint32_t vecOut;
+        IOSVec *vec;
+        IOSAsyncCallbackFn callback;
+        void *context;
+        Clock::time_point readyAt;
+        // Used by synchronous calls to wait for the worker.
+        bool done;
+        IOSError result;
+    };
+
+    struct RawDevice {
+        uint32_t sectorSize;
+        uint64_t sectorCount;
+        std::unordered_map<uint64_t, std::unique_ptr<uint8_t[]>> pages;
+    };
+
+    struct Mapping {
+        uint32_t paddr;
+        uint32_t vaddr;
+        uint32_t size;
+    };
+
+    // The library relies on the wut layout, e.g. for the alignment of the response.
+    static_assert(sizeof(FSARequest) == 0x520 && offsetof(FSAShimBuffer, response) == 0x580 && offsetof(FSAShimBuffer, ioctlvVec) == 0x880);
+
+    constexpr uint32_t MEMORY_PAGE_SIZE = 0x1000;
+    constexpr uint32_t RAW_PAGE_SIZE    = 0x10000;
+    // coreinit has a fixed pool of IPC request buffers, the simulated one is shared by all cores.
+    constexpr uint32_t MAX_OUTSTANDING_REQUESTS = 0x30;
+
+    // State of the simulated IOS. Request processing is serialized through sStateMutex like a single resource manager thread.
+    std::mutex sStateMutex;
+    std::unordered_map<IOSHandle, DeviceType> sHandles;
+    IOSHandle sNextHandle = 1;
+    uint32_t sAPIVersion  = STROOPWAFEL_API_VERSION;
+    std::string sFwPath;
+    StroopwafelMinutePath sMinutePath;
+    StroopwafelMinutePath sPluginPath;
+    std::unordered_map<uint32_t, std::unique_ptr<uint8_t[]>> sMemory;
+    std::map<uint32_t, StroopwafelMockExecuteFn> sExecuteHandlers;
+    std::vector<Mapping> sMappings;
+    std::unordered_map<uint32_t, uint32_t> sCallCounts;
+    int32_t sInjectedError    = 0;
+    uint32_t sInjectedCount   = 0;
+    uint32_t sRoundTripMicros = 0;
+    uint32_t sServiceMicros   = 0;
+    std::map<std::string, std::shared_ptr<RawDevice>> sRawDevices;
+    std::unordered_map<int32_t, std::shared_ptr<RawDevice>> sRawHandles;
+    int32_t sNextRawHandle = 1;
+
+    // Requests waiting for the IOS worker thread. The worker is detached and still waits on the condition variable
+    // when the process exits, so these are intentionally never destroyed.
+    std::mutex &sQueueMutex                 = *new std::mutex;
+    std::condition_variable &sQueueCondition = *new std::condition_variable;
+    std::deque<Request *> &sQueue           = *new std::deque<Request *>;
+    std::once_flag sWorkerStarted;
+    // Requests that hold an IPC request buffer, guarded by sQueueMutex.
+    uint32_t sOutstanding = 0;
+
+    // IOS writes output vectors by physical address after coreinit invalidated their cache lines, so a vector that
+    // doesn't start on a cache line would lose the data in front of it. coreinit doesn't catch this, the simulated IOS does.
+    // A partial last line can't be checked, padded buffers like the FSA response are fine.
+    bool isOutputVectorAligned(const IOSVec &vec) {
+        return ((uintptr_t) vec.vaddr & 0x3F) == 0;
+    }
+
+    uint8_t *memoryPage(uint32_t addr, bool create) {
+        uint32_t page = addr / MEMORY_PAGE_SIZE;
+        auto it       = sMemory.find(page);
+        if (it != sMemory.end()) {
+            return it->second.get();
+        }
+        if (!create) {
+            return nullptr;
+        }
+        auto data = std::make_unique<uint8_t[]>(MEMORY_PAGE_SIZE);
+        memset(data.get(), 0, MEMORY_PAGE_SIZE);
+        auto *res = data.get();
+        sMemory.emplace(page, std::move(data));
+        return res;
+    }
+
+    void readMemory(uint32_t addr, void *out, uint32_t len) {
+        auto *dst = (uint8_t *) out;
+        while (len > 0) {
+            uint32_t offset = addr % MEMORY_PAGE_SIZE;
+            uint32_t chunk  = std::min(len, MEMORY_PAGE_SIZE - offset);
+            auto *page      = memoryPage(addr, false);
+            if (page) {
+                memcpy(dst, page + offset, chunk);
+            } else {
+                memset(dst, 0, chunk);
+            }
+            addr += chunk;
+            dst += chunk;
+            len -= chunk;
+        }
+    }
+
+    void writeMemory(uint32_t addr, const void *data, uint32_t len) {
+        auto *src = (const uint8_t *) data;
+        while (len > 0) {
+            uint32_t offset = addr % MEMORY_PAGE_SIZE;
+            uint32_t chunk  = std::min(len, MEMORY_PAGE_SIZE - offset);
+            memcpy(memoryPage(addr, true) + offset, src, chunk);
+            addr += chunk;
+            src += chunk;
+            len -= chunk;
+        }
+    }
+
+    void rawAccess(RawDevice &device, uint64_t offset, void *data, uint32_t len, bool write) {
+        auto *ptr = (uint8_t *) data;
+        while (len > 0) {
+            uint64_t page     = offset / RAW_PAGE_SIZE;
+            uint32_t inPage   = offset % RAW_PAGE_SIZE;
+            uint32_t chunk    = std::min<uint32_t>(len, RAW_PAGE_SIZE - inPage);
+            auto it           = device.pages.find(page);
+            uint8_t *pageData = it != device.pages.end() ? it->second.get() : nullptr;
+            if (write) {
+                if (!pageData) {
+                    auto newPage = std::make_unique<uint8_t[]>(RAW_PAGE_SIZE);
+                    memset(newPage.get(), 0, RAW_PAGE_SIZE);
+                    pageData = newPage.get();
+                    device.pages.emplace(page, std::move(newPage));
+                }
+                memcpy(pageData + inPage, ptr, chunk);
+            } else if (pageData) {
+                memcpy(ptr, pageData + inPage, chunk);
+            } else {
+                memset(ptr, 0, chunk);
+            }
+            offset += chunk;
+            ptr += chunk;
+            len -= chunk;
+        }
+    }
+
+    IOSError processStroopwafel(Request &req) {
+        if (sInjectedCount > 0) {
+            sInjectedCount--;
+            return (IOSError) sInjectedError;
+        }
+
+        switch (req.command) {
+            case STROOPWAFEL_IOCTL_GET_API_VERSION: {
+                if (req.vectored || !req.outBuf || req.outLen < sizeof(uint32_t)) {
+                    return IOS_ERROR_INVALID;
+                }
+                memcpy(req.outBuf, &sAPIVersion, sizeof(uint32_t));
+                return (IOSError) sizeof(uint32_t);
+            }
+            case STROOPWAFEL_IOCTL_SET_FW_PATH: {
+                if (req.vectored || !req.inBuf || req.inLen == 0) {
+                    return IOS_ERROR_INVALID;
+                }
+                sFwPath.assign((const char *) req.inBuf, strnlen((const char *) req.inBuf, req.inLen));
+                return IOS_ERROR_OK;
+            }
+            case STROOPWAFEL_IOCTLV_WRITE_MEMORY: {
+                if (!req.vectored || req.vecIn < 1 || req.vecOut != 0 || req.vec[0].len != (req.vecIn - 1) * sizeof(uint32_t)) {
+                    return IOS_ERROR_INVALID;
+                }
+                auto *dest_addrs = (const uint32_t *) req.vec[0].vaddr;
+                for (uint32_t i = 1; i < req.vecIn; i++) {
+                    writeMemory(dest_addrs[i - 1], req.vec[i].vaddr, req.vec[i].len);
+                }
+                return IOS_ERROR_OK;
+            }
+            case STROOPWAFEL_IOCTLV_EXECUTE: {
+                if (!req.vectored || req.vecIn < 1 || req.vecIn > 2 || req.vecOut > 1 || req.vec[0].len != sizeof(uint32_t)) {
+                    return IOS_ERROR_INVALID;
+                }
+                uint32_t target     = *(const uint32_t *) req.vec[0].vaddr;
+                const void *config  = req.vecIn == 2 ? req.vec[1].vaddr : nullptr;
+                uint32_t config_len = req.vecIn == 2 ? req.vec[1].len : 0;
+                void *output        = req.vecOut == 1 ? req.vec[req.vecIn].vaddr : nullptr;
+                uint32_t output_len = req.vecOut == 1 ? req.vec[req.vecIn].len : 0;
+
+                auto it = sExecuteHandlers.find(target);
+                if (it != sExecuteHandlers.end()) {
+                    return (IOSError) it->second(target, config, config_len, output, output_len);
+                }
+                if (output && config) {
+                    memcpy(output, config, std::min(config_len, output_len));
+                }
+                return IOS_ERROR_OK;
+            }
+            case STROOPWAFEL_IOCTL_MAP_MEMORY: {
+                if (req.vectored || !req.inBuf || req.inLen != sizeof(StroopwafelMapMemory)) {
+                    return IOS_ERROR_INVALID;
+                }
+                auto *info = (const StroopwafelMapMemory *) req.inBuf;
+                sMappings.push_back({info->paddr, info->vaddr, info->size});
+                return IOS_ERROR_OK;
+            }
+            case STROOPWAFEL_IOCTL_GET_MINUTE_PATH:
+            case STROOPWAFEL_IOCTL_GET_PLUGIN_PATH: {
+                if (req.vectored || !req.outBuf || req.outLen < sizeof(StroopwafelMinutePath)) {
+                    return IOS_ERROR_INVALID;
+                }
+                memcpy(req.outBuf, req.command == STROOPWAFEL_IOCTL_GET_MINUTE_PATH ? &sMinutePath : &sPluginPath, sizeof(StroopwafelMinutePath));
+                return (IOSError) sizeof(StroopwafelMinutePath);
+            }
+            case STROOPWAFEL_IOCTLV_READ_MEMORY: {
+                // Added in v1.1.0, older versions don't know the command.
+                if (sAPIVersion < 0x010100) {
+                    return IOS_ERROR_INVALID;
+                }
+                if (!req.vectored || req.vecIn != 1 || req.vec[0].len != req.vecOut * sizeof(uint32_t)) {
+                    return IOS_ERROR_INVALID;
+                }
+                auto *src_addrs = (const uint32_t *) req.vec[0].vaddr;
+                for (uint32_t i = 0; i < req.vecOut; i++) {
+                    readMemory(src_addrs[i], req.vec[1 + i].vaddr, req.vec[1 + i].len);
+                }
+                return IOS_ERROR_OK;
+            }
+            default:
+                return IOS_ERROR_INVALID;
+        }
+    }
+
+    IOSError processFSA(Request &req) {
+        switch (req.command) {
+            case FSA_COMMAND_RAW_OPEN: {
+                if (req.vectored || req.inLen < sizeof(FSARequest) || req.outLen < sizeof(FSAResponse)) {
+                    return (IOSError) FS_ERROR_INVALID_PARAM;
+                }
+                auto *request = (FSARequest *) req.inBuf;
+                auto it       = sRawDevices.find(std::string(request->rawOpen.path, strnlen(request->rawOpen.path, sizeof(request->rawOpen.path))));
+                if (it == sRawDevices.end()) {
+                    return (IOSError) FS_ERROR_NOT_FOUND;
+                }
+                int32_t handle = sNextRawHandle++;
+                sRawHandles.emplace(handle, it->second);
+                ((FSAResponse *) req.outBuf)->rawOpen.handle = handle;
+                return IOS_ERROR_OK;
+            }
+            case FSA_COMMAND_RAW_CLOSE: {
+                if (req.vectored || req.inLen < sizeof(FSARequest)) {
+                    return (IOSError) FS_ERROR_INVALID_PARAM;
+                }
+                auto *request = (FSARequest *) req.inBuf;
+                return sRawHandles.erase(request->rawClose.handle) ? IOS_ERROR_OK : (IOSError) FS_ERROR_INVALID_PARAM;
+            }
+            case FSA_COMMAND_RAW_READ:
+            case FSA_COMMAND_RAW_WRITE: {
+                bool write = req.command == FSA_COMMAND_RAW_WRITE;
+                if (!req.vectored || req.vecIn + req.vecOut != 3 || req.vecIn != (write ? 2u : 1u)) {
+                    return (IOSError) FS_ERROR_INVALID_PARAM;
+                }
+                auto *request = (FSARequest *) req.vec[0].vaddr;
+                // Raw read and write requests share the same layout.
+                FSARequestRawRead raw;
+                memcpy(&raw, write ? (const void *) &request->rawWrite : (const void *) &request->rawRead, sizeof(raw));
+
+                auto handleIt  = sRawHandles.find((int32_t) raw.device_handle);
+                uint64_t bytes = (uint64_t) raw.size * raw.count;
+                if (handleIt == sRawHandles.end()) {
+                    return (IOSError) FS_ERROR_INVALID_PARAM;
+                }
+                auto &device = *handleIt->second;
+                if (raw.size != device.sectorSize || bytes != req.vec[1].len) {
+                    return (IOSError) FS_ERROR_INVALID_PARAM;
+                }
+                if ((!write && !isOutputVectorAligned(req.vec[1])) || !isOutputVectorAligned(req.vec[2])) {
+                    return (IOSError) FS_ERROR_INVALID_ALIGNMENT;
+                }
+                if (raw.blocks_offset > device.sectorCount || raw.count > device.sectorCount - raw.blocks_offset) {
+                    return (IOSError) FS_ERROR_OUT_OF_RANGE;
+                }
+                rawAccess(device, raw.blocks_offset * device.sectorSize, req.vec[1].vaddr, req.vec[1].len, write);
+                return IOS_ERROR_OK;
+            }
+            default:
+                return (IOSError) FS_ERROR_UNSUPPORTED_COMMAND;
+        }
+    }
+
+    IOSError process(Request &req) {
+        std::lock_guard<std::mutex> lock(sStateMutex);
+        auto it = sHandles.find(req.handle);
+        if (it == sHandles.end()) {
+            return IOS_ERROR_INVALID;
+        }
+        if (sServiceMicros) {
+            auto end = Clock::now() + std::chrono::microseconds(sServiceMicros);
+            while (Clock::now() < end) {}
+        }
+        if (it->second == DeviceType::FSA) {
+            return processFSA(req);
+        }
+        sCallCounts[req.command]++;
+        if (req.vectored) {
+            for (uint32_t i = req.vecIn; i < req.vecIn + req.vecOut; i++) {
+                if (!isOutputVectorAligned(req.vec[i])) {
+                    return IOS_ERROR_INVALID;
+                }
+            }
+        }
+        return processStroopwafel(req);
+    }
+
+    void workerLoop() {
+        while (true) {
+            Request *req;
+            {
+                std::unique_lock<std::mutex> lock(sQueueMutex);
+                sQueueCondition.wait(lock, [] { return !sQueue.empty(); });
+                req = sQueue.front();
+                sQueue.pop_front();
+            }
+            std::this_thread::sleep_until(req->readyAt);
+            IOSError res = process(*req);
+            // The request buffer is free again before the callback runs, so the callback may submit the next request.
+            std::unique_lock<std::mutex> lock(sQueueMutex);
+            sOutstanding--;
+            if (req->callback) {
+                lock.unlock();
+                req->callback(res, req->context);
+                delete req;
+            } else {
+                req->result = res;
+                req->done   = true;
+                sQueueCondition.notify_all();
+            }
+        }
+    }
+
+    IOSError submit(Request &req, bool async) {
+        uint32_t roundTrip;
+        {
+            std::lock_guard<std::mutex> lock(sStateMutex);
+            roundTrip = sRoundTripMicros;
+        }
+
+        std::unique_lock<std::mutex> lock(sQueueMutex);
+        if (sOutstanding >= MAX_OUTSTANDING_REQUESTS) {
+            return IOS_ERROR_QFULL;
+        }
+        sOutstanding++;
+        if (!async && roundTrip == 0 && sQueue.empty()) {
+            // Nothing to wait for, process on the calling thread.
+            lock.unlock();
+            IOSError res = process(req);
+            lock.lock();
+            sOutstanding--;
+            return res;
+        }
+
+        std::call_once(sWorkerStarted, [] { std::thread(workerLoop).detach(); });
+        req.readyAt = Clock::now() + std::chrono::microseconds(roundTrip);
+        if (async) {
+            sQueue.push_back(new Request(req));
+            sQueueCondition.notify_all();
+            return IOS_ERROR_OK;
+        }
+        req.done = false;
+        sQueue.push_back(&req);
+        sQueueCondition.notify_all();
+        sQueueCondition.wait(lock, [&req] { return req.done; });
+        return req.result;
+    }
+
+    IOSError ioctl(IOSHandle handle, uint32_t request, void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen, IOSAsyncCallbackFn callback, void *context, bool async) {
+        Request req{};
+        req.handle   = handle;
+        req.command  = request;
+        req.vectored = false;
+        req.inBuf    = inBuf;
+        req.inLen    = inLen;
+        req.outBuf   = outBuf;
+        req.outLen   = outLen;
+        req.callback = callback;
+        req.context  = context;
+        return submit(req, async);
+    }
+
+    IOSError ioctlv(IOSHandle handle, uint32_t request, uint32_t vecIn, uint32_t vecOut, IOSVec *vec, IOSAsyncCallbackFn callback, void *context, bool async) {
+        Request req{};
+        req.handle   = handle;
+        req.command  = request;
+        req.vectored = true;
+        req.vecIn    = vecIn;
+        req.vecOut   = vecOut;
+        req.vec      = vec;
+        req.callback = callback;
+        req.context  = context;
+        return submit(req, async);
+    }
+} // namespace
+
+IOSError IOS_Open(const char *device, IOSOpenMode mode) {
+    (void) mode;
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    DeviceType type;
+    if (strcmp(device, "/dev/stroopwafel") == 0) {
+        type = DeviceType::Stroopwafel;
+    } else if (strcmp(device, "/dev/fsa") == 0) {
+        type = DeviceType::FSA;
+    } else {
+        return IOS_ERROR_NOEXISTS;
+    }
+    IOSHandle handle = sNextHandle++;
+    sHandles.emplace(handle, type);
+    return (IOSError) handle;
+}
+
+IOSError IOS_Close(IOSHandle handle) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    return sHandles.erase(handle) ? IOS_ERROR_OK : IOS_ERROR_INVALID;
+}
+
+IOSError IOS_Ioctl(IOSHandle handle, uint32_t request, void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen) {
+    return ioctl(handle, request, inBuf, inLen, outBuf, outLen, nullptr, nullptr, false);
+}
+
+IOSError IOS_IoctlAsync(IOSHandle handle, uint32_t request, void *inBuf, uint32_t inLen, void *outBuf, uint32_t outLen, IOSAsyncCallbackFn callback, void *context) {
+    if (!callback) {
+        return IOS_ERROR_INVALID;
+    }
+    return ioctl(handle, request, inBuf, inLen, outBuf, outLen, callback, context, true);
+}
+
+IOSError IOS_Ioctlv(IOSHandle handle, uint32_t request, uint32_t vecIn, uint32_t vecOut, IOSVec *vec) {
+    return ioctlv(handle, request, vecIn, vecOut, vec, nullptr, nullptr, false);
+}
+
+IOSError IOS_IoctlvAsync(IOSHandle handle, uint32_t request, uint32_t vecIn, uint32_t vecOut, IOSVec *vec, IOSAsyncCallbackFn callback, void *context) {
+    if (!callback) {
+        return IOS_ERROR_INVALID;
+    }
+    return ioctlv(handle, request, vecIn, vecOut, vec, callback, context, true);
+}
+
+FSError __FSAShimSend(FSAShimBuffer *shim, uint32_t unk) {
+    (void) unk;
+    IOSError res;
+    if (shim->ipcReqType == FSA_IPC_REQUEST_IOCTLV) {
+        res = IOS_Ioctlv(shim->clientHandle, shim->command, shim->ioctlvVecIn, shim->ioctlvVecOut, shim->ioctlvVec);
+    } else {
+        res = IOS_Ioctl(shim->clientHandle, shim->command, &shim->request, sizeof(FSARequest), &shim->response, sizeof(FSAResponse));
+    }
+    return __FSAShimDecodeIosErrorToFsaStatus(shim->clientHandle, res);
+}
+
+FSError __FSAShimDecodeIosErrorToFsaStatus(IOSHandle handle, IOSError error) {
+    (void) handle;
+    // The simulated FSA already reports FSError values.
+    return (FSError) error;
+}
+
+void StroopwafelMock_Reset() {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    sAPIVersion = STROOPWAFEL_API_VERSION;
+    sFwPath.clear();
+    memset(&sMinutePath, 0, sizeof(sMinutePath));
+    memset(&sPluginPath, 0, sizeof(sPluginPath));
+    sMemory.clear();
+    sExecuteHandlers.clear();
+    sMappings.clear();
+    sCallCounts.clear();
+    sInjectedError   = 0;
+    sInjectedCount   = 0;
+    sRoundTripMicros = 0;
+    sServiceMicros   = 0;
+    sRawHandles.clear();
+    sRawDevices.clear();
+}
+
+void StroopwafelMock_SetLatency(uint32_t round_trip_us, uint32_t service_us) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    sRoundTripMicros = round_trip_us;
+    sServiceMicros   = service_us;
+}
+
+void StroopwafelMock_SetAPIVersion(uint32_t version) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    sAPIVersion = version;
+}
+
+void StroopwafelMock_SetMinutePath(uint32_t device, const char *path) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    sMinutePath.device = device;
+    strncpy(sMinutePath.path, path, sizeof(sMinutePath.path) - 1);
+}
+
+void StroopwafelMock_SetPluginPath(uint32_t device, const char *path) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    sPluginPath.device = device;
+    strncpy(sPluginPath.path, path, sizeof(sPluginPath.path) - 1);
+}
+
+uint32_t StroopwafelMock_GetFwPath(char *out, uint32_t size) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    if (size > 0) {
+        uint32_t length = std::min<uint32_t>(sFwPath.size(), size - 1);
+        memcpy(out, sFwPath.data(), length);
+        out[length] = '\0';
+    }
+    return sFwPath.size();
+}
+
+void StroopwafelMock_ReadMemory(uint32_t addr, void *out, uint32_t len) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    readMemory(addr, out, len);
+}
+
+void StroopwafelMock_WriteMemory(uint32_t addr, const void *data, uint32_t len) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    writeMemory(addr, data, len);
+}
+
+void StroopwafelMock_SetExecuteHandler(uint32_t target_addr, StroopwafelMockExecuteFn handler) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    if (handler) {
+        sExecuteHandlers[target_addr] = handler;
+    } else {
+        sExecuteHandlers.erase(target_addr);
+    }
+}
+
+uint32_t StroopwafelMock_GetMappingCount() {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    return sMappings.size();
+}
+
+int StroopwafelMock_GetMapping(uint32_t index, uint32_t *paddr, uint32_t *vaddr, uint32_t *size) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    if (index >= sMappings.size()) {
+        return -1;
+    }
+    *paddr = sMappings[index].paddr;
+    *vaddr = sMappings[index].vaddr;
+    *size  = sMappings[index].size;
+    return 0;
+}
+
+uint32_t StroopwafelMock_GetCallCount(uint32_t command) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    auto it = sCallCounts.find(command);
+    return it != sCallCounts.end() ? it->second : 0;
+}
+
+void StroopwafelMock_InjectError(int32_t error, uint32_t count) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    sInjectedError = error;
+    sInjectedCount = count;
+}
+
+void StroopwafelMock_AddRawDevice(const char *device_path, uint32_t sector_size, uint64_t sector_count) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    auto device         = std::make_shared<RawDevice>();
+    device->sectorSize  = sector_size;
+    device->sectorCount = sector_count;
+
+    sRawDevices[device_path] = device;
+}
+
+int StroopwafelMock_ReadRawDevice(const char *device_path, uint64_t offset, void *out, uint32_t len) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    auto it = sRawDevices.find(device_path);
+    if (it == sRawDevices.end()) {
+        return -1;
+    }
+    rawAccess(*it->second, offset, out, len, false);
+    return 0;
+}
+
+int StroopwafelMock_WriteRawDevice(const char *device_path, uint64_t offset, const void *data, uint32_t len) {
+    std::lock_guard<std::mutex> lock(sStateMutex);
+    auto it = sRawDevices.find(device_path);
+    if (it == sRawDevices.end()) {
+        return -1;
+    }
+    rawAccess(*it->second, offset, (void *) data, len, true);
+    return 0;
+}
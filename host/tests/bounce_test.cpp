@@ -0,0 +1,71 @@
+/**
+ * Unaligned caller buffers are bounced through aligned IPC buffers, the simulated IOS rejects unaligned output vectors.
+ */
+#include "stroopwafel/commands.h"
+#include "test.h"
+
+namespace {
+    constexpr uint32_t BASE           = 0x10000000;
+    constexpr uint32_t EXECUTE_TARGET = 0x05000000;
+
+    void testWriteMemory() {
+        CHECK(test::begin());
+
+        uint8_t data[0x300];
+        test::fillPattern(data, sizeof(data), 1);
+        StroopwafelWrite writes[3] = {{BASE, data + 1, 100}, {BASE + 0x1000, data + 3, 0x200}, {BASE + 0x2000, data, 5}};
+        CHECK_OK(Stroopwafel_WriteMemory(3, writes));
+        for (const auto &write : writes) {
+            CHECK(memcmp(test::readMock(write.dest_addr, write.length).data(), write.src, write.length) == 0);
+        }
+    }
+
+    void testExecute() {
+        CHECK(test::begin());
+
+        uint8_t config[0x50], output[0x70];
+        test::fillPattern(config, sizeof(config), 2);
+        memset(output, 0xEE, sizeof(output));
+        CHECK_OK(Stroopwafel_Execute(EXECUTE_TARGET, config + 1, 33, output + 3, 33));
+        CHECK(memcmp(output + 3, config + 1, 33) == 0);
+        CHECK_EQ(output[2], 0xEE);
+        CHECK_EQ(output[36], 0xEE);
+    }
+
+    void testAsync() {
+        CHECK(test::begin());
+
+        StroopwafelCompletionQueue *queue = nullptr;
+        CHECK_OK(Stroopwafel_CreateCompletionQueue(4, &queue));
+        if (!queue) {
+            return;
+        }
+        StroopwafelAsyncParams params = {queue, nullptr, nullptr};
+
+        uint8_t config[0x50], output[0x70], data[0x100];
+        test::fillPattern(config, sizeof(config), 3);
+        test::fillPattern(data, sizeof(data), 4);
+        memset(output, 0xEE, sizeof(output));
+        StroopwafelWrite write = {BASE, data + 7, 0xC1};
+        CHECK_OK(Stroopwafel_ExecuteAsync(EXECUTE_TARGET, config + 1, 33, output + 5, 33, &params, nullptr));
+        CHECK_OK(Stroopwafel_WriteMemoryAsync(1, &write, &params, nullptr));
+
+        StroopwafelCompletion completion;
+        for (uint32_t i = 0; i < 2; i++) {
+            CHECK_OK(Stroopwafel_WaitCompletion(queue, &completion));
+            CHECK_OK(completion.status);
+        }
+        CHECK(memcmp(output + 5, config + 1, 33) == 0);
+        CHECK_EQ(output[4], 0xEE);
+        CHECK_EQ(output[38], 0xEE);
+        CHECK(memcmp(test::readMock(BASE, write.length).data(), write.src, write.length) == 0);
+        CHECK_OK(Stroopwafel_DestroyCompletionQueue(queue));
+    }
+} // namespace
+
+int main() {
+    testWriteMemory();
+    testExecute();
+    testAsync();
+    return test::finish("bounce_test");
+}
@@ -0,0 +1,103 @@
+/**
+ * FSAEx_RawWriteVEx/FSAEx_RawReadVEx: overlapping extents are applied in list order, so the later extent wins.
+ */
+#include "stroopwafel/fsa.h"
+#include "test.h"
+#include <coreinit/ios.h>
+
+namespace {
+    constexpr const char *DEVICE   = "/dev/slc01";
+    constexpr uint32_t SECTOR_SIZE = 512;
+    constexpr uint64_t NUM_SECTORS = 8192;
+
+    struct RawDevice {
+        int fsa;
+        int32_t handle;
+    };
+
+    bool openDevice(RawDevice *device) {
+        StroopwafelMock_Reset();
+        StroopwafelMock_AddRawDevice(DEVICE, SECTOR_SIZE, NUM_SECTORS);
+        device->fsa = IOS_Open("/dev/fsa", IOS_OPEN_READ);
+        return device->fsa >= 0 && FSAEx_RawOpenEx(device->fsa, DEVICE, &device->handle) == FS_ERROR_OK;
+    }
+
+    void closeDevice(RawDevice *device) {
+        FSAEx_RawCloseEx(device->fsa, device->handle);
+        IOS_Close(device->fsa);
+    }
+
+    uint8_t sectorByte(uint64_t sector) {
+        uint8_t data[SECTOR_SIZE];
+        StroopwafelMock_ReadRawDevice(DEVICE, sector * SECTOR_SIZE, data, SECTOR_SIZE);
+        return data[0];
+    }
+
+    void testLaterExtentWins() {
+        RawDevice device;
+        CHECK(openDevice(&device));
+
+        // The second extent starts before the first one and covers its beginning.
+        std::vector<uint8_t> a(1100 * SECTOR_SIZE, 'A'), b(2000 * SECTOR_SIZE, 'B');
+        FSAExRawExtent extents[2] = {{1000, 1100, a.data()}, {0, 2000, b.data()}};
+        CHECK_EQ(FSAEx_RawWriteVEx(device.fsa, SECTOR_SIZE, extents, 2, device.handle), FS_ERROR_OK);
+        CHECK_EQ(sectorByte(0), 'B');
+        CHECK_EQ(sectorByte(999), 'B');
+        CHECK_EQ(sectorByte(1000), 'B');
+        CHECK_EQ(sectorByte(1500), 'B');
+        CHECK_EQ(sectorByte(1999), 'B');
+        CHECK_EQ(sectorByte(2000), 'A');
+        CHECK_EQ(sectorByte(2099), 'A');
+        closeDevice(&device);
+    }
+
+    void testOverlapChain() {
+        RawDevice device;
+        CHECK(openDevice(&device));
+
+        // Every extent overlaps the previous one, the chain ends up in a single run.
+        std::vector<std::vector<uint8_t>> buffers(6);
+        FSAExRawExtent extents[6];
+        for (uint32_t i = 0; i < 6; i++) {
+            buffers[i].assign(600 * SECTOR_SIZE, 'a' + i);
+            extents[i] = {(uint64_t) i * 500, 600, buffers[i].data()};
+        }
+        CHECK_EQ(FSAEx_RawWriteVEx(device.fsa, SECTOR_SIZE, extents, 6, device.handle), FS_ERROR_OK);
+        CHECK_EQ(sectorByte(0), 'a');
+        CHECK_EQ(sectorByte(550), 'b');
+        CHECK_EQ(sectorByte(1050), 'c');
+        CHECK_EQ(sectorByte(2999), 'f');
+        closeDevice(&device);
+    }
+
+    void testScatteredRead() {
+        RawDevice device;
+        CHECK(openDevice(&device));
+
+        std::vector<uint8_t> image(NUM_SECTORS * SECTOR_SIZE);
+        test::fillPattern(image.data(), image.size(), 5);
+        StroopwafelMock_WriteRawDevice(DEVICE, 0, image.data(), image.size());
+
+        // Unsorted, overlapping and close extents into unaligned buffers.
+        std::vector<std::vector<uint8_t>> buffers;
+        std::vector<FSAExRawExtent> extents;
+        for (uint32_t i = 0; i < 100; i++) {
+            uint64_t sector = (i * 677) % (NUM_SECTORS - 8);
+            uint32_t count  = 1 + i % 8;
+            buffers.emplace_back(count * SECTOR_SIZE + 1);
+            extents.push_back({sector, count, buffers.back().data() + 1});
+        }
+        CHECK_EQ(FSAEx_RawReadVEx(device.fsa, SECTOR_SIZE, extents.data(), extents.size(), device.handle), FS_ERROR_OK);
+        for (const auto &extent : extents) {
+            CHECK(memcmp(extent.data, image.data() + extent.blocks_offset * SECTOR_SIZE, extent.cnt * SECTOR_SIZE) == 0);
+        }
+        closeDevice(&device);
+    }
+} // namespace
+
+int main() {
+    testLaterExtentWins();
+    testOverlapChain();
+    testScatteredRead();
+    return test::finish("raw_extents_test");
+}
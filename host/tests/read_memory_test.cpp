@@ -0,0 +1,84 @@
+/**
+ * Stroopwafel_ReadMemory: adjacent and overlapping ranges are coalesced, unaligned destinations are staged.
+ */
+#include "stroopwafel/commands.h"
+#include "test.h"
+#include <malloc.h>
+
+namespace {
+    constexpr uint32_t BASE = 0x10000000;
+    constexpr uint32_t SIZE = 0x20000;
+
+    std::vector<uint8_t> fillMock() {
+        std::vector<uint8_t> image(SIZE);
+        test::fillPattern(image.data(), SIZE, 7);
+        StroopwafelMock_WriteMemory(BASE, image.data(), SIZE);
+        return image;
+    }
+
+    uint32_t readCalls() {
+        return StroopwafelMock_GetCallCount(STROOPWAFEL_IOCTLV_READ_MEMORY);
+    }
+
+    void testCoalescing() {
+        CHECK(test::begin());
+        auto image = fillMock();
+
+        // 64 touching and overlapping reads in reverse order end up in a single range.
+        std::vector<uint8_t> out(64 * 0x40);
+        std::vector<StroopwafelRead> reads;
+        for (uint32_t i = 64; i-- > 0;) {
+            reads.push_back({BASE + 0x1000 + i * 0x30, out.data() + i * 0x40, 0x40});
+        }
+        uint32_t before = readCalls();
+        CHECK_OK(Stroopwafel_ReadMemory(reads.size(), reads.data()));
+        CHECK_EQ(readCalls() - before, 1);
+        for (const auto &read : reads) {
+            CHECK(memcmp(read.dest, image.data() + (read.src_addr - BASE), read.length) == 0);
+        }
+    }
+
+    void testStaging() {
+        CHECK(test::begin());
+        auto image = fillMock();
+
+        // Odd destinations and lengths, the bytes around every destination must stay untouched.
+        constexpr uint32_t numReads = 40;
+        std::vector<uint8_t> out(numReads * 0x200, 0xEE);
+        std::vector<StroopwafelRead> reads;
+        for (uint32_t i = 0; i < numReads; i++) {
+            reads.push_back({BASE + i * 0x777 + (i % 3), out.data() + i * 0x200 + 1 + (i % 5), 1 + (i * 37) % 0x1F0});
+        }
+        // A large aligned read is passed to IOS directly.
+        auto *aligned = (uint8_t *) memalign(0x40, 0x8000);
+        reads.push_back({BASE + 0x10000, aligned, 0x8000});
+
+        CHECK_OK(Stroopwafel_ReadMemory(reads.size(), reads.data()));
+        for (uint32_t i = 0; i < reads.size(); i++) {
+            CHECK(memcmp(reads[i].dest, image.data() + (reads[i].src_addr - BASE), reads[i].length) == 0);
+        }
+        for (uint32_t i = 0; i < numReads; i++) {
+            auto *dest = (uint8_t *) reads[i].dest;
+            CHECK_EQ(dest[-1], 0xEE);
+            CHECK_EQ(dest[reads[i].length], 0xEE);
+        }
+        free(aligned);
+    }
+
+    void testInvalidReads() {
+        CHECK(test::begin());
+
+        uint32_t out;
+        StroopwafelRead outOfRange = {0xFFFFFFFE, &out, 4};
+        CHECK_EQ(Stroopwafel_ReadMemory(1, &outOfRange), STROOPWAFEL_RESULT_INVALID_ARGUMENT);
+        StroopwafelRead empty = {BASE, nullptr, 0};
+        CHECK_OK(Stroopwafel_ReadMemory(1, &empty));
+    }
+} // namespace
+
+int main() {
+    testCoalescing();
+    testStaging();
+    testInvalidReads();
+    return test::finish("read_memory_test");
+}
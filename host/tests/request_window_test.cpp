@@ -0,0 +1,71 @@
+/**
+ * Calls that split into many requests keep them within the IOS limit of 0x30 outstanding requests. The simulated IOS
+ * fails every request beyond that with IOS_ERROR_QFULL, the latency makes sure the requests overlap.
+ */
+#include "stroopwafel/commands.h"
+#include "test.h"
+
+namespace {
+    constexpr uint32_t BASE           = 0x10000000;
+    constexpr uint32_t EXECUTE_TARGET = 0x05000000;
+
+    void testReadMemoryWindow() {
+        CHECK(test::begin());
+        StroopwafelMock_SetLatency(200, 1);
+
+        std::vector<uint8_t> image(0x100000);
+        test::fillPattern(image.data(), image.size(), 3);
+        StroopwafelMock_WriteMemory(BASE, image.data(), image.size());
+
+        // Far apart, so nothing is coalesced: 1000 ranges take 67 requests.
+        std::vector<uint32_t> out(1000);
+        std::vector<StroopwafelRead> reads;
+        for (uint32_t i = 0; i < 1000; i++) {
+            reads.push_back({BASE + i * 0x400, &out[i], sizeof(uint32_t)});
+        }
+        CHECK_OK(Stroopwafel_ReadMemory(reads.size(), reads.data()));
+        for (uint32_t i = 0; i < 1000; i++) {
+            CHECK(memcmp(&out[i], image.data() + i * 0x400, sizeof(uint32_t)) == 0);
+        }
+    }
+
+    void testMapMemoryBatchWindow() {
+        CHECK(test::begin());
+        StroopwafelMock_SetLatency(200, 1);
+
+        // Gaps between the regions, so each one is its own MAP_MEMORY request.
+        std::vector<StroopwafelMapMemory> regions;
+        for (uint32_t i = 0; i < 64; i++) {
+            regions.push_back({0x80000000 + i * 0x2000, 0x20000000 + i * 0x2000, 0x1000, 1, 2, 0});
+        }
+        CHECK_OK(Stroopwafel_MapMemoryBatch(regions.size(), regions.data()));
+        CHECK_EQ(StroopwafelMock_GetMappingCount(), 64);
+    }
+
+    void testRunPreparedWindow() {
+        CHECK(test::begin());
+        StroopwafelMock_SetLatency(200, 1);
+
+        // Without a handler the simulated IOS echoes the config into the output.
+        StroopwafelPreparedExecute *handle = nullptr;
+        CHECK_OK(Stroopwafel_PrepareExecute(EXECUTE_TARGET, 8, 8, &handle));
+        if (!handle) {
+            return;
+        }
+        std::vector<uint64_t> configs(500), outputs(500);
+        for (uint32_t i = 0; i < 500; i++) {
+            configs[i] = 0x1000000000ull + i;
+        }
+        CHECK_OK(Stroopwafel_RunPrepared(handle, 500, configs.data(), 8, outputs.data(), 8));
+        CHECK(configs == outputs);
+        CHECK_EQ(StroopwafelMock_GetCallCount(STROOPWAFEL_IOCTLV_EXECUTE), 500);
+        CHECK_OK(Stroopwafel_FreePrepared(handle));
+    }
+} // namespace
+
+int main() {
+    testReadMemoryWindow();
+    testMapMemoryBatchWindow();
+    testRunPreparedWindow();
+    return test::finish("request_window_test");
+}
@@ -0,0 +1,66 @@
+/**
+ * Minimal checks for the host tests. Every tests/<name>.cpp is a program of its own that runs its cases against the
+ * simulated IOS, see `make -C host check`. A failed check is printed and the remaining checks still run, the program
+ * exits with 1 if any of them failed.
+ */
+#pragma once
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel_mock.h"
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+namespace test {
+    inline int failures = 0;
+
+    inline void check(bool ok, const char *expr, const char *file, int line) {
+        if (!ok) {
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expr);
+            failures++;
+        }
+    }
+
+    inline void checkEq(long long a, long long b, const char *exprA, const char *exprB, const char *file, int line) {
+        if (a != b) {
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", file, line, exprA, exprB, a, b);
+            failures++;
+        }
+    }
+
+    // Every case starts with a fresh simulated IOS and an initialized library.
+    inline bool begin() {
+        Stroopwafel_DeInitLibrary();
+        StroopwafelMock_Reset();
+        return Stroopwafel_InitLibrary() == STROOPWAFEL_RESULT_SUCCESS;
+    }
+
+    inline int finish(const char *name) {
+        Stroopwafel_DeInitLibrary();
+        if (failures > 0) {
+            fprintf(stderr, "%s: %d check(s) failed\n", name, failures);
+            return 1;
+        }
+        printf("%s: ok\n", name);
+        return 0;
+    }
+
+    inline std::vector<uint8_t> readMock(uint32_t addr, uint32_t length) {
+        std::vector<uint8_t> data(length);
+        StroopwafelMock_ReadMemory(addr, data.data(), length);
+        return data;
+    }
+
+    // Fills data with a pattern that differs for every seed and offset.
+    inline void fillPattern(uint8_t *data, uint32_t length, uint32_t seed) {
+        uint32_t state = seed * 2654435761u + 1;
+        for (uint32_t i = 0; i < length; i++) {
+            state   = state * 1103515245u + 12345u;
+            data[i] = (uint8_t) (state >> 16);
+        }
+    }
+} // namespace test
+
+#define CHECK(expr)    test::check((expr), #expr, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) test::checkEq((long long) (a), (long long) (b), #a, #b, __FILE__, __LINE__)
+#define CHECK_OK(expr) CHECK_EQ((expr), STROOPWAFEL_RESULT_SUCCESS)
@@ -0,0 +1,181 @@
+/**
+ * Stroopwafel_WriteMemoryBatch and patch sets: overlapping writes are applied in order, so the last one wins.
+ */
+#include "stroopwafel/commands.h"
+#include "stroopwafel/patchset.h"
+#include "test.h"
+#include <malloc.h>
+
+namespace {
+    constexpr uint32_t BASE = 0x10000000;
+
+    // Applies the writes one after another to a local copy of [BASE, BASE + size).
+    std::vector<uint8_t> expectedImage(const StroopwafelWrite *writes, uint32_t num_writes, uint32_t size) {
+        std::vector<uint8_t> image(size);
+        for (uint32_t i = 0; i < num_writes; i++) {
+            memcpy(image.data() + (writes[i].dest_addr - BASE), writes[i].src, writes[i].length);
+        }
+        return image;
+    }
+
+    void testLastWriteWins() {
+        CHECK(test::begin());
+
+        uint8_t data[5][0x100];
+        for (uint32_t i = 0; i < 5; i++) {
+            memset(data[i], 'a' + i, sizeof(data[i]));
+        }
+        // Nested, partially overlapping, identical start addresses and a write that is completely overwritten.
+        StroopwafelWrite writes[] = {
+                {BASE + 0x000, data[0], 0x100},
+                {BASE + 0x010, data[1], 0x20},
+                {BASE + 0x000, data[2], 0x08},
+                {BASE + 0x080, data[3], 0x10},
+                {BASE + 0x080, data[4], 0x10},
+                {BASE + 0x0F0, data[1], 0x20},
+                {BASE + 0x300, data[3], 0x04},
+                {BASE + 0x300, data[0], 0x00},
+        };
+        constexpr uint32_t numWrites = sizeof(writes) / sizeof(writes[0]);
+
+        uint32_t before = StroopwafelMock_GetCallCount(STROOPWAFEL_IOCTLV_WRITE_MEMORY);
+        CHECK_OK(Stroopwafel_WriteMemoryBatch(numWrites, writes));
+        CHECK_EQ(StroopwafelMock_GetCallCount(STROOPWAFEL_IOCTLV_WRITE_MEMORY) - before, 1);
+        CHECK(test::readMock(BASE, 0x400) == expectedImage(writes, numWrites, 0x400));
+    }
+
+    void testMergeCap() {
+        CHECK(test::begin());
+
+        // Touching writes beyond 64 KiB and large aligned writes are split into several runs, but still sent together.
+        std::vector<uint8_t> data(0x60000);
+        test::fillPattern(data.data(), data.size(), 1);
+        auto *large = (uint8_t *) memalign(0x40, 0x20000);
+        test::fillPattern(large, 0x20000, 2);
+
+        std::vector<StroopwafelWrite> writes;
+        for (uint32_t i = 0; i < 20; i++) {
+            writes.push_back({BASE + i * 0x1000, data.data() + i * 0x1000 + 1, 0x1000});
+        }
+        writes.push_back({BASE + 0x20000, large, 0x20000});
+        writes.push_back({BASE + 0x40000, large, 0x20000});
+        // Overlaps the end of the first large write and the start of the second one.
+        writes.push_back({BASE + 0x3FFF0, data.data() + 3, 0x20});
+
+        CHECK_OK(Stroopwafel_WriteMemoryBatch(writes.size(), writes.data()));
+        CHECK(test::readMock(BASE, 0x60000) == expectedImage(writes.data(), writes.size(), 0x60000));
+        free(large);
+    }
+
+    void testInvalidBatch() {
+        CHECK(test::begin());
+
+        uint8_t data[0x10] = {};
+        StroopwafelWrite outOfRange = {0xFFFFFFF8, data, 0x10};
+        CHECK_EQ(Stroopwafel_WriteMemoryBatch(1, &outOfRange), STROOPWAFEL_RESULT_INVALID_ARGUMENT);
+        StroopwafelWrite noSource = {BASE, nullptr, 0x10};
+        CHECK_EQ(Stroopwafel_WriteMemoryBatch(1, &noSource), STROOPWAFEL_RESULT_INVALID_ARGUMENT);
+    }
+
+    void testSerializedPatchSet() {
+        CHECK(test::begin());
+
+        uint8_t data[3][0x200];
+        for (uint32_t i = 0; i < 3; i++) {
+            test::fillPattern(data[i], sizeof(data[i]), 10 + i);
+        }
+        StroopwafelWrite writes[] = {
+                {BASE + 0x1000, data[0], 0x200},
+                {BASE + 0x1100, data[1], 0x40},
+                {BASE + 0x1000, data[2], 0x10},
+                {BASE + 0x1200, data[1], 0x100},
+                {BASE + 0x2000, data[2], 0x33},
+        };
+        constexpr uint32_t numWrites = sizeof(writes) / sizeof(writes[0]);
+
+        uint32_t size = 0;
+        CHECK_OK(Stroopwafel_SerializePatchSet(numWrites, writes, nullptr, 0, &size));
+        auto *buffer = (uint8_t *) memalign(0x40, size);
+        CHECK_OK(Stroopwafel_SerializePatchSet(numWrites, writes, buffer, size, &size));
+
+        StroopwafelPatchSet set;
+        CHECK_OK(Stroopwafel_OpenPatchSet(buffer, size, &set));
+        // Overlaps are resolved when serializing, the stored entries are sorted and disjoint.
+        uint64_t prevEnd = 0;
+        for (uint32_t i = 0; i < set.num_entries; i++) {
+            StroopwafelWrite entry;
+            CHECK_OK(Stroopwafel_GetPatchSetEntry(&set, i, &entry));
+            CHECK(entry.dest_addr >= prevEnd);
+            prevEnd = (uint64_t) entry.dest_addr + entry.length;
+        }
+
+        CHECK_OK(Stroopwafel_ApplyPatchSet(&set));
+        CHECK(test::readMock(BASE, 0x3000) == expectedImage(writes, numWrites, 0x3000));
+        Stroopwafel_ClosePatchSet(&set);
+        free(buffer);
+    }
+
+    void writeBE32(uint8_t *p, uint32_t value) {
+        p[0] = value >> 24;
+        p[1] = value >> 16;
+        p[2] = value >> 8;
+        p[3] = value;
+    }
+
+    void testOverlappingPatchSetEntries() {
+        CHECK(test::begin());
+
+        // Hand-built set whose index overlaps, entries with the same address keep their index order.
+        struct {
+            uint32_t dest_addr;
+            uint32_t length;
+            uint8_t fill;
+        } entries[] = {
+                {BASE + 0x000, 0x40, 'x'},
+                {BASE + 0x000, 0x20, 'y'},
+                {BASE + 0x010, 0x40, 'z'},
+                {BASE + 0x040, 0x00, '-'},
+                {BASE + 0x050, 0x10, 'w'},
+                {BASE + 0x20000, 0x10, 'v'},
+        };
+        constexpr uint32_t numEntries = sizeof(entries) / sizeof(entries[0]);
+        constexpr uint32_t indexSize  = numEntries * sizeof(StroopwafelPatchSetEntry);
+        constexpr uint32_t payloadOff = (sizeof(StroopwafelPatchSetHeader) + indexSize + 0x3F) & ~0x3Fu;
+
+        std::vector<uint8_t> file(payloadOff + numEntries * 0x40);
+        writeBE32(&file[0], STROOPWAFEL_PATCHSET_MAGIC);
+        file[5] = STROOPWAFEL_PATCHSET_VERSION;
+        file[7] = sizeof(StroopwafelPatchSetHeader);
+        writeBE32(&file[8], numEntries);
+        writeBE32(&file[12], sizeof(StroopwafelPatchSetHeader));
+        writeBE32(&file[16], payloadOff);
+        writeBE32(&file[20], numEntries * 0x40);
+
+        std::vector<uint8_t> expected(0x20040);
+        for (uint32_t i = 0; i < numEntries; i++) {
+            uint8_t *entry = &file[sizeof(StroopwafelPatchSetHeader) + i * sizeof(StroopwafelPatchSetEntry)];
+            writeBE32(entry, entries[i].dest_addr);
+            writeBE32(entry + 4, entries[i].length);
+            writeBE32(entry + 8, i * 0x40);
+            memset(&file[payloadOff + i * 0x40], entries[i].fill, 0x40);
+            memset(&expected[entries[i].dest_addr - BASE], entries[i].fill, entries[i].length);
+        }
+
+        StroopwafelPatchSet set;
+        CHECK_OK(Stroopwafel_OpenPatchSet(file.data(), file.size(), &set));
+        uint32_t before = StroopwafelMock_GetCallCount(STROOPWAFEL_IOCTLV_WRITE_MEMORY);
+        CHECK_OK(Stroopwafel_ApplyPatchSet(&set));
+        CHECK_EQ(StroopwafelMock_GetCallCount(STROOPWAFEL_IOCTLV_WRITE_MEMORY) - before, 1);
+        CHECK(test::readMock(BASE, expected.size()) == expected);
+        Stroopwafel_ClosePatchSet(&set);
+    }
+} // namespace
+
+int main() {
+    testLastWriteWins();
+    testMergeCap();
+    testInvalidBatch();
+    testSerializedPatchSet();
+    testOverlappingPatchSetEntries();
+    return test::finish("write_batch_test");
+}
@@ -0,0 +1,110 @@
+/**
+ * Write shadow: unchanged writes are skipped, invalidated ranges and ranges written around the shadow are sent again.
+ */
+#include "stroopwafel/commands.h"
+#include "test.h"
+
+namespace {
+    constexpr uint32_t BASE = 0x10000000;
+
+    uint32_t writeCalls() {
+        return StroopwafelMock_GetCallCount(STROOPWAFEL_IOCTLV_WRITE_MEMORY);
+    }
+
+    void testSkipUnchanged() {
+        CHECK(test::begin());
+        CHECK_OK(Stroopwafel_EnableWriteShadow(0x10000));
+
+        std::vector<uint8_t> data(0x400);
+        test::fillPattern(data.data(), data.size(), 1);
+        StroopwafelWrite write = {BASE, data.data(), (uint32_t) data.size()};
+        CHECK_OK(Stroopwafel_WriteMemory(1, &write));
+
+        uint32_t before = writeCalls();
+        CHECK_OK(Stroopwafel_WriteMemory(1, &write));
+        CHECK_EQ(writeCalls() - before, 0);
+
+        // Only the changed block is sent.
+        data[0x123] ^= 0xFF;
+        CHECK_OK(Stroopwafel_WriteMemory(1, &write));
+        CHECK_EQ(writeCalls() - before, 1);
+        CHECK(test::readMock(BASE, data.size()) == data);
+
+        StroopwafelWriteShadowStats stats;
+        CHECK_OK(Stroopwafel_GetWriteShadowStats(&stats));
+        CHECK_EQ(stats.skipped_writes, 1);
+        CHECK_EQ(stats.bytes_requested, 3 * data.size());
+        CHECK(stats.bytes_written < 2 * data.size());
+        CHECK_OK(Stroopwafel_DisableWriteShadow());
+    }
+
+    void testInvalidate() {
+        CHECK(test::begin());
+        CHECK_OK(Stroopwafel_EnableWriteShadow(0x10000));
+
+        std::vector<uint8_t> data(0x100, 0x5A);
+        StroopwafelWrite write = {BASE, data.data(), (uint32_t) data.size()};
+        CHECK_OK(Stroopwafel_WriteMemory(1, &write));
+
+        // Changed behind the shadow's back, the next write is only sent after invalidating the range.
+        std::vector<uint8_t> other(0x10, 0x00);
+        StroopwafelMock_WriteMemory(BASE + 0x40, other.data(), other.size());
+        CHECK_OK(Stroopwafel_InvalidateWriteShadow(BASE + 0x40, 0x10));
+        uint32_t before = writeCalls();
+        CHECK_OK(Stroopwafel_WriteMemory(1, &write));
+        CHECK_EQ(writeCalls() - before, 1);
+        CHECK(test::readMock(BASE, data.size()) == data);
+
+        CHECK_OK(Stroopwafel_InvalidateWriteShadow(0, 0));
+        StroopwafelWriteShadowStats stats;
+        CHECK_OK(Stroopwafel_GetWriteShadowStats(&stats));
+        CHECK_EQ(stats.num_ranges, 0);
+        CHECK_OK(Stroopwafel_DisableWriteShadow());
+    }
+
+    void testAsyncWriteCompletion() {
+        CHECK(test::begin());
+        CHECK_OK(Stroopwafel_EnableWriteShadow(0x10000));
+        StroopwafelMock_SetLatency(2000, 1);
+
+        StroopwafelCompletionQueue *queue = nullptr;
+        CHECK_OK(Stroopwafel_CreateCompletionQueue(4, &queue));
+        if (!queue) {
+            return;
+        }
+        StroopwafelAsyncParams params = {queue, nullptr, nullptr};
+
+        std::vector<uint8_t> original(0x100, 0x11), changed(0x100, 0x22);
+        StroopwafelWrite write      = {BASE, original.data(), (uint32_t) original.size()};
+        StroopwafelWrite asyncWrite = {BASE, changed.data(), (uint32_t) changed.size()};
+        CHECK_OK(Stroopwafel_WriteMemoryAsync(1, &asyncWrite, &params, nullptr));
+        // Tracked again while the asynchronous write is still in flight.
+        CHECK_OK(Stroopwafel_WriteMemory(1, &write));
+
+        StroopwafelCompletion completion;
+        CHECK_OK(Stroopwafel_WaitCompletion(queue, &completion));
+        CHECK_OK(completion.status);
+        // The synchronous write was submitted last.
+        CHECK(test::readMock(BASE, original.size()) == original);
+
+        // The shadow can't know the order in which IOS processed both writes, the completion dropped the range.
+        uint32_t before = writeCalls();
+        CHECK_OK(Stroopwafel_WriteMemory(1, &write));
+        CHECK_EQ(writeCalls() - before, 1);
+        CHECK(test::readMock(BASE, original.size()) == original);
+
+        before = writeCalls();
+        CHECK_OK(Stroopwafel_WriteMemory(1, &write));
+        CHECK_EQ(writeCalls() - before, 0);
+
+        CHECK_OK(Stroopwafel_DestroyCompletionQueue(queue));
+        CHECK_OK(Stroopwafel_DisableWriteShadow());
+    }
+} // namespace
+
+int main() {
+    testSkipUnchanged();
+    testInvalidate();
+    testAsyncWriteCompletion();
+    return test::finish("write_shadow_test");
+}
@@ -0,0 +1,436 @@
+/**
+ * Measures throughput and latency of the Stroopwafel_* entry points against the simulated IOS.
+ *
+ * usage: stroopwafel_bench [-t max_threads] [-d duration_ms] [-l round_trip_us,service_us] [-H num_handles] [-f csv|json] [filter]
+ *   -t  run every case with 1, 2, 4, ... up to max_threads threads (default 4)
+ *   -d  how long every case runs per thread count (default 200 ms)
+ *   -l  IPC latency of the simulated IOS, see StroopwafelMock_SetLatency (default 0,0)
+ *   -H  number of /dev/stroopwafel handles passed to Stroopwafel_InitLibraryEx (default STROOPWAFEL_MAX_HANDLES)
+ *   -f  output format, a CSV table with a header line (default) or one JSON object per line
+ *   filter only runs the cases whose name contains it
+ *
+ * Every result line covers one case at one thread count: the number of calls, errors, calls/s, payload bytes/s,
+ * /dev/stroopwafel requests per call and the p50/p99/max latency of a single call in microseconds.
+ * Every thread works on its own address range, so only the library and the simulated IOS are shared.
+ */
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel_mock.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr uint32_t MEMORY_BASE      = 0x20000000;
+    constexpr uint32_t THREAD_MEMORY    = 0x01000000;
+    constexpr uint32_t EXECUTE_TARGET   = 0x05100000;
+    constexpr uint32_t MAP_BASE         = 0x13000000;
+    constexpr uint32_t ASYNC_QUEUE_SIZE = 4;
+    constexpr uint32_t MAX_COMMAND      = 0x10;
+
+    struct ThreadContext {
+        uint32_t index;
+        uint8_t *data;
+        uint8_t *out;
+        std::vector<StroopwafelWrite> writes;
+        std::vector<StroopwafelRead> reads;
+        StroopwafelCompletionQueue *queue;
+        StroopwafelPreparedExecute *prepared;
+        std::vector<uint32_t> latencies;
+        uint64_t calls;
+        uint64_t errors;
+    };
+
+    struct Case;
+    using RunFn = StroopwafelStatus (*)(ThreadContext &ctx, const Case &c);
+
+    struct Case {
+        const char *name;
+        RunFn run;
+        // Bytes per write/read/config and number of them per call.
+        uint32_t payload;
+        uint32_t batch;
+        bool writeShadow;
+    };
+
+    uint32_t stride(const Case &c) {
+        return (c.payload + 0x3F) & ~0x3Fu;
+    }
+
+    uint32_t threadBase(const ThreadContext &ctx) {
+        return MEMORY_BASE + ctx.index * THREAD_MEMORY;
+    }
+
+    StroopwafelStatus runGetAPIVersion(ThreadContext &, const Case &) {
+        uint32_t version;
+        return Stroopwafel_GetAPIVersion(&version);
+    }
+
+    StroopwafelStatus runGetCapabilities(ThreadContext &, const Case &) {
+        uint32_t capabilities;
+        return Stroopwafel_GetCapabilities(&capabilities);
+    }
+
+    StroopwafelStatus runGetMinutePath(ThreadContext &, const Case &) {
+        StroopwafelMinutePath path;
+        return Stroopwafel_GetMinutePath(&path);
+    }
+
+    StroopwafelStatus runGetPluginPath(ThreadContext &, const Case &) {
+        StroopwafelMinutePath path;
+        return Stroopwafel_GetPluginPath(&path);
+    }
+
+    StroopwafelStatus runSetFwPath(ThreadContext &, const Case &) {
+        return Stroopwafel_SetFwPath("/vol/external01/wiiu/bench.img");
+    }
+
+    StroopwafelStatus runWriteMemory(ThreadContext &ctx, const Case &c) {
+        return Stroopwafel_WriteMemory(c.batch, ctx.writes.data());
+    }
+
+    StroopwafelStatus runWriteMemoryBatch(ThreadContext &ctx, const Case &c) {
+        return Stroopwafel_WriteMemoryBatch(c.batch, ctx.writes.data());
+    }
+
+    StroopwafelStatus runReadMemory(ThreadContext &ctx, const Case &c) {
+        return Stroopwafel_ReadMemory(c.batch, ctx.reads.data());
+    }
+
+    StroopwafelStatus runExecute(ThreadContext &ctx, const Case &c) {
+        return Stroopwafel_Execute(EXECUTE_TARGET, ctx.data, c.payload, ctx.out, c.payload);
+    }
+
+    StroopwafelStatus runRunPrepared(ThreadContext &ctx, const Case &c) {
+        return Stroopwafel_RunPrepared(ctx.prepared, c.batch, ctx.data, c.payload, ctx.out, c.payload);
+    }
+
+    StroopwafelStatus runMapMemory(ThreadContext &ctx, const Case &) {
+        StroopwafelMapMemory info = {};
+        info.paddr                = MAP_BASE + ctx.index * 0x100000;
+        info.vaddr                = info.paddr;
+        info.size                 = 0x100000;
+        info.domain               = 1;
+        info.type                 = 3;
+        return Stroopwafel_MapMemory(&info);
+    }
+
+    StroopwafelStatus waitCompletion(ThreadContext &ctx) {
+        StroopwafelCompletion completion;
+        StroopwafelStatus res = Stroopwafel_WaitCompletion(ctx.queue, &completion);
+        return res != STROOPWAFEL_RESULT_SUCCESS ? res : completion.status;
+    }
+
+    StroopwafelStatus runGetAPIVersionAsync(ThreadContext &ctx, const Case &) {
+        StroopwafelAsyncParams params = {ctx.queue, nullptr, nullptr};
+        uint32_t version;
+        StroopwafelStatus res = Stroopwafel_GetAPIVersionAsync(&version, &params, nullptr);
+        return res != STROOPWAFEL_RESULT_SUCCESS ? res : waitCompletion(ctx);
+    }
+
+    StroopwafelStatus runWriteMemoryAsync(ThreadContext &ctx, const Case &c) {
+        StroopwafelAsyncParams params = {ctx.queue, nullptr, nullptr};
+        StroopwafelStatus res         = Stroopwafel_WriteMemoryAsync(c.batch, ctx.writes.data(), &params, nullptr);
+        return res != STROOPWAFEL_RESULT_SUCCESS ? res : waitCompletion(ctx);
+    }
+
+    const uint32_t sPayloadSizes[] = {4, 0x40, 0x400, 0x4000};
+    const uint32_t sBatchSizes[]   = {1, 2, 4, 8, 15, 16, 32, 64, 256};
+
+    std::vector<Case> buildCases() {
+        std::vector<Case> cases = {
+                {"GetAPIVersion", runGetAPIVersion, 0, 1, false},
+                {"GetCapabilities", runGetCapabilities, 0, 1, false},
+                {"GetMinutePath", runGetMinutePath, 0, 1, false},
+                {"GetPluginPath", runGetPluginPath, 0, 1, false},
+                {"SetFwPath", runSetFwPath, 0, 1, false},
+                {"MapMemory", runMapMemory, 0, 1, false},
+                {"GetAPIVersionAsync", runGetAPIVersionAsync, 0, 1, false},
+        };
+        // Payload sizes with a single write/read, then batch sizes with small writes/reads.
+        // Stroopwafel_WriteMemory takes at most 15 writes, bigger batches are only run through Stroopwafel_WriteMemoryBatch.
+        for (uint32_t payload : sPayloadSizes) {
+            cases.push_back({"WriteMemory", runWriteMemory, payload, 1, false});
+        }
+        for (uint32_t batch : sBatchSizes) {
+            if (batch > 1 && batch <= 15) {
+                cases.push_back({"WriteMemory", runWriteMemory, 4, batch, false});
+            }
+        }
+        for (uint32_t batch : sBatchSizes) {
+            cases.push_back({"WriteMemoryBatch", runWriteMemoryBatch, 4, batch, false});
+        }
+        for (uint32_t batch : {1u, 15u}) {
+            cases.push_back({"WriteMemoryShadowed", runWriteMemory, 4, batch, true});
+        }
+        for (uint32_t batch : {1u, 15u}) {
+            cases.push_back({"WriteMemoryAsync", runWriteMemoryAsync, 0x40, batch, false});
+        }
+        for (uint32_t payload : sPayloadSizes) {
+            cases.push_back({"ReadMemory", runReadMemory, payload, 1, false});
+        }
+        for (uint32_t batch : sBatchSizes) {
+            if (batch > 1) {
+                cases.push_back({"ReadMemory", runReadMemory, 4, batch, false});
+            }
+        }
+        for (uint32_t payload : {0x40u, 0x400u}) {
+            cases.push_back({"Execute", runExecute, payload, 1, false});
+        }
+        for (uint32_t batch : {1u, 15u, 64u}) {
+            cases.push_back({"RunPrepared", runRunPrepared, 0x40, batch, false});
+        }
+        return cases;
+    }
+
+    bool setupThread(ThreadContext &ctx, const Case &c) {
+        uint32_t size = std::max(stride(c) * c.batch, 0x40u);
+        ctx.data      = (uint8_t *) memalign(0x40, size);
+        ctx.out       = (uint8_t *) memalign(0x40, size);
+        if (!ctx.data || !ctx.out) {
+            return false;
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            ctx.data[i] = (uint8_t) (i * 31 + ctx.index);
+        }
+        // Leave a gap between the entries so neighbouring writes/reads can't be merged into one.
+        for (uint32_t i = 0; i < c.batch; i++) {
+            uint32_t addr = threadBase(ctx) + i * (stride(c) + 0x40);
+            ctx.writes.push_back({addr, ctx.data + i * stride(c), c.payload});
+            ctx.reads.push_back({addr, ctx.out + i * stride(c), c.payload});
+        }
+        if (c.run == runGetAPIVersionAsync || c.run == runWriteMemoryAsync) {
+            if (Stroopwafel_CreateCompletionQueue(ASYNC_QUEUE_SIZE, &ctx.queue) != STROOPWAFEL_RESULT_SUCCESS) {
+                return false;
+            }
+        }
+        if (c.run == runRunPrepared) {
+            if (Stroopwafel_PrepareExecute(EXECUTE_TARGET, c.payload, c.payload, &ctx.prepared) != STROOPWAFEL_RESULT_SUCCESS) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void teardownThread(ThreadContext &ctx) {
+        if (ctx.queue) {
+            Stroopwafel_DestroyCompletionQueue(ctx.queue);
+        }
+        if (ctx.prepared) {
+            Stroopwafel_FreePrepared(ctx.prepared);
+        }
+        free(ctx.data);
+        free(ctx.out);
+    }
+
+    uint64_t totalRequests() {
+        uint64_t total = 0;
+        for (uint32_t command = 1; command < MAX_COMMAND; command++) {
+            total += StroopwafelMock_GetCallCount(command);
+        }
+        return total;
+    }
+
+    struct Result {
+        uint64_t calls;
+        uint64_t errors;
+        double seconds;
+        double requestsPerCall;
+        double p50;
+        double p99;
+        double max;
+    };
+
+    double percentile(const std::vector<uint32_t> &sorted, double q) {
+        if (sorted.empty()) {
+            return 0.0;
+        }
+        size_t index = std::min(sorted.size() - 1, (size_t) (sorted.size() * q));
+        return sorted[index] / 1000.0;
+    }
+
+    bool runCase(const Case &c, uint32_t numThreads, uint32_t durationMs, Result *outResult) {
+        std::vector<ThreadContext> contexts(numThreads);
+        bool ok = true;
+        for (uint32_t i = 0; i < numThreads; i++) {
+            contexts[i]       = {};
+            contexts[i].index = i;
+            ok                = ok && setupThread(contexts[i], c);
+        }
+        if (ok && c.writeShadow) {
+            ok = Stroopwafel_EnableWriteShadow(numThreads * c.batch * stride(c)) == STROOPWAFEL_RESULT_SUCCESS;
+        }
+
+        if (ok) {
+            // One call per thread before measuring, so first-time setup (caches, the shadow, mappings) isn't counted.
+            for (auto &ctx : contexts) {
+                c.run(ctx, c);
+            }
+
+            std::atomic<uint32_t> ready{0};
+            std::atomic<bool> go{false};
+            std::atomic<bool> stop{false};
+            std::vector<std::thread> threads;
+            for (auto &ctx : contexts) {
+                threads.emplace_back([&c, &ctx, &ready, &go, &stop]() {
+                    ctx.latencies.reserve(0x10000);
+                    ready++;
+                    while (!go.load(std::memory_order_acquire)) {
+                        std::this_thread::yield();
+                    }
+                    while (!stop.load(std::memory_order_relaxed)) {
+                        auto callStart        = Clock::now();
+                        StroopwafelStatus res = c.run(ctx, c);
+                        auto elapsed          = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - callStart).count();
+                        ctx.latencies.push_back((uint32_t) std::min<int64_t>(elapsed, UINT32_MAX));
+                        ctx.calls++;
+                        ctx.errors += res != STROOPWAFEL_RESULT_SUCCESS;
+                    }
+                });
+            }
+            while (ready.load() < numThreads) {
+                std::this_thread::yield();
+            }
+
+            uint64_t requestsBefore = totalRequests();
+            auto start              = Clock::now();
+            go.store(true, std::memory_order_release);
+            std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+            stop.store(true, std::memory_order_relaxed);
+            for (auto &thread : threads) {
+                thread.join();
+            }
+            double seconds    = std::chrono::duration<double>(Clock::now() - start).count();
+            uint64_t requests = totalRequests() - requestsBefore;
+
+            std::vector<uint32_t> latencies;
+            Result result = {};
+            for (auto &ctx : contexts) {
+                latencies.insert(latencies.end(), ctx.latencies.begin(), ctx.latencies.end());
+                result.calls += ctx.calls;
+                result.errors += ctx.errors;
+            }
+            std::sort(latencies.begin(), latencies.end());
+            result.seconds         = seconds;
+            result.requestsPerCall = result.calls ? (double) requests / result.calls : 0.0;
+            result.p50             = percentile(latencies, 0.50);
+            result.p99             = percentile(latencies, 0.99);
+            result.max             = latencies.empty() ? 0.0 : latencies.back() / 1000.0;
+            *outResult             = result;
+        }
+
+        if (c.writeShadow) {
+            Stroopwafel_DisableWriteShadow();
+        }
+        for (auto &ctx : contexts) {
+            teardownThread(ctx);
+        }
+        return ok;
+    }
+
+    void printResult(bool json, const Case &c, uint32_t numThreads, const Result &r) {
+        double callsPerSec = r.seconds > 0 ? r.calls / r.seconds : 0.0;
+        double bytesPerSec = callsPerSec * c.payload * c.batch;
+        if (json) {
+            printf("{\"name\":\"%s\",\"payload\":%u,\"batch\":%u,\"threads\":%u,\"calls\":%llu,\"errors\":%llu,"
+                   "\"calls_per_sec\":%.1f,\"bytes_per_sec\":%.1f,\"requests_per_call\":%.3f,"
+                   "\"p50_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f}\n",
+                   c.name, c.payload, c.batch, numThreads, (unsigned long long) r.calls, (unsigned long long) r.errors,
+                   callsPerSec, bytesPerSec, r.requestsPerCall, r.p50, r.p99, r.max);
+        } else {
+            printf("%s,%u,%u,%u,%llu,%llu,%.1f,%.1f,%.3f,%.3f,%.3f,%.3f\n",
+                   c.name, c.payload, c.batch, numThreads, (unsigned long long) r.calls, (unsigned long long) r.errors,
+                   callsPerSec, bytesPerSec, r.requestsPerCall, r.p50, r.p99, r.max);
+        }
+        fflush(stdout);
+    }
+
+    void usage(const char *name) {
+        fprintf(stderr, "usage: %s [-t max_threads] [-d duration_ms] [-l round_trip_us,service_us] [-H num_handles] [-f csv|json] [filter]\n", name);
+    }
+} // namespace
+
+int main(int argc, char **argv) {
+    uint32_t maxThreads = 4;
+    uint32_t durationMs = 200;
+    uint32_t numHandles = STROOPWAFEL_MAX_HANDLES;
+    uint32_t roundTrip = 0, service = 0;
+    bool json           = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:d:l:H:f:")) != -1) {
+        switch (opt) {
+            case 't':
+                maxThreads = (uint32_t) strtoul(optarg, nullptr, 0);
+                break;
+            case 'd':
+                durationMs = (uint32_t) strtoul(optarg, nullptr, 0);
+                break;
+            case 'l':
+                if (sscanf(optarg, "%u,%u", &roundTrip, &service) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'H':
+                numHandles = (uint32_t) strtoul(optarg, nullptr, 0);
+                break;
+            case 'f':
+                if (strcmp(optarg, "csv") != 0 && strcmp(optarg, "json") != 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                json = strcmp(optarg, "json") == 0;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind + 1 < argc || maxThreads == 0 || maxThreads > 0x40 || durationMs == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *filter = optind < argc ? argv[optind] : nullptr;
+
+    StroopwafelMock_SetLatency(roundTrip, service);
+    if (Stroopwafel_InitLibraryEx(numHandles) != STROOPWAFEL_RESULT_SUCCESS) {
+        fprintf(stderr, "failed to init the library\n");
+        return 1;
+    }
+
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    if (!json) {
+        printf("name,payload,batch,threads,calls,errors,calls_per_sec,bytes_per_sec,requests_per_call,p50_us,p99_us,max_us\n");
+    }
+    int ret = 0;
+    for (const auto &c : buildCases()) {
+        if (filter && !strstr(c.name, filter)) {
+            continue;
+        }
+        for (uint32_t threads : threadCounts) {
+            Result result = {};
+            if (!runCase(c, threads, durationMs, &result)) {
+                fprintf(stderr, "failed to set up %s (payload %u, batch %u, %u threads)\n", c.name, c.payload, c.batch, threads);
+                ret = 1;
+                continue;
+            }
+            printResult(json, c, threads, result);
+        }
+    }
+
+    Stroopwafel_DeInitLibrary();
+    return ret;
+}
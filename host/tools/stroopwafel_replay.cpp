@@ -0,0 +1,289 @@
+/**
+ * Replays an IPC trace recorded with Stroopwafel_StartTrace/Stroopwafel_FlushTrace against the simulated IOS.
+ *
+ * usage: stroopwafel_replay [-t] [-n count] [-l round_trip_us,service_us] trace.swtr
+ *   -t  keep the original spacing between the calls instead of replaying back to back
+ *   -n  replay the trace count times
+ *   -l  IPC latency of the simulated IOS, see StroopwafelMock_SetLatency
+ *
+ * Every record is sent through the library's IPC path with its recorded vector lengths. Inputs get the recorded payload
+ * if there is one and zeros otherwise. Asynchronous calls are replayed synchronously.
+ */
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel/stroopwafel.hpp"
+#include "stroopwafel/trace.h"
+#include "stroopwafel_mock.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr uint32_t HEADER_SIZE = sizeof(StroopwafelTraceHeader);
+    constexpr uint32_t RECORD_SIZE = sizeof(StroopwafelTraceRecord);
+
+    struct Record {
+        uint64_t timestamp_us;
+        uint32_t duration_us;
+        uint8_t command;
+        uint8_t flags;
+        uint32_t num_in;
+        uint32_t num_io;
+        uint32_t lengths[0x10];
+        const uint8_t *payload;
+    };
+
+    struct CommandSummary {
+        uint64_t calls;
+        uint64_t errors;
+        uint64_t replay_us;
+        uint64_t recorded_us;
+    };
+
+    uint32_t readBE32(const uint8_t *p) {
+        return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+    }
+
+    uint16_t readBE16(const uint8_t *p) {
+        return (uint16_t) ((p[0] << 8) | p[1]);
+    }
+
+    uint64_t readBE64(const uint8_t *p) {
+        return ((uint64_t) readBE32(p) << 32) | readBE32(p + 4);
+    }
+
+    bool readFile(const char *path, std::vector<uint8_t> &out) {
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            return false;
+        }
+        uint8_t chunk[0x10000];
+        size_t read;
+        while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            out.insert(out.end(), chunk, chunk + read);
+        }
+        bool ok = !ferror(file);
+        fclose(file);
+        return ok;
+    }
+
+    bool parseTrace(const std::vector<uint8_t> &data, uint32_t *outFlags, std::vector<Record> &outRecords) {
+        if (data.size() < HEADER_SIZE || readBE32(data.data()) != STROOPWAFEL_TRACE_MAGIC) {
+            fprintf(stderr, "not a trace file\n");
+            return false;
+        }
+        if (readBE16(data.data() + 4) != STROOPWAFEL_TRACE_VERSION) {
+            fprintf(stderr, "unsupported trace version %u\n", readBE16(data.data() + 4));
+            return false;
+        }
+        uint32_t headerSize = readBE16(data.data() + 6);
+        uint32_t numRecords = readBE32(data.data() + 12);
+        *outFlags           = readBE32(data.data() + 8);
+        if (readBE32(data.data() + 16) > 0) {
+            printf("note: %u records were dropped while recording\n", readBE32(data.data() + 16));
+        }
+
+        size_t offset = headerSize;
+        for (uint32_t i = 0; i < numRecords; i++) {
+            if (offset + RECORD_SIZE > data.size()) {
+                fprintf(stderr, "record %u is truncated\n", i);
+                return false;
+            }
+            const uint8_t *p = data.data() + offset;
+            uint32_t size    = readBE32(p);
+
+            Record record       = {};
+            record.timestamp_us = readBE64(p + 8);
+            record.duration_us  = readBE32(p + 16);
+            record.command      = p[24];
+            record.flags        = p[25];
+            record.num_in       = p[26];
+            record.num_io       = p[27];
+
+            uint32_t numVectors = record.num_in + record.num_io;
+            uint64_t payload    = 0;
+            if (numVectors > 0x10 || size < RECORD_SIZE + numVectors * 4 || offset + size > data.size()) {
+                fprintf(stderr, "record %u is malformed\n", i);
+                return false;
+            }
+            for (uint32_t v = 0; v < numVectors; v++) {
+                record.lengths[v] = readBE32(p + RECORD_SIZE + v * 4);
+                if (v < record.num_in) {
+                    payload += (record.lengths[v] + 3) & ~3u;
+                }
+            }
+            if (record.flags & STROOPWAFEL_TRACE_RECORD_PAYLOAD) {
+                if (RECORD_SIZE + numVectors * 4 + payload > size) {
+                    fprintf(stderr, "record %u has a truncated payload\n", i);
+                    return false;
+                }
+                record.payload = p + RECORD_SIZE + numVectors * 4;
+            }
+            outRecords.push_back(record);
+            offset += size;
+        }
+        return true;
+    }
+
+    // The address vectors hold 32 bit numbers, they have to be converted if the trace comes from a system with a
+    // different byte order.
+    bool hasWordInput(uint8_t command, uint32_t vector) {
+        switch (command) {
+            case STROOPWAFEL_IOCTLV_WRITE_MEMORY:
+            case STROOPWAFEL_IOCTLV_READ_MEMORY:
+            case STROOPWAFEL_IOCTLV_EXECUTE:
+                return vector == 0;
+            case STROOPWAFEL_IOCTL_MAP_MEMORY:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void swapWords(uint8_t *data, uint32_t length) {
+        for (uint32_t i = 0; i + 4 <= length; i += 4) {
+            uint32_t value;
+            memcpy(&value, data + i, 4);
+            value = __builtin_bswap32(value);
+            memcpy(data + i, &value, 4);
+        }
+    }
+
+    StroopwafelStatus replayRecord(const Record &record, bool swap, uint8_t *scratch) {
+        IOSVec vectors[0x10]   = {};
+        const uint8_t *payload = record.payload;
+        uint32_t offset        = 0;
+        for (uint32_t v = 0; v < record.num_in + record.num_io; v++) {
+            uint32_t length  = record.lengths[v];
+            vectors[v].vaddr = scratch + offset;
+            vectors[v].len   = length;
+            if (v < record.num_in && payload) {
+                memcpy(scratch + offset, payload, length);
+                payload += (length + 3) & ~3u;
+                if (swap && hasWordInput(record.command, v)) {
+                    swapWords(scratch + offset, length);
+                }
+            } else {
+                memset(scratch + offset, 0, length);
+            }
+            offset += (length + 0x3F) & ~0x3Fu;
+        }
+
+        if (record.flags & STROOPWAFEL_TRACE_RECORD_IOCTLV) {
+            return stroopwafel::detail::ioctlv(record.command, record.num_in, record.num_io, vectors);
+        }
+        int actualLen = 0;
+        return stroopwafel::detail::ioctl(record.command, vectors[0].len ? vectors[0].vaddr : nullptr, vectors[0].len, vectors[1].len ? vectors[1].vaddr : nullptr, vectors[1].len, &actualLen);
+    }
+
+    uint32_t scratchSize(const Record &record) {
+        uint32_t size = 0;
+        for (uint32_t v = 0; v < record.num_in + record.num_io; v++) {
+            size += (record.lengths[v] + 0x3F) & ~0x3Fu;
+        }
+        return size;
+    }
+
+    void usage(const char *name) {
+        fprintf(stderr, "usage: %s [-t] [-n count] [-l round_trip_us,service_us] trace.swtr\n", name);
+    }
+} // namespace
+
+int main(int argc, char **argv) {
+    bool originalTiming = false;
+    uint32_t repeat     = 1;
+    uint32_t roundTrip  = 0, service = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "tn:l:")) != -1) {
+        switch (opt) {
+            case 't':
+                originalTiming = true;
+                break;
+            case 'n':
+                repeat = (uint32_t) strtoul(optarg, nullptr, 0);
+                break;
+            case 'l':
+                if (sscanf(optarg, "%u,%u", &roundTrip, &service) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind + 1 != argc || repeat == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    if (!readFile(argv[optind], data)) {
+        fprintf(stderr, "failed to read %s\n", argv[optind]);
+        return 1;
+    }
+    uint32_t flags = 0;
+    std::vector<Record> records;
+    if (!parseTrace(data, &flags, records)) {
+        return 1;
+    }
+
+    uint32_t maxScratch = 0x40;
+    for (const auto &record : records) {
+        maxScratch = std::max(maxScratch, scratchSize(record));
+    }
+    auto *scratch      = (uint8_t *) memalign(0x40, maxScratch);
+    bool bigEndianHost = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+    bool swap          = ((flags & STROOPWAFEL_TRACE_FLAG_BIG_ENDIAN) != 0) != bigEndianHost;
+
+    StroopwafelMock_SetLatency(roundTrip, service);
+    if (Stroopwafel_InitLibrary() != STROOPWAFEL_RESULT_SUCCESS) {
+        fprintf(stderr, "failed to init the library\n");
+        return 1;
+    }
+
+    CommandSummary summary[0x100] = {};
+    auto start                    = Clock::now();
+    for (uint32_t round = 0; round < repeat; round++) {
+        auto roundStart = Clock::now();
+        for (const auto &record : records) {
+            if (originalTiming) {
+                std::this_thread::sleep_until(roundStart + std::chrono::microseconds(record.timestamp_us));
+            }
+            auto callStart           = Clock::now();
+            StroopwafelStatus status = replayRecord(record, swap, scratch);
+            auto elapsed             = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - callStart).count();
+
+            auto &entry = summary[record.command];
+            entry.calls++;
+            entry.errors += status != STROOPWAFEL_RESULT_SUCCESS;
+            entry.replay_us += elapsed;
+            entry.recorded_us += record.duration_us;
+        }
+    }
+    double total = std::chrono::duration<double>(Clock::now() - start).count();
+
+    uint64_t calls = (uint64_t) records.size() * repeat;
+    printf("%llu calls in %.3f s, %.0f calls/s\n", (unsigned long long) calls, total, total > 0 ? calls / total : 0.0);
+    printf("%-8s %10s %8s %14s %14s\n", "command", "calls", "errors", "avg replay us", "avg trace us");
+    for (uint32_t command = 0; command < 0x100; command++) {
+        const auto &entry = summary[command];
+        if (entry.calls == 0) {
+            continue;
+        }
+        printf("0x%02X     %10llu %8llu %14.1f %14.1f\n", command, (unsigned long long) entry.calls, (unsigned long long) entry.errors,
+               (double) entry.replay_us / entry.calls, (double) entry.recorded_us / entry.calls);
+    }
+
+    Stroopwafel_DeInitLibrary();
+    free(scratch);
+    return 0;
+}
@@ -13,8 +13,9 @@ extern "C" {
 #define STROOPWAFEL_IOCTL_MAP_MEMORY      0x5
 #define STROOPWAFEL_IOCTL_GET_MINUTE_PATH 0x6
 #define STROOPWAFEL_IOCTL_GET_PLUGIN_PATH 0x7
+#define STROOPWAFEL_IOCTLV_READ_MEMORY    0x8
 
-#define STROOPWAFEL_API_VERSION           0x010000 // v1.0.0
+#define STROOPWAFEL_API_VERSION           0x010100 // v1.1.0
 
 #ifdef __cplusplus
 } // extern "C"
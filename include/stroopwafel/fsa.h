@@ -46,7 +46,7 @@ FSError FSAEx_RawCloseEx(FSAClientHandle clientHandle, int32_t device_handle);
  * Read data from a device handle.
  *
  * @param client valid FSClient pointer with unlocked permissions
- * @param data buffer where the result will be stored. Requires 0x40 alignment for the buffer itself and buffer size.
+ * @param data buffer where the result will be stored. Unaligned buffers are bounced through an aligned copy, pass a 0x40 aligned buffer with 0x40 aligned size to avoid it.
  * @param size_bytes size of sector.
  * @param cnt number of sectors that should be read.
  * @param blocks_offset read offset in sectors.
@@ -59,7 +59,7 @@ FSError FSAEx_RawRead(FSClient *client, void *data, uint32_t size_bytes, uint32_
  * Read data from a raw device handle.
  *
  * @param clientHandle valid /dev/fsa handle with unlocked permissions
- * @param data buffer where the result will be stored. Requires 0x40 alignment for the buffer itself and buffer size.
+ * @param data buffer where the result will be stored. Unaligned buffers are bounced through an aligned copy, pass a 0x40 aligned buffer with 0x40 aligned size to avoid it.
  * @param size_bytes size of sector.
  * @param cnt number of sectors that should be read.
  * @param blocks_offset read offset in sectors.
@@ -73,7 +73,7 @@ FSError FSAEx_RawReadEx(FSAClientHandle clientHandle, void *data, uint32_t size_
  * Write data to raw device handle
  *
  * @param client valid FSClient pointer with unlocked permissions
- * @param data buffer of data that should be written.. Requires 0x40 alignment for the buffer itself and buffer size.
+ * @param data buffer of data that should be written.. Unaligned buffers are bounced through an aligned copy, pass a 0x40 aligned buffer with 0x40 aligned size to avoid it.
  * @param size_bytes size of sector.
  * @param cnt number of sectors that should be written.
  * @param blocks_offset write offset in sectors.
@@ -86,7 +86,7 @@ FSError FSAEx_RawWrite(FSClient *client, const void *data, uint32_t size_bytes,
  * Write data to raw device handle
  *
  * @param clientHandle valid /dev/fsa handle with unlocked permissions
- * @param data buffer of data that should be written.. Requires 0x40 alignment for the buffer itself and buffer size.
+ * @param data buffer of data that should be written.. Unaligned buffers are bounced through an aligned copy, pass a 0x40 aligned buffer with 0x40 aligned size to avoid it.
  * @param size_bytes size of sector.
  * @param cnt number of sectors that should be written.
  * @param blocks_offset write offset in sectors.
@@ -95,6 +95,314 @@ FSError FSAEx_RawWrite(FSClient *client, const void *data, uint32_t size_bytes,
  */
 FSError FSAEx_RawWriteEx(FSAClientHandle clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
 
+typedef struct FSAExRawExtent {
+    //! First sector of the extent.
+    uint64_t blocks_offset;
+    //! Number of sectors.
+    uint32_t cnt;
+    //! Buffer of cnt sectors.
+    void *data;
+} FSAExRawExtent;
+
+/**
+ * Reads a list of extents from a raw device handle.
+ *
+ * The extents are sorted and merged into runs, close extents are merged as well and the gap is read into a
+ * staging buffer. The runs are pipelined so up to 8 raw reads are queued in IOS at a time. A run that consists
+ * of a single 0x40 aligned extent with an aligned size is read directly into the buffer. Reads don't go through
+ * the block cache.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param size_bytes size of sector.
+ * @param extents extents that should be read. May overlap and don't need to be sorted.
+ * @param num_extents number of extents.
+ * @param device_handle valid device handle.
+ * @return FS_ERROR_OK on success, otherwise the first error. Extents of failed runs have undefined contents.
+ */
+FSError FSAEx_RawReadV(FSClient *client, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle);
+
+/**
+ * Reads a list of extents from a raw device handle. See FSAEx_RawReadV.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawReadVEx(FSAClientHandle clientHandle, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle);
+
+/**
+ * Writes a list of extents to a raw device handle.
+ *
+ * Touching extents are merged into raw writes of up to 1 MiB. Overlapping extents always end up in the same raw write,
+ * however big it gets, and later extents in the list win on overlaps.
+ * Like FSAEx_RawReadV up to 8 writes are queued in IOS at a time. Cached blocks are updated like with FSAEx_RawWrite.
+ *
+ * @param client valid FSClient pointer with unlocked permissions
+ * @param size_bytes size of sector.
+ * @param extents extents that should be written. Don't need to be sorted.
+ * @param num_extents number of extents.
+ * @param device_handle valid device handle.
+ * @return FS_ERROR_OK on success, otherwise the first error. No further runs are submitted after an error.
+ *         FS_ERROR_INVALID_PARAM if a chain of overlapping extents spans more than 4 GiB.
+ */
+FSError FSAEx_RawWriteV(FSClient *client, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle);
+
+/**
+ * Writes a list of extents to a raw device handle. See FSAEx_RawWriteV.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ */
+FSError FSAEx_RawWriteVEx(FSAClientHandle clientHandle, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle);
+
+typedef enum FSAExBlockCachePolicy {
+    FSAEX_BLOCK_CACHE_LRU   = 0,
+    FSAEX_BLOCK_CACHE_CLOCK = 1,
+} FSAExBlockCachePolicy;
+
+typedef struct FSAExBlockCacheStats {
+    //! Pages served from the cache.
+    uint64_t hits;
+    //! Requested pages that had to be read from the device.
+    uint64_t misses;
+    //! Pages read ahead of a sequential reader.
+    uint64_t readahead_pages;
+    uint64_t evictions;
+    //! Raw reads issued by the cache.
+    uint64_t reads;
+    //! Requests that were too big for the cache and went to the device directly.
+    uint64_t bypassed;
+} FSAExBlockCacheStats;
+
+/**
+ * Enables a block cache for FSAEx_RawRead(Ex). Replaces (and drops) a cache that is already enabled.
+ *
+ * Cached data is kept in 0x40 aligned pages keyed by device handle and offset. Misses read whole pages, and reads
+ * that continue where the previous one ended grow a read-ahead window up to <max_readahead_pages>, so small
+ * sequential reads (e.g. walking filesystem metadata) need far fewer IPCs. Requests bigger than a quarter of the
+ * cache bypass it.
+ *
+ * The cache is write-through: FSAEx_RawWrite(Ex) updates cached pages, raw stream writes and FSAEx_RawClose(Ex) drop them.
+ * Writes to the device that don't go through this library are not seen, use FSAEx_InvalidateBlockCache after them.
+ *
+ * Reads from different threads only wait for each other while they need the same missing page, the device reads
+ * themselves run in parallel. Replacing or disabling the cache waits for reads that are still using it.
+ *
+ * @param page_size size of a page in bytes, has to be a multiple of 0x40. Reads with a sector size that doesn't divide it bypass the cache.
+ * @param num_pages number of pages, at least 4.
+ * @param policy FSAEX_BLOCK_CACHE_LRU or FSAEX_BLOCK_CACHE_CLOCK.
+ * @param max_readahead_pages maximum number of pages read ahead of a sequential reader, capped at num_pages / 2. 0 disables read-ahead.
+ * @return FS_ERROR_OK on success, FS_ERROR_INVALID_PARAM or FS_ERROR_OUT_OF_RESOURCES otherwise.
+ */
+FSError FSAEx_EnableBlockCache(uint32_t page_size, uint32_t num_pages, FSAExBlockCachePolicy policy, uint32_t max_readahead_pages);
+
+/**
+ * Disables the block cache and frees its memory.
+ */
+FSError FSAEx_DisableBlockCache();
+
+/**
+ * Drops cached pages.
+ *
+ * @param device_handle device handle whose pages should be dropped, -1 drops all pages.
+ */
+FSError FSAEx_InvalidateBlockCache(int32_t device_handle);
+
+/**
+ * Returns the statistics of the block cache since it has been enabled.
+ *
+ * @return FS_ERROR_OK on success, FS_ERROR_NOT_INIT if the cache is not enabled.
+ */
+FSError FSAEx_GetBlockCacheStats(FSAExBlockCacheStats *outStats);
+
+typedef enum FSAExDumpFlags {
+    //! Calculate the CRC32 of the dumped range.
+    FSAEX_DUMP_FLAG_CRC32 = 1 << 0,
+    //! Calculate the SHA-1 of the dumped range.
+    FSAEX_DUMP_FLAG_SHA1 = 1 << 1,
+    //! Skip all-zero sectors in the output file instead of writing them, so they become holes on filesystems that support sparse files.
+    FSAEX_DUMP_FLAG_SPARSE = 1 << 2,
+} FSAExDumpFlags;
+
+/**
+ * Called from the thread that called FSAEx_DumpDevice after each chunk has been hashed and written.
+ */
+typedef void (*FSAExDumpProgressCallback)(uint64_t done_cnt, uint64_t total_cnt, void *context);
+
+typedef struct FSAExDumpOptions {
+    //! Combination of FSAExDumpFlags.
+    uint32_t flags;
+    //! Sectors per raw read, 0 selects 512 KiB chunks.
+    uint32_t chunk_cnt;
+    //! Number of reader threads, 0 starts one per core.
+    uint32_t num_workers;
+    //! Number of chunk buffers, 0 selects two per worker plus one. Raised to num_workers + 1 if smaller.
+    uint32_t num_buffers;
+    FSAExDumpProgressCallback progress;
+    void *progress_context;
+} FSAExDumpOptions;
+
+typedef struct FSAExDumpResult {
+    //! Only set with FSAEX_DUMP_FLAG_CRC32.
+    uint32_t crc32;
+    //! Only set with FSAEX_DUMP_FLAG_SHA1.
+    uint8_t sha1[20];
+    //! Number of sectors that have been written to the output file.
+    uint64_t data_cnt;
+    //! Number of all-zero sectors that have been skipped, only counted with FSAEX_DUMP_FLAG_SPARSE.
+    uint64_t zero_cnt;
+} FSAExDumpResult;
+
+/**
+ * Dumps a range of a raw device to a file.
+ *
+ * The range is split into chunks that are read by worker threads pinned to separate cores, each keeping one
+ * FSAEx_RawReadEx in flight. Workers also scan their chunk for all-zero sectors. The calling thread hashes and
+ * writes the chunks in order while the next ones are being read, so no second pass over the image is needed.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param device_handle valid device handle.
+ * @param size_bytes size of sector.
+ * @param blocks_offset offset of the first sector.
+ * @param total_cnt number of sectors to dump.
+ * @param out_path path of the image file that will be created, may be NULL to only calculate the checksums.
+ * @param options options, may be NULL to use the defaults without checksums.
+ * @param outResult optional pointer where the checksums and sector counts will be stored.
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_INVALID_PARAM: Invalid size, range or options. <br>
+ *         FS_ERROR_INVALID_PATH: The output file could not be created. <br>
+ *         FS_ERROR_MEDIA_ERROR: Writing the output file failed. <br>
+ *         FS_ERROR_OUT_OF_RESOURCES: Failed to allocate the buffers or start the workers. <br>
+ *         Any error of FSAEx_RawReadEx. The dump stops at the first failed chunk.
+ */
+FSError FSAEx_DumpDevice(FSAClientHandle clientHandle, int device_handle, uint32_t size_bytes, uint64_t blocks_offset, uint64_t total_cnt, const char *out_path, const FSAExDumpOptions *options, FSAExDumpResult *outResult);
+
+typedef enum FSAExDiffWriteFlags {
+    //! Read back every written span and compare it against the source.
+    FSAEX_DIFF_WRITE_FLAG_VERIFY = 1 << 0,
+} FSAExDiffWriteFlags;
+
+typedef struct FSAExDiffWriteOptions {
+    //! Combination of FSAExDiffWriteFlags.
+    uint32_t flags;
+    //! Sectors per compared chunk, 0 selects 256 KiB chunks. Has to match the manifest if one is used.
+    uint32_t chunk_cnt;
+    //! Optional CRC32 per chunk of the current device contents, as created by FSAEx_BuildRawManifest.
+    const uint32_t *manifest;
+    //! Number of entries in manifest, chunks past the end are compared against the device.
+    uint32_t num_manifest_entries;
+} FSAExDiffWriteOptions;
+
+typedef struct FSAExDiffWriteResult {
+    //! Sectors that have been read from the device for comparing.
+    uint64_t read_cnt;
+    //! Sectors that have been written.
+    uint64_t written_cnt;
+    //! Number of raw writes that have been issued.
+    uint32_t num_spans;
+    //! Chunks that have been skipped because their CRC32 matched the manifest.
+    uint32_t skipped_chunks;
+} FSAExDiffWriteResult;
+
+/**
+ * Calculates the CRC32 of every <chunk_cnt> sectors of an image, for use as FSAExDiffWriteOptions::manifest.
+ *
+ * @param data image data.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors.
+ * @param chunk_cnt sectors per chunk, 0 selects 256 KiB chunks.
+ * @param outManifest array of (cnt + chunk_cnt - 1) / chunk_cnt entries.
+ * @return FS_ERROR_OK on success, FS_ERROR_INVALID_PARAM otherwise.
+ */
+FSError FSAEx_BuildRawManifest(const void *data, uint32_t size_bytes, uint64_t cnt, uint32_t chunk_cnt, uint32_t *outManifest);
+
+/**
+ * Writes an image to a raw device, but only the sectors that differ from the current device contents.
+ *
+ * The device is read chunk by chunk (pipelined via a raw stream) and compared against the source word-wise. Runs of
+ * differing sectors are merged into contiguous spans and written with FSAEx_RawWriteEx. With a manifest, chunks
+ * whose source CRC32 matches the manifest entry are skipped without reading the device. A CRC32 collision would
+ * hide a change in that chunk, only use a manifest that describes the device contents exactly.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param data image data that should end up on the device.
+ * @param size_bytes size of sector.
+ * @param cnt number of sectors.
+ * @param blocks_offset write offset in sectors. Manifest entries are relative to this offset.
+ * @param device_handle valid device handle.
+ * @param options options, may be NULL for the defaults without verification.
+ * @param outResult optional pointer where the statistics will be stored, also set if an error occurs.
+ * @return FS_ERROR_OK on success <br>
+ *         FS_ERROR_DATA_CORRUPTED: The verify pass found a mismatch. <br>
+ *         FS_ERROR_OUT_OF_RESOURCES: Failed to allocate buffers. <br>
+ *         Any error of the raw reads and writes.
+ */
+FSError FSAEx_RawWriteDiff(FSAClientHandle clientHandle, const void *data, uint32_t size_bytes, uint64_t cnt, uint64_t blocks_offset, int device_handle, const FSAExDiffWriteOptions *options, FSAExDiffWriteResult *outResult);
+
+typedef struct FSAExRawStream FSAExRawStream;
+
+typedef enum FSAExRawStreamMode {
+    FSAEX_RAW_STREAM_READ  = 0,
+    FSAEX_RAW_STREAM_WRITE = 1,
+} FSAExRawStreamMode;
+
+/**
+ * Opens a pipelined stream over a raw device handle.
+ *
+ * The stream owns <num_buffers> 0x40 aligned buffers of <chunk_cnt> sectors each and keeps as many
+ * asynchronous raw reads/writes in flight as possible, so the device keeps working while the caller
+ * consumes (or fills) the previous chunk.
+ *
+ * @param clientHandle valid /dev/fsa handle with unlocked permissions
+ * @param device_handle valid device handle.
+ * @param mode FSAEX_RAW_STREAM_READ or FSAEX_RAW_STREAM_WRITE
+ * @param size_bytes size of sector.
+ * @param chunk_cnt number of sectors per chunk.
+ * @param num_buffers number of chunks in flight. Values smaller than 2 are raised to 2.
+ * @param blocks_offset offset of the first sector.
+ * @param total_cnt total number of sectors that will be read/written.
+ * @param outStream pointer where the stream will be stored.
+ * @return FS_ERROR_OK on success
+ */
+FSError FSAEx_RawStreamOpen(FSAClientHandle clientHandle, int device_handle, FSAExRawStreamMode mode, uint32_t size_bytes, uint32_t chunk_cnt, uint32_t num_buffers, uint64_t blocks_offset, uint64_t total_cnt, FSAExRawStream **outStream);
+
+/**
+ * Returns the next chunk of a read stream. The returned buffer stays valid until the next call to
+ * FSAEx_RawStreamRead or FSAEx_RawStreamClose, after which it will be reused for a read-ahead.
+ *
+ * @param stream stream opened with FSAEX_RAW_STREAM_READ.
+ * @param outData pointer where the address of the chunk data will be stored.
+ * @param outCnt pointer where the number of sectors of the chunk will be stored.
+ * @param outBlocksOffset optional pointer where the sector offset of the chunk will be stored.
+ * @return FS_ERROR_OK on success, FS_ERROR_END_OF_FILE once all sectors have been returned.
+ */
+FSError FSAEx_RawStreamRead(FSAExRawStream *stream, const void **outData, uint32_t *outCnt, uint64_t *outBlocksOffset);
+
+/**
+ * Returns a free buffer of a write stream. Waits for the oldest in-flight write if all buffers are busy.
+ *
+ * @param stream stream opened with FSAEX_RAW_STREAM_WRITE.
+ * @param outData pointer where the address of the buffer will be stored.
+ * @param outCnt pointer where the number of sectors that may be submitted will be stored.
+ * @return FS_ERROR_OK on success, FS_ERROR_END_OF_FILE if all sectors have already been submitted.
+ */
+FSError FSAEx_RawStreamGetWriteBuffer(FSAExRawStream *stream, void **outData, uint32_t *outCnt);
+
+/**
+ * Submits the buffer returned by FSAEx_RawStreamGetWriteBuffer for writing. Does not wait for the write.
+ *
+ * @param stream stream opened with FSAEX_RAW_STREAM_WRITE.
+ * @param cnt number of sectors of the buffer that should be written.
+ * @return FS_ERROR_OK on success, otherwise the first error of a previous write.
+ *         FS_ERROR_INVALID_PARAM if FSAEx_RawStreamGetWriteBuffer has not been called for the next buffer.
+ */
+FSError FSAEx_RawStreamSubmitWrite(FSAExRawStream *stream, uint32_t cnt);
+
+/**
+ * Waits for all in-flight requests and frees the stream.
+ *
+ * @param stream stream to close.
+ * @return FS_ERROR_OK if every request of the stream succeeded, otherwise the first error.
+ */
+FSError FSAEx_RawStreamClose(FSAExRawStream *stream);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
\ No newline at end of file
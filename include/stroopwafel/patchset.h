@@ -0,0 +1,125 @@
+#pragma once
+
+#include "stroopwafel.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Patch-set file format, all fields are big-endian:
+ * - StroopwafelPatchSetHeader at offset 0
+ * - num_entries StroopwafelPatchSetEntry at index_offset, sorted by dest_addr
+ * - payload_size bytes of data at payload_offset, referenced by the entries
+ *
+ * Entries may overlap, overlapping ranges are applied in index order so later entries win.
+ * The payload of each entry should start at a 0x40 aligned offset, so a set that is loaded to an
+ * aligned buffer can be passed to IOS without copying.
+ */
+#define STROOPWAFEL_PATCHSET_MAGIC   0x53575053 // "SWPS"
+#define STROOPWAFEL_PATCHSET_VERSION 1
+
+typedef struct StroopwafelPatchSetHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t num_entries;
+    uint32_t index_offset;
+    uint32_t payload_offset;
+    uint32_t payload_size;
+    uint32_t reserved[2];
+} StroopwafelPatchSetHeader;
+
+typedef struct StroopwafelPatchSetEntry {
+    uint32_t dest_addr;
+    uint32_t length;
+    //! Offset relative to the start of the payload.
+    uint32_t payload_offset;
+    uint32_t reserved;
+} StroopwafelPatchSetEntry;
+
+/**
+ * A validated patch set. The entries are read from the underlying buffer on demand, opening or loading a
+ * patch set does not allocate anything per entry.
+ */
+typedef struct StroopwafelPatchSet {
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t num_entries;
+    const uint8_t *index;
+    const uint8_t *payload;
+    uint32_t payload_size;
+    //! Buffer owned by the patch set, set by Stroopwafel_LoadPatchSet.
+    void *owned_buffer;
+} StroopwafelPatchSet;
+
+/**
+ * Validates a patch set that is already in memory. The data is not copied and has to stay valid until
+ * Stroopwafel_ClosePatchSet is called.
+ *
+ * @param data pointer to the patch set. Should be 0x40 aligned to avoid copies when applying it.
+ * @param size size of the data in bytes.
+ * @param outSet patch set that will be initialized.
+ * @return STROOPWAFEL_RESULT_SUCCESS:             The patch set is valid. <br>
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT:    Invalid pointer, malformed or unsorted patch set. <br>
+ *         STROOPWAFEL_RESULT_UNSUPPORTED_API_VERSION: The patch set uses an unsupported format version.
+ */
+StroopwafelStatus Stroopwafel_OpenPatchSet(const void *data, uint32_t size, StroopwafelPatchSet *outSet);
+
+/**
+ * Reads a patch set file into a single aligned buffer and validates it.
+ *
+ * @param path path of the file, e.g. "fs:/vol/external01/wiiu/patches.swps"
+ * @param outSet patch set that will be initialized.
+ * @return STROOPWAFEL_RESULT_SUCCESS:             The patch set has been loaded. <br>
+ *         STROOPWAFEL_RESULT_NOT_FOUND:           Failed to open or read the file. <br>
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY:       Not enough memory to load the file. <br>
+ *         Any error of Stroopwafel_OpenPatchSet.
+ */
+StroopwafelStatus Stroopwafel_LoadPatchSet(const char *path, StroopwafelPatchSet *outSet);
+
+/**
+ * Frees the buffer of a patch set loaded with Stroopwafel_LoadPatchSet. Does nothing for sets opened from memory.
+ */
+void Stroopwafel_ClosePatchSet(StroopwafelPatchSet *set);
+
+/**
+ * Returns an entry of a patch set. The src of the returned write points into the patch set data.
+ *
+ * @return STROOPWAFEL_RESULT_SUCCESS or STROOPWAFEL_RESULT_INVALID_ARGUMENT if the index is out of range.
+ */
+StroopwafelStatus Stroopwafel_GetPatchSetEntry(const StroopwafelPatchSet *set, uint32_t index, StroopwafelWrite *outWrite);
+
+/**
+ * Applies a patch set. <br>
+ * Entries are merged the same way as by Stroopwafel_WriteMemoryBatch: overlapping entries are applied in index order,
+ * adjacent ones are merged up to 64 KiB, larger entries are passed to IOS directly.
+ *
+ * @param set patch set opened with Stroopwafel_OpenPatchSet or Stroopwafel_LoadPatchSet.
+ * @return STROOPWAFEL_RESULT_SUCCESS:             All entries have been written. <br>
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT:    Invalid patch set. <br>
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY:       Failed to allocate the run index or a staging buffer. <br>
+ *         Any error of Stroopwafel_WriteMemory. The set may have been applied partially in this case.
+ */
+StroopwafelStatus Stroopwafel_ApplyPatchSet(const StroopwafelPatchSet *set);
+
+/**
+ * Serializes writes into the patch set format. <br>
+ * Adjacent and overlapping writes are merged into a single entry, later writes win on overlaps like with
+ * Stroopwafel_WriteMemoryBatch. Payloads are placed at 0x40 aligned offsets.
+ *
+ * @param num_writes number of writes.
+ * @param writes writes that should be stored.
+ * @param outBuffer buffer for the patch set, may be NULL to query the required size.
+ * @param bufferSize size of outBuffer.
+ * @param outSize size of the serialized patch set.
+ * @return STROOPWAFEL_RESULT_SUCCESS:             The patch set has been written (or the size has been queried). <br>
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT:    Invalid writes or outBuffer is too small. <br>
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY:       Failed to allocate memory for sorting.
+ */
+StroopwafelStatus Stroopwafel_SerializePatchSet(uint32_t num_writes, const StroopwafelWrite *writes, void *outBuffer, uint32_t bufferSize, uint32_t *outSize);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -2,6 +2,7 @@
 #include "commands.h"
 #include <coreinit/filesystem.h>
 #include <coreinit/filesystem_fsa.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -26,20 +27,46 @@ typedef enum StroopwafelStatus {
 const char *Stroopwafel_GetStatusStr(StroopwafelStatus status);
 
 /**
- * Initializes the stroopwafel lib. Needs to be called before any other functions can be used
+ * Maximum number of /dev/stroopwafel handles that can be opened via Stroopwafel_InitLibraryEx (one per core).
+ */
+#define STROOPWAFEL_MAX_HANDLES 3
+
+/**
+ * Initializes the stroopwafel lib. Needs to be called before any other functions can be used. <br>
+ * Equivalent to Stroopwafel_InitLibraryEx(1).
  * @return STROOPWAFEL_RESULT_SUCCESS:                Library has been successfully initialized <br>
  *         STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND:    Failed to initialize the library caused by an outdated stroopwafel version.
  */
 StroopwafelStatus Stroopwafel_InitLibrary();
 
 /**
- * Deinitializes the stroopwafel lib
- * @return
+ * Initializes the stroopwafel lib with a pool of up to num_handles /dev/stroopwafel handles. <br>
+ * Calls from different cores are spread over the pool so they don't serialize on a single handle. <br>
+ * <br>
+ * Initialization is thread-safe and reference counted: every successful call must be paired with a call to
+ * Stroopwafel_DeInitLibrary(). If the library is already initialized, only the reference count is increased and
+ * the existing pool is kept. If fewer than num_handles handles can be opened, the library is initialized with a
+ * smaller pool.
+ *
+ * @param num_handles Number of handles to open, 1 to STROOPWAFEL_MAX_HANDLES.
+ * @return STROOPWAFEL_RESULT_SUCCESS:                    Library has been successfully initialized <br>
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT:           num_handles is 0 or bigger than STROOPWAFEL_MAX_HANDLES <br>
+ *         STROOPWAFEL_RESULT_UNSUPPORTED_CFW:            Failed to open /dev/stroopwafel <br>
+ *         STROOPWAFEL_RESULT_UNSUPPORTED_API_VERSION:    The running stroopwafel is not compatible with this library.
+ */
+StroopwafelStatus Stroopwafel_InitLibraryEx(uint32_t num_handles);
+
+/**
+ * Deinitializes the stroopwafel lib. <br>
+ * Decreases the reference count, the handles are closed by the call matching the first successful init.
+ * No other stroopwafel call may be in flight at that point.
+ * @return STROOPWAFEL_RESULT_SUCCESS
  */
 StroopwafelStatus Stroopwafel_DeInitLibrary();
 
 /**
- * Retrieves the API Version of the running stroopwafel.
+ * Retrieves the API Version of the running stroopwafel. Only the first call does an IPC, the version is cached afterward.
+ * The cache is shared with Stroopwafel_GetAPIVersionAsync and dropped when the library is deinitialized the last time.
  *
  * @param outVersion pointer to the variable where the version will be stored.
  *
@@ -51,7 +78,24 @@ StroopwafelStatus Stroopwafel_DeInitLibrary();
 StroopwafelStatus Stroopwafel_GetAPIVersion(uint32_t *outVersion);
 
 /**
- * Sets the fw.img path.
+ * Bit of a STROOPWAFEL_IOCTL(V)_* command in the capability bitmap.
+ */
+#define STROOPWAFEL_CAPABILITY(command) (1u << (command))
+
+/**
+ * Retrieves the commands supported by the running stroopwafel as a bitmap of STROOPWAFEL_CAPABILITY(command) bits. <br>
+ * The bitmap is negotiated once during Stroopwafel_InitLibrary(), calls using a command that is not supported
+ * return STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND without doing an IPC.
+ *
+ * @param outCapabilities pointer to the variable where the bitmap will be stored.
+ * @return STROOPWAFEL_RESULT_SUCCESS:                The capabilities have been stored in outCapabilities<br>
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT:       Invalid outCapabilities pointer<br>
+ *         STROOPWAFEL_RESULT_LIB_UNINITIALIZED:      Library was not initialized.
+ */
+StroopwafelStatus Stroopwafel_GetCapabilities(uint32_t *outCapabilities);
+
+/**
+ * Sets the fw.img path. Invalidates the paths cached by Stroopwafel_GetMinutePath() and Stroopwafel_GetPluginPath().
  * @param path The full path for the fw.img (e.g., "/vol/sdcard/minute/fw.img").
  * @return STROOPWAFEL_RESULT_SUCCESS: The path has been set successfully.
  *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid path pointer.
@@ -77,6 +121,98 @@ typedef struct StroopwafelWrite {
  */
 StroopwafelStatus Stroopwafel_WriteMemory(uint32_t num_writes, const StroopwafelWrite *writes);
 
+/**
+ * Writes any number of entries to the IOS memory with as few IPC calls as possible.
+ * The writes are sorted by destination and overlapping ranges are merged (the entry that comes later in the array wins).
+ * Adjacent ranges are merged as long as the result stays within 64 KiB, so small writes are packed into 0x40 aligned
+ * staging buffers while large ones are passed on directly. The result is sent via Stroopwafel_WriteMemory in batches
+ * of up to 15 ranges.
+ * @param num_writes The number of writes to perform.
+ * @param writes Pointer to an array of StroopwafelWrite structures. Entries with a length of 0 are ignored.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The memory has been written successfully.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid arguments, a write that exceeds the 32 bit address space or
+ *                                             overlapping writes that cover the whole address space.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: Failed to allocate the staging buffers.
+ *         STROOPWAFEL_RESULT_LIB_UNINITIALIZED: Library was not initialized.
+ *         STROOPWAFEL_RESULT_UNKNOWN_ERROR: Unknown error. Batches before the failing one have already been written.
+ */
+StroopwafelStatus Stroopwafel_WriteMemoryBatch(uint32_t num_writes, const StroopwafelWrite *writes);
+
+typedef struct StroopwafelRead {
+    uint32_t src_addr;
+    void *dest;
+    uint32_t length;
+} StroopwafelRead;
+
+/**
+ * Reads any number of ranges from the IOS memory with as few IPC calls as possible. Requires stroopwafel v1.1.0. <br>
+ * The reads are sorted by source address and adjacent or overlapping ranges are read only once. Every IPC carries up
+ * to 15 ranges and up to 8 IPCs are queued in IOS at a time. Destinations that are 0x40 aligned and cover whole cache
+ * lines receive the data directly, everything else is copied from an aligned staging buffer of its IPC.
+ * @param num_reads The number of reads to perform.
+ * @param reads Pointer to an array of StroopwafelRead structures. Entries with a length of 0 are ignored.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The memory has been read successfully.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid arguments or a read that exceeds the 32 bit address space.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: Failed to allocate the staging buffers.
+ *         STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND: The running stroopwafel is older than v1.1.0.
+ *         STROOPWAFEL_RESULT_LIB_UNINITIALIZED: Library was not initialized.
+ *         STROOPWAFEL_RESULT_UNKNOWN_ERROR: Unknown error. The content of the destinations is undefined.
+ */
+StroopwafelStatus Stroopwafel_ReadMemory(uint32_t num_reads, const StroopwafelRead *reads);
+
+typedef struct StroopwafelWriteShadowStats {
+    //! Bytes passed to Stroopwafel_WriteMemory (directly or via the batch and patch set helpers).
+    uint64_t bytes_requested;
+    //! Bytes that were actually sent to IOS.
+    uint64_t bytes_written;
+    //! Writes that were skipped entirely because nothing had changed.
+    uint64_t skipped_writes;
+    //! Ranges currently tracked and their total size.
+    uint32_t num_ranges;
+    uint32_t tracked_bytes;
+} StroopwafelWriteShadowStats;
+
+/**
+ * Enables the write shadow. Replaces (and drops) a shadow that is already enabled. <br>
+ * The shadow remembers a hash per 0x20 byte block of every range written via Stroopwafel_WriteMemory. Writing the
+ * same range again only sends the blocks whose content changed, and nothing at all if the content is identical, so
+ * re-applying the same patches is nearly free. A write to a different range drops the overlapping ranges it replaces. <br>
+ * <br>
+ * Stroopwafel_WriteMemoryAsync, uploads and mapping memory invalidate the affected ranges when they are submitted and
+ * again when they complete, so a write that overlaps them in the meantime isn't trusted. Anything else that changes IOS memory
+ * (Stroopwafel_Execute, other clients, an IOS reload) is not seen, call Stroopwafel_InvalidateWriteShadow after it.
+ * While the shadow is enabled, synchronous writes from different threads are serialized.
+ *
+ * @param max_tracked_bytes Maximum total size of the tracked ranges. Writes beyond that still work but are not tracked.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The shadow has been enabled.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: max_tracked_bytes is 0.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: Failed to allocate the shadow.
+ */
+StroopwafelStatus Stroopwafel_EnableWriteShadow(uint32_t max_tracked_bytes);
+
+/**
+ * Disables the write shadow and frees its memory.
+ * @return STROOPWAFEL_RESULT_SUCCESS
+ */
+StroopwafelStatus Stroopwafel_DisableWriteShadow();
+
+/**
+ * Forgets the content of every tracked range that overlaps [addr, addr + length), so the next write of it is sent in full.
+ * @param addr Start of the range.
+ * @param length Size of the range, 0 forgets everything.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The ranges have been dropped (or the shadow is disabled).
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: The range exceeds the 32 bit address space.
+ */
+StroopwafelStatus Stroopwafel_InvalidateWriteShadow(uint32_t addr, uint32_t length);
+
+/**
+ * Returns the statistics of the write shadow since it has been enabled.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The statistics have been stored in outStats.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid outStats pointer.
+ *         STROOPWAFEL_RESULT_NOT_FOUND: The write shadow is not enabled.
+ */
+StroopwafelStatus Stroopwafel_GetWriteShadowStats(StroopwafelWriteShadowStats *outStats);
+
 /**
  * Executes code at a target address in IOS.
  * @param target_addr The address to execute.
@@ -91,6 +227,56 @@ StroopwafelStatus Stroopwafel_WriteMemory(uint32_t num_writes, const Stroopwafel
  */
 StroopwafelStatus Stroopwafel_Execute(uint32_t target_addr, const void *config, uint32_t config_len, void *output, uint32_t output_len);
 
+typedef struct StroopwafelPreparedExecute StroopwafelPreparedExecute;
+
+/**
+ * Prepares repeated calls of the same IOS routine. <br>
+ * The handle owns pinned 0x40 aligned config/output buffers and prebuilt vectors, so running it only copies
+ * the payload and fires the IPC. A handle must not be used by multiple threads at the same time.
+ *
+ * @param target_addr The address to execute.
+ * @param config_cap Maximum config length of a single invocation.
+ * @param output_cap Maximum output length of a single invocation.
+ * @param outHandle Pointer where the handle will be stored.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The handle has been created.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid target address or outHandle pointer.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: Failed to allocate the buffers.
+ */
+StroopwafelStatus Stroopwafel_PrepareExecute(uint32_t target_addr, uint32_t config_cap, uint32_t output_cap, StroopwafelPreparedExecute **outHandle);
+
+/**
+ * Returns the pinned buffers of an invocation slot, so the payload can be written in place and the output can be read
+ * without a copy. Slot <index> is used by invocation <index> of Stroopwafel_RunPrepared.
+ * The buffers stay valid until Stroopwafel_FreePrepared is called.
+ *
+ * @return STROOPWAFEL_RESULT_SUCCESS, STROOPWAFEL_RESULT_INVALID_ARGUMENT or STROOPWAFEL_RESULT_OUT_OF_MEMORY
+ */
+StroopwafelStatus Stroopwafel_GetPreparedBuffers(StroopwafelPreparedExecute *handle, uint32_t index, void **outConfig, void **outOutput);
+
+/**
+ * Runs a prepared execute <count> times. Up to 8 invocations are queued in IOS at a time, the next one is submitted
+ * as soon as one completes. Unless the payloads are used in place, only 8 slots are allocated for any <count>.
+ *
+ * @param handle Handle created by Stroopwafel_PrepareExecute.
+ * @param count Number of invocations.
+ * @param configs count * config_len bytes, the config of invocation i starts at configs + i * config_len.
+ *                May be NULL if the configs have been written to the pinned buffers.
+ * @param config_len Config length of every invocation, at most config_cap. 0 to pass no config.
+ * @param outputs count * output_len bytes that receive the outputs. May be NULL to keep them in the pinned buffers.
+ * @param output_len Output length of every invocation, at most output_cap. 0 to pass no output.
+ * @return STROOPWAFEL_RESULT_SUCCESS: All invocations completed.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid handle, count or lengths.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: Failed to allocate buffers for additional slots.
+ *         STROOPWAFEL_RESULT_LIB_UNINITIALIZED: Library was not initialized.
+ *         STROOPWAFEL_RESULT_UNKNOWN_ERROR: At least one invocation failed, the outputs of the others are still copied.
+ */
+StroopwafelStatus Stroopwafel_RunPrepared(StroopwafelPreparedExecute *handle, uint32_t count, const void *configs, uint32_t config_len, void *outputs, uint32_t output_len);
+
+/**
+ * Frees a prepared execute handle and its buffers.
+ */
+StroopwafelStatus Stroopwafel_FreePrepared(StroopwafelPreparedExecute *handle);
+
 typedef struct StroopwafelMapMemory {
     uint32_t paddr;
     uint32_t vaddr;
@@ -110,6 +296,37 @@ typedef struct StroopwafelMapMemory {
  */
 StroopwafelStatus Stroopwafel_MapMemory(const StroopwafelMapMemory *info);
 
+/**
+ * Maps multiple memory regions in IOS. <br>
+ * Regions that overlap or touch and share the same translation, domain, type and cached attributes are merged.
+ * The result is checked against all mappings done through Stroopwafel_MapMemoryBatch before: parts that are already
+ * mapped the same way are skipped, ranges that are mapped differently reject the whole batch before anything is mapped.
+ * The remaining regions are submitted with up to 8 requests in flight. <br>
+ * Mappings done via Stroopwafel_MapMemory, Stroopwafel_MapMemoryAsync or other clients are not tracked, and the index
+ * is dropped when the library is deinitialized for the last time. Use Stroopwafel_InvalidateMapIndex if mappings
+ * changed behind the library's back (e.g. an IOS reload).
+ *
+ * @param num_regions Number of regions.
+ * @param regions Array of regions.
+ * @return STROOPWAFEL_RESULT_SUCCESS: All regions are mapped.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid arguments, empty regions or requested regions that overlap with different attributes.
+ *         STROOPWAFEL_RESULT_ALREADY_EXISTS: A region conflicts with an existing mapping, nothing has been mapped.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: Failed to allocate memory.
+ *         STROOPWAFEL_RESULT_LIB_UNINITIALIZED: Library was not initialized.
+ *         STROOPWAFEL_RESULT_UNKNOWN_ERROR: At least one mapping failed, the others have been mapped.
+ */
+StroopwafelStatus Stroopwafel_MapMemoryBatch(uint32_t num_regions, const StroopwafelMapMemory *regions);
+
+/**
+ * Forgets every mapping recorded by Stroopwafel_MapMemoryBatch that overlaps [vaddr, vaddr + size), so the next batch
+ * maps it again.
+ * @param vaddr Start of the range.
+ * @param size Size of the range, 0 forgets everything.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The mappings have been dropped from the index.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: The range exceeds the 32 bit address space.
+ */
+StroopwafelStatus Stroopwafel_InvalidateMapIndex(uint32_t vaddr, uint32_t size);
+
 typedef enum StroopwafelMinuteDevice {
     STROOPWAFEL_MIN_DEV_UNKNOWN = 0,
     STROOPWAFEL_MIN_DEV_SLC     = 1,
@@ -122,7 +339,7 @@ typedef struct StroopwafelMinutePath {
 } StroopwafelMinutePath;
 
 /**
- * Retrieves the path to the minute binary.
+ * Retrieves the path to the minute binary. The result is cached until Stroopwafel_SetFwPath() is called.
  * @param out Pointer to a StroopwafelMinutePath structure where the path will be stored.
  * @return STROOPWAFEL_RESULT_SUCCESS: Path retrieved successfully.
  *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid out pointer.
@@ -132,7 +349,7 @@ typedef struct StroopwafelMinutePath {
 StroopwafelStatus Stroopwafel_GetMinutePath(StroopwafelMinutePath *out);
 
 /**
- * Retrieves the path to the plugins directory.
+ * Retrieves the path to the plugins directory. The result is cached until Stroopwafel_SetFwPath() is called.
  * @param out Pointer to a StroopwafelMinutePath structure where the path will be stored.
  * @return STROOPWAFEL_RESULT_SUCCESS: Path retrieved successfully.
  *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid out pointer.
@@ -141,6 +358,207 @@ StroopwafelStatus Stroopwafel_GetMinutePath(StroopwafelMinutePath *out);
  */
 StroopwafelStatus Stroopwafel_GetPluginPath(StroopwafelMinutePath *out);
 
+typedef enum StroopwafelUploadFlags {
+    //! Read every chunk back after it has been written and compare its CRC-32. Requires STROOPWAFEL_IOCTLV_READ_MEMORY.
+    //! Up to num_buffers written chunks are read back with a single request, which needs another num_buffers * chunk_size bytes.
+    STROOPWAFEL_UPLOAD_FLAG_VERIFY = 1 << 0,
+} StroopwafelUploadFlags;
+
+typedef struct StroopwafelUploadOptions {
+    //! Bytes per write request, a multiple of 0x40. 0 for the default of 0x10000.
+    uint32_t chunk_size;
+    //! Number of chunk buffers, 2 to 8. 0 for the default of 2. The next chunk is read while the others are being written.
+    uint32_t num_buffers;
+    //! STROOPWAFEL_UPLOAD_FLAG_* flags.
+    uint32_t flags;
+} StroopwafelUploadOptions;
+
+typedef struct StroopwafelUploadedFile {
+    //! File name without the directory.
+    char name[256];
+    uint32_t dest_addr;
+    uint32_t size;
+    //! CRC-32 of the file content.
+    uint32_t crc32;
+} StroopwafelUploadedFile;
+
+/**
+ * Streams a file into IOS memory without loading it as a whole. Equivalent to Stroopwafel_UploadFileEx(path, dest_addr, NULL, NULL).
+ */
+StroopwafelStatus Stroopwafel_UploadFile(const char *path, uint32_t dest_addr);
+
+/**
+ * Streams a file into IOS memory at dest_addr. <br>
+ * The file is read in chunks of options->chunk_size bytes. Every chunk is sent as its own WriteMemory request, the next
+ * chunk is read from the file while the previous ones are still being written, so at most num_buffers chunks are held in memory.
+ * The write shadow of the range is invalidated.
+ *
+ * @param path Path of the file, e.g. built from Stroopwafel_GetPluginPath().
+ * @param dest_addr IOS address the file is written to.
+ * @param options Optional, NULL for the defaults.
+ * @param outFile Optional, receives the address, size and CRC-32 of the file on success.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The file has been written (and verified).
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid path or options, or the file doesn't fit below 4 GiB.
+ *         STROOPWAFEL_RESULT_NOT_FOUND: The file couldn't be opened or read.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: Failed to allocate the chunk buffers.
+ *         STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND: STROOPWAFEL_UPLOAD_FLAG_VERIFY is set, but the running stroopwafel can't read memory.
+ *         STROOPWAFEL_RESULT_LIB_UNINITIALIZED: Library was not initialized.
+ *         STROOPWAFEL_RESULT_UNKNOWN_ERROR: A write failed or a chunk didn't match after writing it. Parts of the file may have been written.
+ */
+StroopwafelStatus Stroopwafel_UploadFileEx(const char *path, uint32_t dest_addr, const StroopwafelUploadOptions *options, StroopwafelUploadedFile *outFile);
+
+/**
+ * Streams every regular file of a directory (e.g. the plugin directory) into IOS memory, one after another in name order. <br>
+ * The first file is written to dest_addr, every following one at the next multiple of alignment after the previous file.
+ * The chunk buffers are shared by all files, see Stroopwafel_UploadFileEx. The chunks of one file are still being written while
+ * the next file is read, the function only waits for all of them at the end.
+ *
+ * @param dir_path Path of the directory.
+ * @param suffix Optional, only files whose name ends with it (case-insensitive) are uploaded, e.g. ".ipx".
+ * @param dest_addr IOS address of the first file.
+ * @param alignment Alignment of the address of every file after the first, a power of two. 0 for 0x40.
+ * @param options Optional, NULL for the defaults.
+ * @param outFiles Receives name, address, size and CRC-32 of every file.
+ * @param max_files Number of entries outFiles can hold.
+ * @param outNumFiles Receives the number of files that have been uploaded, or the number of files found if max_files is too small.
+ * @return STROOPWAFEL_RESULT_SUCCESS: All files have been written.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: More than max_files files (nothing has been written), or failed to allocate the chunk buffers.
+ *         Otherwise the result of Stroopwafel_UploadFileEx for the first file that failed, the files before it have been written.
+ */
+StroopwafelStatus Stroopwafel_UploadDirectory(const char *dir_path, const char *suffix, uint32_t dest_addr, uint32_t alignment, const StroopwafelUploadOptions *options,
+                                              StroopwafelUploadedFile *outFiles, uint32_t max_files, uint32_t *outNumFiles);
+
+
+typedef struct StroopwafelCompletionQueue StroopwafelCompletionQueue;
+
+typedef struct StroopwafelCompletion {
+    //! Token that was returned by the *Async call.
+    uint32_t token;
+    //! The STROOPWAFEL_IOCTL(V)_* command of the request.
+    uint32_t command;
+    //! Result of the request, output pointers are only written on success.
+    StroopwafelStatus status;
+    //! User data passed in StroopwafelAsyncParams.
+    void *userdata;
+} StroopwafelCompletion;
+
+/**
+ * Called from the IPC completion context as soon as a request finishes.
+ * Must not block. The request slot is released right after the callback returns, the completion is not delivered to the queue.
+ */
+typedef void (*StroopwafelCompletionCallback)(const StroopwafelCompletion *completion);
+
+typedef struct StroopwafelAsyncParams {
+    //! Queue that owns the request slot and receives the completion. Required.
+    StroopwafelCompletionQueue *queue;
+    //! Optional callback, replaces the delivery to the queue.
+    StroopwafelCompletionCallback callback;
+    //! Optional user data.
+    void *userdata;
+} StroopwafelAsyncParams;
+
+/**
+ * Creates a completion queue for asynchronous requests.
+ * The queue owns the 0x40 aligned staging buffers of every request, so at most <capacity> requests can be in flight
+ * (or waiting to be received) at once.
+ * @param capacity Maximum number of requests in flight. Must be between 1 and 0xFFFF.
+ * @param outQueue Pointer where the queue will be stored.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The queue has been created.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid capacity or outQueue pointer.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: Failed to allocate the queue.
+ */
+StroopwafelStatus Stroopwafel_CreateCompletionQueue(uint32_t capacity, StroopwafelCompletionQueue **outQueue);
+
+/**
+ * Waits for every outstanding request of the queue, including callback requests, and frees it. Pending completions are discarded.
+ * @param queue The queue to destroy.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The queue has been destroyed.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid queue pointer.
+ */
+StroopwafelStatus Stroopwafel_DestroyCompletionQueue(StroopwafelCompletionQueue *queue);
+
+/**
+ * Blocks until a request of the queue has finished and releases its slot.
+ * @param queue The queue to wait on.
+ * @param outCompletion Pointer where the completion will be stored.
+ * @return STROOPWAFEL_RESULT_SUCCESS: A completion has been received.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid queue or outCompletion pointer.
+ *         STROOPWAFEL_RESULT_NOT_FOUND: No request of this queue without a callback is outstanding.
+ */
+StroopwafelStatus Stroopwafel_WaitCompletion(StroopwafelCompletionQueue *queue, StroopwafelCompletion *outCompletion);
+
+/**
+ * Same as Stroopwafel_WaitCompletion, but returns STROOPWAFEL_RESULT_NOT_FOUND instead of blocking if no request has finished yet.
+ */
+StroopwafelStatus Stroopwafel_PollCompletion(StroopwafelCompletionQueue *queue, StroopwafelCompletion *outCompletion);
+
+/**
+ * Asynchronous versions of the functions above.
+ * They validate the arguments, submit the request and return immediately. The result is delivered to asyncParams->callback
+ * if set, to asyncParams->queue otherwise.
+ * Output pointers are written before the completion is delivered. Caller buffers that are passed to IOS directly
+ * (the write sources of Stroopwafel_WriteMemoryAsync, config and output of Stroopwafel_ExecuteAsync) must stay valid
+ * until the completion has been received, everything else is copied into the request.
+ * Stroopwafel_GetAPIVersionAsync shares the cache of Stroopwafel_GetAPIVersion, a cached version is delivered (and the
+ * callback invoked) before the call returns.
+ *
+ * @return STROOPWAFEL_RESULT_SUCCESS: The request has been submitted, outToken (optional) holds its token.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Same as the synchronous version, or invalid asyncParams.
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY: All request slots of the queue are in use.
+ *         STROOPWAFEL_RESULT_LIB_UNINITIALIZED: Library was not initialized.
+ *         STROOPWAFEL_RESULT_UNKNOWN_ERROR: Failed to submit the request.
+ */
+StroopwafelStatus Stroopwafel_GetAPIVersionAsync(uint32_t *outVersion, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken);
+StroopwafelStatus Stroopwafel_SetFwPathAsync(const char *path, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken);
+StroopwafelStatus Stroopwafel_WriteMemoryAsync(uint32_t num_writes, const StroopwafelWrite *writes, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken);
+StroopwafelStatus Stroopwafel_ExecuteAsync(uint32_t target_addr, const void *config, uint32_t config_len, void *output, uint32_t output_len, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken);
+StroopwafelStatus Stroopwafel_MapMemoryAsync(const StroopwafelMapMemory *info, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken);
+StroopwafelStatus Stroopwafel_GetMinutePathAsync(StroopwafelMinutePath *out, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken);
+StroopwafelStatus Stroopwafel_GetPluginPathAsync(StroopwafelMinutePath *out, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken);
+
+#define STROOPWAFEL_STATS_MAX_COMMANDS    0x10
+#define STROOPWAFEL_STATS_LATENCY_BUCKETS 20
+
+typedef struct StroopwafelCommandStats {
+    //! Number of IPC calls for this command, including failed ones.
+    uint64_t calls;
+    //! Number of calls that failed.
+    uint64_t errors;
+    //! Sum of all input buffer/vector lengths.
+    uint64_t bytes_in;
+    //! Sum of all bytes returned by successful calls.
+    uint64_t bytes_out;
+    //! Sum of the latency of all calls in microseconds.
+    uint64_t total_latency_us;
+    //! Slowest call in microseconds.
+    uint32_t max_latency_us;
+    //! latency_histogram[0] counts calls that took less than 1us, latency_histogram[i] calls between 2^(i-1) and 2^i - 1 us.
+    //! The last bucket also counts everything slower.
+    uint32_t latency_histogram[STROOPWAFEL_STATS_LATENCY_BUCKETS];
+} StroopwafelCommandStats;
+
+/**
+ * Enables or disables collecting per-command IPC statistics. Disabled by default.
+ * While disabled the IPC path only checks a flag.
+ * @param enabled true to start collecting, false to stop. Already collected statistics are kept.
+ * @return STROOPWAFEL_RESULT_SUCCESS
+ */
+StroopwafelStatus Stroopwafel_SetStatsEnabled(bool enabled);
+
+/**
+ * Retrieves the statistics of a single command.
+ * @param command A STROOPWAFEL_IOCTL(V)_* command from commands.h.
+ * @param out Pointer where the statistics will be stored.
+ * @return STROOPWAFEL_RESULT_SUCCESS: The statistics have been stored in out.
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT: Invalid out pointer or command >= STROOPWAFEL_STATS_MAX_COMMANDS.
+ */
+StroopwafelStatus Stroopwafel_GetStats(uint32_t command, StroopwafelCommandStats *out);
+
+/**
+ * Resets the statistics of all commands.
+ * @return STROOPWAFEL_RESULT_SUCCESS
+ */
+StroopwafelStatus Stroopwafel_ResetStats();
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,255 @@
+#pragma once
+
+/**
+ * Type-safe C++20 layer over the /dev/stroopwafel commands.
+ *
+ * Every command of commands.h has a CommandTraits specialization that binds it to its transport, the API version
+ * it was introduced with and its input/output types. The call wrappers take the typed buffers, bounce them through
+ * 0x40 aligned stack storage only if they are not suitably aligned already and check the returned length, so
+ * passing the wrong type or a buffer of the wrong size fails to compile. Nothing is allocated.
+ *
+ * The IPC itself goes through the library's handle pool, so Stroopwafel_InitLibrary has to be called first.
+ */
+
+#include "commands.h"
+#include "stroopwafel.h"
+#include <coreinit/ios.h>
+#include <cstring>
+#include <stdint.h>
+#include <type_traits>
+
+namespace stroopwafel {
+    enum class Transport {
+        Ioctl,
+        Ioctlv,
+    };
+
+    //! Placeholder for a command without input or output buffer.
+    struct None {};
+
+    //! Variable length byte input of at most Max bytes.
+    template <uint32_t Max>
+    struct Bytes {
+        static constexpr uint32_t max = Max;
+    };
+
+    //! Unknown commands have no traits and can't be called.
+    template <uint32_t Command>
+    struct CommandTraits;
+
+    template <>
+    struct CommandTraits<STROOPWAFEL_IOCTL_GET_API_VERSION> {
+        static constexpr Transport transport = Transport::Ioctl;
+        static constexpr uint32_t version    = 0x010000;
+        using Input                          = None;
+        using Output                         = uint32_t;
+    };
+
+    template <>
+    struct CommandTraits<STROOPWAFEL_IOCTL_SET_FW_PATH> {
+        static constexpr Transport transport = Transport::Ioctl;
+        static constexpr uint32_t version    = 0x010000;
+        // Null terminated path, including the terminator.
+        using Input  = Bytes<256>;
+        using Output = None;
+    };
+
+    template <>
+    struct CommandTraits<STROOPWAFEL_IOCTLV_WRITE_MEMORY> {
+        static constexpr Transport transport = Transport::Ioctlv;
+        static constexpr uint32_t version    = 0x010000;
+        // Destination addresses plus one vector per write.
+        static constexpr uint32_t maxVectors = 16;
+    };
+
+    template <>
+    struct CommandTraits<STROOPWAFEL_IOCTLV_EXECUTE> {
+        static constexpr Transport transport = Transport::Ioctlv;
+        static constexpr uint32_t version    = 0x010000;
+        // Target address, optional config, optional output.
+        static constexpr uint32_t maxVectors = 3;
+    };
+
+    template <>
+    struct CommandTraits<STROOPWAFEL_IOCTL_MAP_MEMORY> {
+        static constexpr Transport transport = Transport::Ioctl;
+        static constexpr uint32_t version    = 0x010000;
+        using Input                          = StroopwafelMapMemory;
+        using Output                         = None;
+        static_assert(sizeof(Input) == 0x18, "StroopwafelMapMemory doesn't match the IOS layout");
+    };
+
+    template <>
+    struct CommandTraits<STROOPWAFEL_IOCTL_GET_MINUTE_PATH> {
+        static constexpr Transport transport = Transport::Ioctl;
+        static constexpr uint32_t version    = 0x010000;
+        using Input                          = None;
+        using Output                         = StroopwafelMinutePath;
+        static_assert(sizeof(Output) == 0x104, "StroopwafelMinutePath doesn't match the IOS layout");
+    };
+
+    template <>
+    struct CommandTraits<STROOPWAFEL_IOCTL_GET_PLUGIN_PATH> : CommandTraits<STROOPWAFEL_IOCTL_GET_MINUTE_PATH> {};
+
+    template <>
+    struct CommandTraits<STROOPWAFEL_IOCTLV_READ_MEMORY> {
+        static constexpr Transport transport = Transport::Ioctlv;
+        static constexpr uint32_t version    = 0x010100;
+        // Source addresses plus one output vector per read.
+        static constexpr uint32_t maxVectors = 16;
+    };
+
+    namespace detail {
+        // Transport of the library, checks the capabilities and records statistics.
+        StroopwafelStatus ioctl(uint32_t command, const void *in, uint32_t inLen, void *out, uint32_t outLen, int *actualLen);
+        StroopwafelStatus ioctlv(uint32_t command, uint32_t numIn, uint32_t numIo, IOSVec *vectors);
+
+        constexpr uint32_t roundUp(uint32_t size) {
+            return (size + 0x3F) & ~0x3Fu;
+        }
+
+        inline bool isAligned(const void *ptr) {
+            return ((uintptr_t) ptr & 0x3F) == 0;
+        }
+
+        template <typename T>
+        constexpr bool isNone = std::is_same_v<T, None>;
+
+        template <typename T>
+        struct IsBytes : std::false_type {};
+        template <uint32_t Max>
+        struct IsBytes<Bytes<Max>> : std::true_type {};
+
+        template <typename T>
+        constexpr uint32_t sizeOf() {
+            if constexpr (isNone<T>) {
+                return 0;
+            } else {
+                return sizeof(T);
+            }
+        }
+
+        // Whole cache lines, so IOS invalidating the buffer can't clobber data next to it.
+        template <uint32_t Size>
+        struct alignas(0x40) Bounce {
+            uint8_t data[roundUp(Size > 0 ? Size : 1)];
+        };
+
+        // Inputs only need an aligned address, outputs also have to cover whole cache lines.
+        template <typename T>
+        bool canPassInput(const T *ptr) {
+            return alignof(T) >= 0x40 || isAligned(ptr);
+        }
+
+        template <typename T>
+        bool canPassOutput(const T *ptr) {
+            if constexpr (sizeof(T) % 0x40 != 0) {
+                return false;
+            } else {
+                return alignof(T) >= 0x40 || isAligned(ptr);
+            }
+        }
+
+        template <uint32_t Command>
+        StroopwafelStatus callFixed(const typename CommandTraits<Command>::Input *in, typename CommandTraits<Command>::Output *out) {
+            using Traits = CommandTraits<Command>;
+            static_assert(Traits::transport == Transport::Ioctl, "command is not an ioctl");
+            constexpr uint32_t inSize  = sizeOf<typename Traits::Input>();
+            constexpr uint32_t outSize = sizeOf<typename Traits::Output>();
+
+            const void *ipcIn = nullptr;
+            [[maybe_unused]] Bounce<inSize> inBounce;
+            if constexpr (inSize > 0) {
+                ipcIn = in;
+                if (!canPassInput(in)) {
+                    memcpy(inBounce.data, in, inSize);
+                    ipcIn = inBounce.data;
+                }
+            }
+
+            void *ipcOut = nullptr;
+            [[maybe_unused]] Bounce<outSize> outBounce;
+            if constexpr (outSize > 0) {
+                ipcOut = canPassOutput(out) ? (void *) out : outBounce.data;
+            }
+
+            int actualLen            = 0;
+            StroopwafelStatus status = ioctl(Command, ipcIn, inSize, ipcOut, outSize, &actualLen);
+            if (status != STROOPWAFEL_RESULT_SUCCESS) {
+                return status;
+            }
+            if constexpr (outSize > 0) {
+                if ((uint32_t) actualLen != outSize) {
+                    return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+                }
+                if (ipcOut != out) {
+                    memcpy(out, ipcOut, outSize);
+                }
+            }
+            return STROOPWAFEL_RESULT_SUCCESS;
+        }
+    } // namespace detail
+
+    template <uint32_t Command>
+    concept FixedIoctl = CommandTraits<Command>::transport == Transport::Ioctl && !detail::IsBytes<typename CommandTraits<Command>::Input>::value;
+
+    /**
+     * Ioctl with input and output.
+     */
+    template <uint32_t Command>
+        requires FixedIoctl<Command> && (!detail::isNone<typename CommandTraits<Command>::Input>) && (!detail::isNone<typename CommandTraits<Command>::Output>)
+    StroopwafelStatus call(const typename CommandTraits<Command>::Input &in, typename CommandTraits<Command>::Output &out) {
+        return detail::callFixed<Command>(&in, &out);
+    }
+
+    /**
+     * Ioctl that only returns data.
+     */
+    template <uint32_t Command>
+        requires FixedIoctl<Command> && detail::isNone<typename CommandTraits<Command>::Input> && (!detail::isNone<typename CommandTraits<Command>::Output>)
+    StroopwafelStatus call(typename CommandTraits<Command>::Output &out) {
+        return detail::callFixed<Command>(nullptr, &out);
+    }
+
+    /**
+     * Ioctl that only takes data.
+     */
+    template <uint32_t Command>
+        requires FixedIoctl<Command> && (!detail::isNone<typename CommandTraits<Command>::Input>) && detail::isNone<typename CommandTraits<Command>::Output>
+    StroopwafelStatus call(const typename CommandTraits<Command>::Input &in) {
+        return detail::callFixed<Command>(&in, nullptr);
+    }
+
+    /**
+     * Ioctl with a variable length byte input, bounced through the stack if it's not aligned.
+     */
+    template <uint32_t Command>
+        requires(CommandTraits<Command>::transport == Transport::Ioctl && detail::IsBytes<typename CommandTraits<Command>::Input>::value)
+    StroopwafelStatus callBytes(const void *data, uint32_t length) {
+        constexpr uint32_t max = CommandTraits<Command>::Input::max;
+        if (length > max) {
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        detail::Bounce<max> bounce;
+        const void *ipcIn = data;
+        if (!detail::isAligned(data)) {
+            memcpy(bounce.data, data, length);
+            ipcIn = bounce.data;
+        }
+        return detail::ioctl(Command, ipcIn, length, nullptr, 0, nullptr);
+    }
+
+    /**
+     * Ioctlv, the vector count is checked against the command at compile time. The buffers are passed as-is and
+     * have to follow the IPC alignment rules.
+     */
+    template <uint32_t Command, uint32_t N>
+        requires(CommandTraits<Command>::transport == Transport::Ioctlv)
+    StroopwafelStatus callv(IOSVec (&vectors)[N], uint32_t numIn, uint32_t numIo) {
+        static_assert(N <= CommandTraits<Command>::maxVectors, "too many vectors for this command");
+        if (numIn + numIo > N) {
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        return detail::ioctlv(Command, numIn, numIo, vectors);
+    }
+} // namespace stroopwafel
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "stroopwafel.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * IPC trace file format, all fields are big-endian:
+ * - StroopwafelTraceHeader at offset 0
+ * - num_records records starting at header_size, oldest first. Each record is a StroopwafelTraceRecord followed by
+ *   the length of each of its num_in + num_io vectors (uint32_t) and, if STROOPWAFEL_TRACE_RECORD_PAYLOAD is set, the
+ *   data of the num_in input vectors. Every vector's data is padded to 4 bytes, record_size covers all of it.
+ *
+ * An ioctl is stored as one input and one output vector. Payloads are stored as they were passed to IOS, so numbers
+ * inside them use the byte order of the recording system (see STROOPWAFEL_TRACE_FLAG_BIG_ENDIAN).
+ */
+#define STROOPWAFEL_TRACE_MAGIC   0x53575452 // "SWTR"
+#define STROOPWAFEL_TRACE_VERSION 1
+
+typedef enum StroopwafelTraceFlags {
+    //! Record the input buffers of every call, not only their lengths.
+    STROOPWAFEL_TRACE_FLAG_PAYLOADS = 1 << 0,
+    //! Set in the file header if the payloads were recorded on a big-endian system.
+    STROOPWAFEL_TRACE_FLAG_BIG_ENDIAN = 1 << 1,
+} StroopwafelTraceFlags;
+
+typedef enum StroopwafelTraceRecordFlags {
+    STROOPWAFEL_TRACE_RECORD_IOCTLV = 1 << 0,
+    //! Submitted asynchronously, result is the result of the submission and duration_us is 0.
+    STROOPWAFEL_TRACE_RECORD_ASYNC = 1 << 1,
+    //! The input data follows the vector lengths.
+    STROOPWAFEL_TRACE_RECORD_PAYLOAD = 1 << 2,
+} StroopwafelTraceRecordFlags;
+
+typedef struct StroopwafelTraceHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t flags;
+    uint32_t num_records;
+    //! Records that were overwritten because the ring buffer was full, or not recorded because a call had more than 16 vectors.
+    uint32_t dropped_records;
+    uint32_t reserved[3];
+} StroopwafelTraceHeader;
+
+typedef struct StroopwafelTraceRecord {
+    uint32_t record_size;
+    uint32_t reserved;
+    //! Start of the call in microseconds since the trace was started.
+    uint64_t timestamp_us;
+    uint32_t duration_us;
+    int32_t result;
+    uint8_t command;
+    uint8_t flags;
+    uint8_t num_in;
+    uint8_t num_io;
+    //! Core the call was made from.
+    uint8_t core;
+    uint8_t reserved2[3];
+} StroopwafelTraceRecord;
+
+/**
+ * Starts recording every /dev/stroopwafel IPC into a ring buffer. Replaces (and drops) a trace that is already running. <br>
+ * When the ring buffer is full the oldest records are overwritten. Records whose payload would take more than an eighth
+ * of the buffer are stored without payload.
+ *
+ * @param buffer_size size of the ring buffer in bytes, at least 0x1000.
+ * @param flags STROOPWAFEL_TRACE_FLAG_PAYLOADS or 0.
+ * @return STROOPWAFEL_RESULT_SUCCESS:             Recording has been started. <br>
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT:    buffer_size is too small or unknown flags. <br>
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY:       Failed to allocate the ring buffer.
+ */
+StroopwafelStatus Stroopwafel_StartTrace(uint32_t buffer_size, uint32_t flags);
+
+/**
+ * Stops recording and frees the ring buffer. Records that have not been flushed are lost.
+ * @return STROOPWAFEL_RESULT_SUCCESS
+ */
+StroopwafelStatus Stroopwafel_StopTrace();
+
+/**
+ * Writes the records of the ring buffer to a trace file and empties the ring buffer. Recording continues.
+ *
+ * @param path path of the file that will be created.
+ * @return STROOPWAFEL_RESULT_SUCCESS:             The trace has been written. <br>
+ *         STROOPWAFEL_RESULT_INVALID_ARGUMENT:    Invalid path. <br>
+ *         STROOPWAFEL_RESULT_NOT_FOUND:           No trace is running or the file couldn't be written. <br>
+ *         STROOPWAFEL_RESULT_OUT_OF_MEMORY:       Failed to allocate the copy of the ring buffer.
+ */
+StroopwafelStatus Stroopwafel_FlushTrace(const char *path);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
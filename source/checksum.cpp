@@ -0,0 +1,143 @@
+#include "checksum.h"
+#include <cstring>
+
+namespace {
+    // Slicing-by-4 tables, generated at compile time.
+    struct Crc32Tables {
+        uint32_t table[4][256];
+
+        constexpr Crc32Tables() : table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+                }
+                table[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; i++) {
+                for (int slice = 1; slice < 4; slice++) {
+                    table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    constexpr Crc32Tables sCrc32;
+
+    uint32_t rotl(uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    uint32_t loadBE32(const uint8_t *p) {
+        return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+    }
+
+    void sha1Block(uint32_t state[5], const uint8_t *block) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = loadBE32(block + i * 4);
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+            e             = d;
+            d             = c;
+            c             = rotl(b, 30);
+            b             = a;
+            a             = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+} // namespace
+
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len) {
+    auto *p = (const uint8_t *) data;
+    crc     = ~crc;
+    // Byte order independent: the word is assembled from bytes instead of loaded directly.
+    while (len >= 4) {
+        crc ^= (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+        crc = sCrc32.table[3][crc & 0xFF] ^ sCrc32.table[2][(crc >> 8) & 0xFF] ^ sCrc32.table[1][(crc >> 16) & 0xFF] ^ sCrc32.table[0][crc >> 24];
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ sCrc32.table[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+void sha1Init(Sha1Context *ctx) {
+    ctx->state[0] = 0x67452301;
+    ctx->state[1] = 0xEFCDAB89;
+    ctx->state[2] = 0x98BADCFE;
+    ctx->state[3] = 0x10325476;
+    ctx->state[4] = 0xC3D2E1F0;
+    ctx->length   = 0;
+}
+
+void sha1Update(Sha1Context *ctx, const void *data, size_t len) {
+    auto *p         = (const uint8_t *) data;
+    uint32_t filled = (uint32_t) (ctx->length & 0x3F);
+    ctx->length += len;
+
+    if (filled) {
+        uint32_t copy = 64 - filled < len ? 64 - filled : (uint32_t) len;
+        memcpy(ctx->buffer + filled, p, copy);
+        p += copy;
+        len -= copy;
+        if (filled + copy < 64) {
+            return;
+        }
+        sha1Block(ctx->state, ctx->buffer);
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+        sha1Block(ctx->state, p);
+    }
+    memcpy(ctx->buffer, p, len);
+}
+
+void sha1Final(Sha1Context *ctx, uint8_t out[20]) {
+    uint64_t bits   = ctx->length * 8;
+    uint32_t filled = (uint32_t) (ctx->length & 0x3F);
+
+    ctx->buffer[filled++] = 0x80;
+    if (filled > 56) {
+        memset(ctx->buffer + filled, 0, 64 - filled);
+        sha1Block(ctx->state, ctx->buffer);
+        filled = 0;
+    }
+    memset(ctx->buffer + filled, 0, 56 - filled);
+    for (int i = 0; i < 8; i++) {
+        ctx->buffer[56 + i] = (uint8_t) (bits >> (56 - i * 8));
+    }
+    sha1Block(ctx->state, ctx->buffer);
+
+    for (int i = 0; i < 5; i++) {
+        out[i * 4 + 0] = (uint8_t) (ctx->state[i] >> 24);
+        out[i * 4 + 1] = (uint8_t) (ctx->state[i] >> 16);
+        out[i * 4 + 2] = (uint8_t) (ctx->state[i] >> 8);
+        out[i * 4 + 3] = (uint8_t) ctx->state[i];
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 as used by zlib/PNG/ZIP. Start with crc = 0 and feed the previous result back in for streaming.
+uint32_t crc32Update(uint32_t crc, const void *data, size_t len);
+
+struct Sha1Context {
+    uint32_t state[5];
+    uint64_t length;
+    uint8_t buffer[64];
+};
+
+void sha1Init(Sha1Context *ctx);
+void sha1Update(Sha1Context *ctx, const void *data, size_t len);
+void sha1Final(Sha1Context *ctx, uint8_t out[20]);
@@ -0,0 +1,659 @@
+#include "stroopwafel/fsa.h"
+#include "fsa_block_cache.h"
+#include "ipc_buffer_pool.h"
+#include "logger.h"
+#include "stroopwafel_ipc.h"
+#include <algorithm>
+#include <coreinit/filesystem_fsa.h>
+#include <coreinit/ios.h>
+#include <coreinit/messagequeue.h>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+#include <stdint.h>
+
+namespace {
+    void prepareRawIOShim(FSAShimBuffer *shim, FSAClientHandle clientHandle, FSACommandEnum command, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+        shim->clientHandle = clientHandle;
+        shim->ipcReqType   = FSA_IPC_REQUEST_IOCTLV;
+        shim->command      = command;
+
+        // Reads return the data in the second vector, writes send it as second input vector.
+        if (command == FSA_COMMAND_RAW_READ) {
+            shim->ioctlvVecIn  = 1;
+            shim->ioctlvVecOut = 2;
+        } else {
+            shim->ioctlvVecIn  = 2;
+            shim->ioctlvVecOut = 1;
+        }
+
+        shim->ioctlvVec[0].vaddr = &shim->request;
+        shim->ioctlvVec[0].len   = sizeof(FSARequest);
+
+        shim->ioctlvVec[1].vaddr = (void *) data;
+        shim->ioctlvVec[1].len   = size_bytes * cnt;
+
+        shim->ioctlvVec[2].vaddr = &shim->response;
+        shim->ioctlvVec[2].len   = sizeof(FSAResponse);
+
+        if (command == FSA_COMMAND_RAW_READ) {
+            shim->request.rawRead.blocks_offset = blocks_offset;
+            shim->request.rawRead.count         = cnt;
+            shim->request.rawRead.size          = size_bytes;
+            shim->request.rawRead.device_handle = device_handle;
+        } else {
+            shim->request.rawWrite.blocks_offset = blocks_offset;
+            shim->request.rawWrite.count         = cnt;
+            shim->request.rawWrite.size          = size_bytes;
+            shim->request.rawWrite.device_handle = device_handle;
+        }
+    }
+} // namespace
+
+FSError doRawIO(FSAClientHandle clientHandle, FSACommandEnum command, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if (data == nullptr) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    // The transfer length is a single 32 bit vector length.
+    if ((uint64_t) size_bytes * cnt > 0xFFFFFFFF) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    IPCBuffer shimBuffer;
+    if (!shimBuffer.acquire(sizeof(FSAShimBuffer))) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    auto *shim = shimBuffer.as<FSAShimBuffer>();
+
+    // Unaligned buffers are bounced through an aligned one, for reads the length has to be aligned as well.
+    uint32_t length = size_bytes * cnt;
+    bool aligned    = command == FSA_COMMAND_RAW_READ ? isIPCAligned(data, length) : isIPCAligned(data);
+    IPCBuffer bounce;
+    void *ipcData = (void *) data;
+    if (!aligned) {
+        if (!bounce.acquire(length)) {
+            return FS_ERROR_INVALID_BUFFER;
+        }
+        ipcData = bounce.data();
+        if (command == FSA_COMMAND_RAW_WRITE) {
+            memcpy(ipcData, data, length);
+        }
+    }
+
+    prepareRawIOShim(shim, clientHandle, command, ipcData, size_bytes, cnt, blocks_offset, device_handle);
+
+    auto res = __FSAShimSend(shim, 0);
+    if (res >= 0 && command == FSA_COMMAND_RAW_READ && ipcData != data) {
+        memcpy((void *) data, ipcData, length);
+    }
+    return res;
+}
+
+FSError FSAEx_RawOpen(FSClient *client, const char *device_path, int32_t *outHandle) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawOpenEx(FSGetClientBody(client)->clientHandle, device_path, outHandle);
+}
+
+FSError FSAEx_RawOpenEx(FSAClientHandle clientHandle, const char *device_path, int32_t *outHandle) {
+    if (!outHandle || !device_path) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    if (strlen(device_path) >= sizeof(FSARequestRawOpen::path)) {
+        return FS_ERROR_INVALID_PATH;
+    }
+
+    IPCBuffer shimBuffer;
+    if (!shimBuffer.acquire(sizeof(FSAShimBuffer))) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    auto *shim = shimBuffer.as<FSAShimBuffer>();
+
+    shim->clientHandle = clientHandle;
+    shim->ipcReqType   = FSA_IPC_REQUEST_IOCTL;
+    shim->command      = FSA_COMMAND_RAW_OPEN;
+    strcpy(shim->request.rawOpen.path, device_path);
+
+    auto res = __FSAShimSend(shim, 0);
+    if (res >= 0) {
+        *outHandle = shim->response.rawOpen.handle;
+    }
+    return res;
+}
+
+FSError FSAEx_RawClose(FSClient *client, int32_t device_handle) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawCloseEx(FSGetClientBody(client)->clientHandle, device_handle);
+}
+
+FSError FSAEx_RawCloseEx(FSAClientHandle clientHandle, int32_t device_handle) {
+    IPCBuffer shimBuffer;
+    if (!shimBuffer.acquire(sizeof(FSAShimBuffer))) {
+        return FS_ERROR_INVALID_BUFFER;
+    }
+    auto *shim = shimBuffer.as<FSAShimBuffer>();
+
+    shim->clientHandle           = clientHandle;
+    shim->ipcReqType             = FSA_IPC_REQUEST_IOCTL;
+    shim->command                = FSA_COMMAND_RAW_CLOSE;
+    shim->request.rawClose.handle = device_handle;
+
+    // The handle may be reused for a different device.
+    blockCacheInvalidate(device_handle);
+    return __FSAShimSend(shim, 0);
+}
+
+FSError FSAEx_RawRead(FSClient *client, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawReadEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+}
+
+FSError FSAEx_RawReadEx(FSAClientHandle clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if ((uint64_t) size_bytes * cnt > 0xFFFFFFFF) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    FSError res;
+    if (blockCacheRead(clientHandle, data, size_bytes, cnt, blocks_offset, device_handle, &res)) {
+        return res;
+    }
+    return doRawIO(clientHandle, FSA_COMMAND_RAW_READ, data, size_bytes, cnt, blocks_offset, device_handle);
+}
+
+FSError FSAEx_RawWrite(FSClient *client, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawWriteEx(FSGetClientBody(client)->clientHandle, data, size_bytes, cnt, blocks_offset, device_handle);
+}
+
+FSError FSAEx_RawWriteEx(FSAClientHandle clientHandle, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    auto res = doRawIO(clientHandle, FSA_COMMAND_RAW_WRITE, data, size_bytes, cnt, blocks_offset, device_handle);
+    if (data) {
+        // A failed write may have reached the device partially, so those pages are dropped.
+        blockCacheWritten(res >= 0 ? data : nullptr, size_bytes, cnt, blocks_offset, device_handle);
+    }
+    return res;
+}
+
+namespace {
+    // Read extents closer than this are merged and the gap is read into the staging buffer.
+    constexpr uint32_t MAX_READ_GAP_BYTES = 0x4000;
+    // Merged runs don't grow beyond this, a single bigger extent is still submitted as one request.
+    constexpr uint32_t MAX_RUN_BYTES      = 0x100000;
+    constexpr uint32_t MAX_RUNS_IN_FLIGHT = 8;
+
+    struct RawVecRun {
+        uint64_t first;
+        uint32_t cnt;
+        // Range of the run in the sorted extent order.
+        uint32_t begin;
+        uint32_t end;
+        void *ipcData;
+        IPCBuffer shim;
+        IPCBuffer staging;
+        IOSError result;
+        OSMessageQueue *queue;
+    };
+
+    void rawVecCallback(IOSError result, void *context) {
+        auto *run   = (RawVecRun *) context;
+        run->result = result;
+
+        OSMessage message;
+        message.message = run;
+        OSSendMessage(run->queue, &message, OS_MESSAGE_FLAGS_NONE);
+    }
+
+    uint64_t extentEnd(const FSAExRawExtent &extent) {
+        return extent.blocks_offset + extent.cnt;
+    }
+
+    // Sorts the extents and splits them into runs. Returns the number of runs or 0 if overlapping writes would
+    // need a single request of more than 4 GiB.
+    uint32_t buildRawVecRuns(bool write, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, uint32_t *order, RawVecRun *runs) {
+        for (uint32_t i = 0; i < num_extents; i++) {
+            order[i] = i;
+        }
+        std::sort(order, order + num_extents, [extents](uint32_t a, uint32_t b) {
+            return extents[a].blocks_offset != extents[b].blocks_offset ? extents[a].blocks_offset < extents[b].blocks_offset : a < b;
+        });
+
+        uint64_t maxGap  = write ? 0 : MAX_READ_GAP_BYTES / size_bytes;
+        uint64_t maxRun  = MAX_RUN_BYTES / size_bytes;
+        uint32_t numRuns = 0;
+        RawVecRun *run   = nullptr;
+        uint64_t runEnd  = 0;
+        for (uint32_t i = 0; i < num_extents; i++) {
+            const auto &extent = extents[order[i]];
+            // Writes can only be merged if they touch or overlap, reads may also bridge small gaps.
+            // An overlapping write has to stay in the run even beyond maxRun, otherwise two runs would write the
+            // overlapped sectors and the order of the requests, not the order of the extents, would decide the result.
+            uint64_t mergedEnd = std::max(runEnd, extentEnd(extent));
+            bool overlaps      = write && run && extent.blocks_offset < runEnd;
+            if (overlaps && (mergedEnd - run->first) * size_bytes > 0xFFFFFFFF) {
+                return 0;
+            }
+            if (run && extent.blocks_offset <= runEnd + maxGap && (overlaps || mergedEnd - run->first <= maxRun)) {
+                runEnd   = mergedEnd;
+                run->cnt = (uint32_t) (runEnd - run->first);
+                run->end = i + 1;
+                continue;
+            }
+            run        = &runs[numRuns++];
+            run->first = extent.blocks_offset;
+            run->cnt   = extent.cnt;
+            run->begin = i;
+            run->end   = i + 1;
+            runEnd     = extentEnd(extent);
+        }
+
+        if (write) {
+            // Within a run the extents are copied in submission order, so later extents win on overlaps.
+            for (uint32_t i = 0; i < numRuns; i++) {
+                std::sort(order + runs[i].begin, order + runs[i].end);
+            }
+        }
+        return numRuns;
+    }
+
+    bool rawVecSubmit(FSAClientHandle clientHandle, FSACommandEnum command, uint32_t size_bytes, const FSAExRawExtent *extents, const uint32_t *order, RawVecRun *run, int device_handle) {
+        uint32_t length = run->cnt * size_bytes;
+        if (!run->shim.acquire(sizeof(FSAShimBuffer))) {
+            return false;
+        }
+
+        // A run made of a single aligned extent is passed to IOS as-is.
+        const auto &single = extents[order[run->begin]];
+        if (run->end - run->begin == 1 && isIPCAligned(single.data, length)) {
+            run->ipcData = single.data;
+        } else {
+            if (!run->staging.acquire(length)) {
+                return false;
+            }
+            run->ipcData = run->staging.data();
+            if (command == FSA_COMMAND_RAW_WRITE) {
+                for (uint32_t i = run->begin; i < run->end; i++) {
+                    const auto &extent = extents[order[i]];
+                    memcpy((uint8_t *) run->ipcData + (extent.blocks_offset - run->first) * size_bytes, extent.data, extent.cnt * size_bytes);
+                }
+            }
+        }
+
+        auto *shim = run->shim.as<FSAShimBuffer>();
+        prepareRawIOShim(shim, clientHandle, command, run->ipcData, size_bytes, run->cnt, run->first, device_handle);
+        auto res = IOS_IoctlvAsync(clientHandle, command, shim->ioctlvVecIn, shim->ioctlvVecOut, shim->ioctlvVec, rawVecCallback, run);
+        if (res < 0) {
+            // The request never reached IOS, so no callback will arrive for it.
+            rawVecCallback(res, run);
+        }
+        return true;
+    }
+
+    FSError rawVecComplete(FSAClientHandle clientHandle, FSACommandEnum command, uint32_t size_bytes, const FSAExRawExtent *extents, const uint32_t *order, RawVecRun *run, int device_handle) {
+        FSError res = FS_ERROR_OK;
+        if (run->result < 0) {
+            res = __FSAShimDecodeIosErrorToFsaStatus(clientHandle, run->result);
+            DEBUG_FUNCTION_LINE_ERR("Raw %s of sectors %llu-%llu failed: %d", command == FSA_COMMAND_RAW_READ ? "read" : "write", (unsigned long long) run->first, (unsigned long long) (run->first + run->cnt - 1), res);
+        }
+
+        if (command == FSA_COMMAND_RAW_READ) {
+            if (res >= 0 && run->staging.data()) {
+                for (uint32_t i = run->begin; i < run->end; i++) {
+                    const auto &extent = extents[order[i]];
+                    memcpy(extent.data, (const uint8_t *) run->ipcData + (extent.blocks_offset - run->first) * size_bytes, extent.cnt * size_bytes);
+                }
+            }
+        } else {
+            blockCacheWritten(res >= 0 ? run->ipcData : nullptr, size_bytes, run->cnt, run->first, device_handle);
+        }
+        run->shim.release();
+        run->staging.release();
+        return res;
+    }
+
+    FSError doRawIOV(FSAClientHandle clientHandle, FSACommandEnum command, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle) {
+        if (!extents || size_bytes == 0 || size_bytes > MAX_RUN_BYTES) {
+            return FS_ERROR_INVALID_PARAM;
+        }
+        for (uint32_t i = 0; i < num_extents; i++) {
+            if (!extents[i].data || extents[i].cnt == 0 || (uint64_t) extents[i].cnt * size_bytes > 0xFFFFFFFF) {
+                return FS_ERROR_INVALID_PARAM;
+            }
+        }
+        if (num_extents == 0) {
+            return FS_ERROR_OK;
+        }
+
+        auto *order = (uint32_t *) malloc(num_extents * sizeof(uint32_t));
+        auto *runs  = (RawVecRun *) malloc(num_extents * sizeof(RawVecRun));
+        if (!order || !runs) {
+            free(order);
+            free(runs);
+            return FS_ERROR_OUT_OF_RESOURCES;
+        }
+        for (uint32_t i = 0; i < num_extents; i++) {
+            new (&runs[i]) RawVecRun();
+        }
+        uint32_t numRuns = buildRawVecRuns(command == FSA_COMMAND_RAW_WRITE, size_bytes, extents, num_extents, order, runs);
+        if (numRuns == 0) {
+            for (uint32_t i = 0; i < num_extents; i++) {
+                runs[i].~RawVecRun();
+            }
+            free(order);
+            free(runs);
+            return FS_ERROR_INVALID_PARAM;
+        }
+
+        OSMessage messages[MAX_RUNS_IN_FLIGHT];
+        OSMessageQueue queue;
+        OSInitMessageQueue(&queue, messages, MAX_RUNS_IN_FLIGHT);
+
+        // Keep up to MAX_RUNS_IN_FLIGHT requests queued in IOS, stop submitting after the first error.
+        FSError result     = FS_ERROR_OK;
+        uint32_t submitted = 0;
+        uint32_t inFlight  = 0;
+        while (inFlight > 0 || (submitted < numRuns && result == FS_ERROR_OK)) {
+            if (submitted < numRuns && result == FS_ERROR_OK && inFlight < MAX_RUNS_IN_FLIGHT) {
+                auto *run  = &runs[submitted++];
+                run->queue = &queue;
+                if (!rawVecSubmit(clientHandle, command, size_bytes, extents, order, run, device_handle)) {
+                    result = FS_ERROR_OUT_OF_RESOURCES;
+                    continue;
+                }
+                inFlight++;
+                continue;
+            }
+
+            OSMessage message;
+            OSReceiveMessage(&queue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+            inFlight--;
+            auto res = rawVecComplete(clientHandle, command, size_bytes, extents, order, (RawVecRun *) message.message, device_handle);
+            if (res < 0 && result == FS_ERROR_OK) {
+                result = res;
+            }
+        }
+
+        for (uint32_t i = 0; i < num_extents; i++) {
+            runs[i].~RawVecRun();
+        }
+        free(order);
+        free(runs);
+        return result;
+    }
+} // namespace
+
+FSError FSAEx_RawReadV(FSClient *client, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawReadVEx(FSGetClientBody(client)->clientHandle, size_bytes, extents, num_extents, device_handle);
+}
+
+FSError FSAEx_RawReadVEx(FSAClientHandle clientHandle, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle) {
+    return doRawIOV(clientHandle, FSA_COMMAND_RAW_READ, size_bytes, extents, num_extents, device_handle);
+}
+
+FSError FSAEx_RawWriteV(FSClient *client, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle) {
+    if (!client) {
+        return FS_ERROR_INVALID_CLIENTHANDLE;
+    }
+    return FSAEx_RawWriteVEx(FSGetClientBody(client)->clientHandle, size_bytes, extents, num_extents, device_handle);
+}
+
+FSError FSAEx_RawWriteVEx(FSAClientHandle clientHandle, uint32_t size_bytes, const FSAExRawExtent *extents, uint32_t num_extents, int device_handle) {
+    return doRawIOV(clientHandle, FSA_COMMAND_RAW_WRITE, size_bytes, extents, num_extents, device_handle);
+}
+
+struct FSAExRawStreamSlot {
+    FSAShimBuffer *shim;
+    FSAExRawStream *stream;
+    void *buffer;
+    uint64_t blocks_offset;
+    uint32_t cnt;
+    IOSError result;
+    bool inFlight;
+    bool done;
+};
+
+struct FSAExRawStream {
+    FSAClientHandle clientHandle;
+    int device_handle;
+    FSAExRawStreamMode mode;
+    uint32_t size_bytes;
+    uint32_t chunk_cnt;
+    uint64_t nextOffset;
+    uint64_t endOffset;
+    FSError error;
+    // Slots are used in ring order, head is always the oldest chunk.
+    uint32_t numSlots;
+    uint32_t head;
+    bool chunkHandedOut;
+    FSAExRawStreamSlot *slots;
+    OSMessage *messages;
+    OSMessageQueue queue;
+};
+
+namespace {
+    // Called from the IPC completion context, must not block.
+    void rawStreamCallback(IOSError result, void *context) {
+        auto *slot   = (FSAExRawStreamSlot *) context;
+        slot->result = result;
+
+        OSMessage message;
+        message.message = slot;
+        OSSendMessage(&slot->stream->queue, &message, OS_MESSAGE_FLAGS_NONE);
+    }
+
+    void rawStreamSubmit(FSAExRawStream *stream, FSAExRawStreamSlot *slot, uint32_t cnt) {
+        auto command        = stream->mode == FSAEX_RAW_STREAM_READ ? FSA_COMMAND_RAW_READ : FSA_COMMAND_RAW_WRITE;
+        slot->blocks_offset = stream->nextOffset;
+        slot->cnt           = cnt;
+        slot->done          = false;
+        slot->inFlight      = true;
+
+        stream->nextOffset += cnt;
+        if (command == FSA_COMMAND_RAW_WRITE) {
+            // The cache can't be updated from the completion context, drop the pages now and again on completion.
+            blockCacheWritten(nullptr, stream->size_bytes, cnt, slot->blocks_offset, stream->device_handle);
+        }
+
+        prepareRawIOShim(slot->shim, stream->clientHandle, command, slot->buffer, stream->size_bytes, cnt, slot->blocks_offset, stream->device_handle);
+
+        auto res = IOS_IoctlvAsync(stream->clientHandle, command, slot->shim->ioctlvVecIn, slot->shim->ioctlvVecOut, slot->shim->ioctlvVec, rawStreamCallback, slot);
+        if (res < 0) {
+            // The request never reached IOS, so no callback will arrive for it.
+            slot->result   = res;
+            slot->done     = true;
+            slot->inFlight = false;
+        }
+    }
+
+    void rawStreamWait(FSAExRawStream *stream, FSAExRawStreamSlot *slot) {
+        while (slot->inFlight) {
+            OSMessage message;
+            OSReceiveMessage(&stream->queue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+            auto *completed     = (FSAExRawStreamSlot *) message.message;
+            completed->done     = true;
+            completed->inFlight = false;
+        }
+        if (slot->done) {
+            slot->done = false;
+            if (stream->mode == FSAEX_RAW_STREAM_WRITE) {
+                blockCacheWritten(nullptr, stream->size_bytes, slot->cnt, slot->blocks_offset, stream->device_handle);
+            }
+            if (slot->result < 0 && stream->error == FS_ERROR_OK) {
+                stream->error = __FSAShimDecodeIosErrorToFsaStatus(stream->clientHandle, slot->result);
+                DEBUG_FUNCTION_LINE_ERR("Raw %s at sector %llu failed: %d", stream->mode == FSAEX_RAW_STREAM_READ ? "read" : "write", (unsigned long long) slot->blocks_offset, stream->error);
+            }
+        }
+    }
+
+    uint32_t rawStreamNextCount(FSAExRawStream *stream) {
+        uint64_t remaining = stream->endOffset - stream->nextOffset;
+        return remaining < stream->chunk_cnt ? (uint32_t) remaining : stream->chunk_cnt;
+    }
+
+    void rawStreamFree(FSAExRawStream *stream) {
+        if (stream->slots) {
+            for (uint32_t i = 0; i < stream->numSlots; i++) {
+                free(stream->slots[i].shim);
+                free(stream->slots[i].buffer);
+            }
+        }
+        free(stream->slots);
+        free(stream->messages);
+        free(stream);
+    }
+} // namespace
+
+FSError FSAEx_RawStreamOpen(FSAClientHandle clientHandle, int device_handle, FSAExRawStreamMode mode, uint32_t size_bytes, uint32_t chunk_cnt, uint32_t num_buffers, uint64_t blocks_offset, uint64_t total_cnt, FSAExRawStream **outStream) {
+    if (!outStream || size_bytes == 0 || chunk_cnt == 0 || (mode != FSAEX_RAW_STREAM_READ && mode != FSAEX_RAW_STREAM_WRITE)) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if ((uint64_t) size_bytes * chunk_cnt > 0x7FFFFFC0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (num_buffers < 2) {
+        num_buffers = 2;
+    }
+
+    auto *stream = (FSAExRawStream *) malloc(sizeof(FSAExRawStream));
+    if (!stream) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    memset(stream, 0, sizeof(FSAExRawStream));
+    stream->clientHandle  = clientHandle;
+    stream->device_handle = device_handle;
+    stream->mode          = mode;
+    stream->size_bytes    = size_bytes;
+    stream->chunk_cnt     = chunk_cnt;
+    stream->nextOffset    = blocks_offset;
+    stream->endOffset     = blocks_offset + total_cnt;
+    stream->error         = FS_ERROR_OK;
+    stream->numSlots      = num_buffers;
+    stream->slots         = (FSAExRawStreamSlot *) calloc(num_buffers, sizeof(FSAExRawStreamSlot));
+    stream->messages      = (OSMessage *) calloc(num_buffers, sizeof(OSMessage));
+    if (!stream->slots || !stream->messages) {
+        rawStreamFree(stream);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    uint32_t chunkSize = ROUNDUP(size_bytes * chunk_cnt, 0x40);
+    for (uint32_t i = 0; i < num_buffers; i++) {
+        auto &slot  = stream->slots[i];
+        slot.stream = stream;
+        slot.shim   = (FSAShimBuffer *) memalign(0x40, sizeof(FSAShimBuffer));
+        slot.buffer = memalign(0x40, chunkSize);
+        if (!slot.shim || !slot.buffer) {
+            rawStreamFree(stream);
+            return FS_ERROR_OUT_OF_RESOURCES;
+        }
+    }
+
+    OSInitMessageQueue(&stream->queue, stream->messages, (int32_t) num_buffers);
+
+    if (mode == FSAEX_RAW_STREAM_READ) {
+        // Fill the whole pipeline right away.
+        for (uint32_t i = 0; i < num_buffers && stream->nextOffset < stream->endOffset; i++) {
+            rawStreamSubmit(stream, &stream->slots[i], rawStreamNextCount(stream));
+        }
+    }
+
+    *outStream = stream;
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawStreamRead(FSAExRawStream *stream, const void **outData, uint32_t *outCnt, uint64_t *outBlocksOffset) {
+    if (!stream || stream->mode != FSAEX_RAW_STREAM_READ || !outData || !outCnt) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (stream->error != FS_ERROR_OK) {
+        return stream->error;
+    }
+
+    auto *slot = &stream->slots[stream->head];
+    if (stream->chunkHandedOut) {
+        // The caller is done with the previous chunk, reuse its buffer for the next read-ahead.
+        stream->chunkHandedOut = false;
+        if (stream->nextOffset < stream->endOffset) {
+            rawStreamSubmit(stream, slot, rawStreamNextCount(stream));
+        }
+        stream->head = (stream->head + 1) % stream->numSlots;
+        slot         = &stream->slots[stream->head];
+    }
+
+    if (!slot->inFlight && !slot->done) {
+        return FS_ERROR_END_OF_FILE;
+    }
+
+    rawStreamWait(stream, slot);
+    if (stream->error != FS_ERROR_OK) {
+        return stream->error;
+    }
+
+    stream->chunkHandedOut = true;
+    *outData               = slot->buffer;
+    *outCnt                = slot->cnt;
+    if (outBlocksOffset) {
+        *outBlocksOffset = slot->blocks_offset;
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawStreamGetWriteBuffer(FSAExRawStream *stream, void **outData, uint32_t *outCnt) {
+    if (!stream || stream->mode != FSAEX_RAW_STREAM_WRITE || !outData || !outCnt) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (stream->nextOffset >= stream->endOffset) {
+        return FS_ERROR_END_OF_FILE;
+    }
+
+    auto *slot = &stream->slots[stream->head];
+    rawStreamWait(stream, slot);
+    if (stream->error != FS_ERROR_OK) {
+        return stream->error;
+    }
+
+    *outData = slot->buffer;
+    *outCnt  = rawStreamNextCount(stream);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawStreamSubmitWrite(FSAExRawStream *stream, uint32_t cnt) {
+    if (!stream || stream->mode != FSAEX_RAW_STREAM_WRITE || cnt == 0 || cnt > rawStreamNextCount(stream)) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    if (stream->error != FS_ERROR_OK) {
+        return stream->error;
+    }
+
+    auto *slot = &stream->slots[stream->head];
+    if (slot->inFlight || slot->done) {
+        // FSAEx_RawStreamGetWriteBuffer has not been called for this buffer, the result of its previous write is unprocessed.
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    rawStreamSubmit(stream, slot, cnt);
+    stream->head = (stream->head + 1) % stream->numSlots;
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawStreamClose(FSAExRawStream *stream) {
+    if (!stream) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    // Every buffer has to be idle before it can be freed.
+    for (uint32_t i = 0; i < stream->numSlots; i++) {
+        rawStreamWait(stream, &stream->slots[i]);
+    }
+
+    FSError res = stream->error;
+    rawStreamFree(stream);
+    return res;
+}
@@ -0,0 +1,526 @@
+#include "fsa_block_cache.h"
+#include "ipc_buffer_pool.h"
+#include "logger.h"
+#include "os_mutex.h"
+#include "stroopwafel/fsa.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <malloc.h>
+#include <mutex>
+
+namespace {
+    constexpr uint32_t NO_PAGE = 0xFFFFFFFF;
+    // Sequential streams start with this many read-ahead pages and double up to the configured maximum.
+    constexpr uint32_t INITIAL_READAHEAD = 4;
+
+    struct CachePage {
+        uint64_t pageNo;
+        int32_t device;
+        uint32_t hashNext;
+        // LRU list, head is the most recently used page.
+        uint32_t lruPrev;
+        uint32_t lruNext;
+        bool valid;
+        bool referenced;
+        // Reserved by a read that is still waiting for its IPC. Such pages are in the hash table but not evicted,
+        // readers of them wait for the fill.
+        bool loading;
+        // Written or invalidated while loading, the fill drops the page instead of publishing outdated data.
+        bool stale;
+    };
+
+    struct BlockCache {
+        uint32_t pageSize;
+        uint32_t numPages;
+        FSAExBlockCachePolicy policy;
+        uint32_t maxReadahead;
+        // Requests spanning more pages than this bypass the cache instead of flushing it.
+        uint32_t maxRequestPages;
+        uint8_t *data;
+        CachePage *pages;
+        uint32_t *buckets;
+        uint32_t bucketBits;
+        uint32_t lruHead;
+        uint32_t lruTail;
+        uint32_t clockHand;
+        // Sequential access detection, a read starting where the last one ended grows the read-ahead window.
+        int32_t lastDevice;
+        uint64_t lastEnd;
+        uint32_t readahead;
+        // Reads that may drop the lock, the cache isn't freed before they are done.
+        uint32_t users;
+        FSAExBlockCacheStats stats;
+    };
+
+    // Not held during IPC: missing pages are reserved as loading, filled without the lock and then published.
+    Mutex sCacheLock;
+    // Signaled when pages finished loading or a read stopped using the cache.
+    Condition sCacheCondition;
+    BlockCache *sCache = nullptr;
+    // Lets uncached IO skip the lock entirely while the cache is disabled.
+    std::atomic<bool> sCacheEnabled{false};
+
+    uint32_t hashPage(const BlockCache *cache, int32_t device, uint64_t pageNo) {
+        return (uint32_t) (((pageNo + ((uint64_t) (uint32_t) device << 40)) * 0x9E3779B97F4A7C15ULL) >> (64 - cache->bucketBits));
+    }
+
+    uint32_t lookup(const BlockCache *cache, int32_t device, uint64_t pageNo) {
+        for (uint32_t i = cache->buckets[hashPage(cache, device, pageNo)]; i != NO_PAGE; i = cache->pages[i].hashNext) {
+            if (cache->pages[i].pageNo == pageNo && cache->pages[i].device == device) {
+                return i;
+            }
+        }
+        return NO_PAGE;
+    }
+
+    void hashRemove(BlockCache *cache, uint32_t index) {
+        auto &page = cache->pages[index];
+        auto *link = &cache->buckets[hashPage(cache, page.device, page.pageNo)];
+        while (*link != index) {
+            link = &cache->pages[*link].hashNext;
+        }
+        *link = page.hashNext;
+    }
+
+    void lruUnlink(BlockCache *cache, uint32_t index) {
+        auto &page = cache->pages[index];
+        if (page.lruPrev != NO_PAGE) {
+            cache->pages[page.lruPrev].lruNext = page.lruNext;
+        } else {
+            cache->lruHead = page.lruNext;
+        }
+        if (page.lruNext != NO_PAGE) {
+            cache->pages[page.lruNext].lruPrev = page.lruPrev;
+        } else {
+            cache->lruTail = page.lruPrev;
+        }
+    }
+
+    void lruPushFront(BlockCache *cache, uint32_t index) {
+        auto &page   = cache->pages[index];
+        page.lruPrev = NO_PAGE;
+        page.lruNext = cache->lruHead;
+        if (cache->lruHead != NO_PAGE) {
+            cache->pages[cache->lruHead].lruPrev = index;
+        } else {
+            cache->lruTail = index;
+        }
+        cache->lruHead = index;
+    }
+
+    void lruPushBack(BlockCache *cache, uint32_t index) {
+        auto &page   = cache->pages[index];
+        page.lruNext = NO_PAGE;
+        page.lruPrev = cache->lruTail;
+        if (cache->lruTail != NO_PAGE) {
+            cache->pages[cache->lruTail].lruNext = index;
+        } else {
+            cache->lruHead = index;
+        }
+        cache->lruTail = index;
+    }
+
+    void touchPage(BlockCache *cache, uint32_t index) {
+        if (cache->policy == FSAEX_BLOCK_CACHE_LRU) {
+            lruUnlink(cache, index);
+            lruPushFront(cache, index);
+        } else {
+            cache->pages[index].referenced = true;
+        }
+    }
+
+    void dropPage(BlockCache *cache, uint32_t index) {
+        hashRemove(cache, index);
+        cache->pages[index].valid = false;
+        if (cache->policy == FSAEX_BLOCK_CACHE_LRU) {
+            // Free pages are reused first.
+            lruUnlink(cache, index);
+            lruPushBack(cache, index);
+        }
+    }
+
+    // Returns NO_PAGE if every page is loading.
+    uint32_t pickVictim(BlockCache *cache) {
+        if (cache->policy == FSAEX_BLOCK_CACHE_LRU) {
+            uint32_t index = cache->lruTail;
+            while (index != NO_PAGE && cache->pages[index].loading) {
+                index = cache->pages[index].lruPrev;
+            }
+            return index;
+        }
+        // Two rounds clear every reference bit on the way.
+        for (uint32_t i = 0; i < cache->numPages * 2; i++) {
+            uint32_t index   = cache->clockHand;
+            cache->clockHand = (cache->clockHand + 1) % cache->numPages;
+            auto &page       = cache->pages[index];
+            if (page.loading) {
+                continue;
+            }
+            if (!page.valid || !page.referenced) {
+                return index;
+            }
+            page.referenced = false;
+        }
+        return NO_PAGE;
+    }
+
+    // Reserves a page for pageNo and marks it as loading. Returns NO_PAGE if no page can be evicted.
+    uint32_t reservePage(BlockCache *cache, int32_t device, uint64_t pageNo) {
+        uint32_t index = pickVictim(cache);
+        if (index == NO_PAGE) {
+            return NO_PAGE;
+        }
+        auto &page = cache->pages[index];
+        if (page.valid) {
+            hashRemove(cache, index);
+            cache->stats.evictions++;
+        }
+        uint32_t bucket        = hashPage(cache, device, pageNo);
+        page.pageNo            = pageNo;
+        page.device            = device;
+        page.valid             = true;
+        page.referenced        = false;
+        page.loading           = true;
+        page.stale             = false;
+        page.hashNext          = cache->buckets[bucket];
+        cache->buckets[bucket] = index;
+        if (cache->policy == FSAEX_BLOCK_CACHE_LRU) {
+            lruUnlink(cache, index);
+            lruPushFront(cache, index);
+        }
+        return index;
+    }
+
+    uint8_t *pageData(const BlockCache *cache, uint32_t index) {
+        return cache->data + (size_t) index * cache->pageSize;
+    }
+
+    // Copies the part of a page that overlaps the byte range [start, end) of a request.
+    void copyOut(const BlockCache *cache, const uint8_t *src, uint64_t pageNo, uint64_t start, uint64_t end, uint8_t *out) {
+        uint64_t pageStart = pageNo * cache->pageSize;
+        uint64_t from      = std::max(start, pageStart);
+        uint64_t to        = std::min(end, pageStart + cache->pageSize);
+        memcpy(out + (from - start), src + (from - pageStart), to - from);
+    }
+
+    // Reads the part of [start, end) that lies in pages [firstPage, endPage) without caching it.
+    FSError readUncached(BlockCache *cache, FSAClientHandle clientHandle, int device_handle, uint32_t size_bytes, uint64_t firstPage, uint64_t endPage, uint64_t start, uint64_t end, uint8_t *out) {
+        uint64_t from = std::max(start, firstPage * cache->pageSize);
+        uint64_t to   = std::min(end, endPage * cache->pageSize);
+        return doRawIO(clientHandle, FSA_COMMAND_RAW_READ, out + (from - start), size_bytes, (uint32_t) ((to - from) / size_bytes), from / size_bytes, device_handle);
+    }
+
+    // Reads pages [firstPage, *endPage) with a single IPC, caches them and copies the requested part out.
+    // Called and returns with the lock held, but drops it for the IPC. *endPage is lowered if fewer pages could be reserved.
+    FSError fillPages(BlockCache *cache, std::unique_lock<Mutex> &lock, FSAClientHandle clientHandle, int device_handle, uint32_t size_bytes, uint64_t firstPage, uint64_t *endPage, uint64_t start, uint64_t end, uint8_t *out) {
+        uint64_t reservedEnd = firstPage;
+        while (reservedEnd < *endPage && reservePage(cache, device_handle, reservedEnd) != NO_PAGE) {
+            reservedEnd++;
+        }
+        cache->stats.reads++;
+        lock.unlock();
+
+        if (reservedEnd == firstPage) {
+            // Every page is being filled by other reads.
+            FSError res = readUncached(cache, clientHandle, device_handle, size_bytes, firstPage, *endPage, start, end, out);
+            lock.lock();
+            return res;
+        }
+        *endPage = reservedEnd;
+
+        uint32_t numPages      = (uint32_t) (reservedEnd - firstPage);
+        uint32_t sectorsInPage = cache->pageSize / size_bytes;
+        IPCBuffer buffer;
+        FSError res = FS_ERROR_OUT_OF_RESOURCES;
+        if (buffer.acquire(numPages * cache->pageSize)) {
+            res = doRawIO(clientHandle, FSA_COMMAND_RAW_READ, buffer.data(), size_bytes, numPages * sectorsInPage, firstPage * sectorsInPage, device_handle);
+        }
+        if (res >= 0) {
+            for (uint32_t i = 0; i < numPages; i++) {
+                uint64_t pageNo = firstPage + i;
+                if (pageNo * cache->pageSize < end) {
+                    copyOut(cache, buffer.as<uint8_t>() + (size_t) i * cache->pageSize, pageNo, start, end, out);
+                }
+            }
+        }
+
+        lock.lock();
+        // Loading pages are never evicted, so the reserved pages are still where they were.
+        for (uint32_t i = 0; i < numPages; i++) {
+            uint32_t index = lookup(cache, device_handle, firstPage + i);
+            auto &page     = cache->pages[index];
+            page.loading   = false;
+            if (res < 0 || page.stale) {
+                dropPage(cache, index);
+            } else {
+                memcpy(pageData(cache, index), buffer.as<uint8_t>() + (size_t) i * cache->pageSize, cache->pageSize);
+            }
+        }
+        sCacheCondition.notifyAll();
+        if (res >= 0) {
+            return FS_ERROR_OK;
+        }
+
+        // Whole pages (or the read-ahead) may reach past the end of the device, fall back to reading
+        // exactly the requested sectors without caching them.
+        cache->stats.reads++;
+        lock.unlock();
+        res = readUncached(cache, clientHandle, device_handle, size_bytes, firstPage, reservedEnd, start, end, out);
+        lock.lock();
+        return res;
+    }
+
+    // Waits until no read uses a cache that has been replaced or disabled. Called with the lock held.
+    void waitForUsers(BlockCache *cache) {
+        while (cache && cache->users > 0) {
+            sCacheCondition.wait(sCacheLock);
+        }
+    }
+
+    void freeCache(BlockCache *cache) {
+        if (cache) {
+            free(cache->data);
+            free(cache->pages);
+            free(cache->buckets);
+            free(cache);
+        }
+    }
+} // namespace
+
+bool blockCacheRead(FSAClientHandle clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSError *outResult) {
+    if (!sCacheEnabled.load(std::memory_order_relaxed) || !data || size_bytes == 0 || cnt == 0) {
+        return false;
+    }
+
+    std::unique_lock<Mutex> lock(sCacheLock);
+    auto *cache = sCache;
+    if (!cache || cache->pageSize % size_bytes != 0) {
+        return false;
+    }
+
+    uint64_t start     = blocks_offset * size_bytes;
+    uint64_t end       = start + (uint64_t) size_bytes * cnt;
+    uint64_t firstPage = start / cache->pageSize;
+    uint64_t lastPage  = (end - 1) / cache->pageSize;
+
+    if (device_handle == cache->lastDevice && start == cache->lastEnd) {
+        cache->readahead = cache->readahead ? std::min(cache->readahead * 2, cache->maxReadahead) : std::min(INITIAL_READAHEAD, cache->maxReadahead);
+    } else {
+        cache->readahead = 0;
+    }
+    cache->lastDevice = device_handle;
+    cache->lastEnd    = end;
+
+    if (lastPage - firstPage + 1 > cache->maxRequestPages) {
+        cache->stats.bypassed++;
+        return false;
+    }
+
+    auto *out   = (uint8_t *) data;
+    FSError res = FS_ERROR_OK;
+    cache->users++;
+    for (uint64_t page = firstPage; page <= lastPage;) {
+        uint32_t index = lookup(cache, device_handle, page);
+        if (index != NO_PAGE && cache->pages[index].loading) {
+            // Another read is filling the page, wait for it instead of reading it twice.
+            sCacheCondition.wait(sCacheLock);
+            continue;
+        }
+        if (index != NO_PAGE) {
+            copyOut(cache, pageData(cache, index), page, start, end, out);
+            touchPage(cache, index);
+            cache->stats.hits++;
+            page++;
+            continue;
+        }
+
+        // Fetch the whole run of missing pages at once, plus the read-ahead if the run reaches the end of the request.
+        uint64_t runEnd = page + 1;
+        while (runEnd <= lastPage && lookup(cache, device_handle, runEnd) == NO_PAGE) {
+            runEnd++;
+        }
+        uint64_t missingEnd = runEnd;
+        if (runEnd > lastPage) {
+            uint64_t readaheadEnd = runEnd + cache->readahead;
+            while (runEnd < readaheadEnd && lookup(cache, device_handle, runEnd) == NO_PAGE) {
+                runEnd++;
+            }
+        }
+
+        res = fillPages(cache, lock, clientHandle, device_handle, size_bytes, page, &runEnd, start, end, out);
+        cache->stats.misses += std::min(runEnd, missingEnd) - page;
+        cache->stats.readahead_pages += runEnd - std::min(runEnd, missingEnd);
+        if (res < 0) {
+            break;
+        }
+        page = runEnd;
+    }
+    if (--cache->users == 0) {
+        sCacheCondition.notifyAll();
+    }
+
+    *outResult = res;
+    return true;
+}
+
+void blockCacheWritten(const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle) {
+    if (!sCacheEnabled.load(std::memory_order_relaxed) || size_bytes == 0 || cnt == 0) {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(sCacheLock);
+    auto *cache = sCache;
+    if (!cache) {
+        return;
+    }
+
+    uint64_t start     = blocks_offset * size_bytes;
+    uint64_t end       = start + (uint64_t) size_bytes * cnt;
+    uint64_t firstPage = start / cache->pageSize;
+    uint64_t lastPage  = (end - 1) / cache->pageSize;
+
+    auto update = [&](uint32_t index) {
+        auto &page = cache->pages[index];
+        if (page.loading) {
+            // The fill may have read the sectors before this write.
+            page.stale = true;
+            return;
+        }
+        if (!data) {
+            dropPage(cache, index);
+            return;
+        }
+        uint64_t pageStart = page.pageNo * cache->pageSize;
+        uint64_t from      = std::max(start, pageStart);
+        uint64_t to        = std::min(end, pageStart + cache->pageSize);
+        memcpy(pageData(cache, index) + (from - pageStart), (const uint8_t *) data + (from - start), to - from);
+    };
+
+    if (lastPage - firstPage + 1 > cache->numPages) {
+        // Cheaper to walk the cache than to look up every page of a big write.
+        for (uint32_t i = 0; i < cache->numPages; i++) {
+            auto &page = cache->pages[i];
+            if (page.valid && page.device == device_handle && page.pageNo >= firstPage && page.pageNo <= lastPage) {
+                update(i);
+            }
+        }
+        return;
+    }
+    for (uint64_t pageNo = firstPage; pageNo <= lastPage; pageNo++) {
+        uint32_t index = lookup(cache, device_handle, pageNo);
+        if (index != NO_PAGE) {
+            update(index);
+        }
+    }
+}
+
+void blockCacheInvalidate(int32_t device_handle) {
+    if (!sCacheEnabled.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    std::lock_guard<Mutex> lock(sCacheLock);
+    auto *cache = sCache;
+    if (!cache) {
+        return;
+    }
+    for (uint32_t i = 0; i < cache->numPages; i++) {
+        auto &page = cache->pages[i];
+        if (!page.valid || (device_handle >= 0 && page.device != device_handle)) {
+            continue;
+        }
+        if (page.loading) {
+            page.stale = true;
+        } else {
+            dropPage(cache, i);
+        }
+    }
+    if (device_handle < 0 || cache->lastDevice == device_handle) {
+        cache->lastDevice = -1;
+        cache->readahead  = 0;
+    }
+}
+
+FSError FSAEx_EnableBlockCache(uint32_t page_size, uint32_t num_pages, FSAExBlockCachePolicy policy, uint32_t max_readahead_pages) {
+    if (page_size == 0 || (page_size & 0x3F) != 0 || num_pages < 4 || (policy != FSAEX_BLOCK_CACHE_LRU && policy != FSAEX_BLOCK_CACHE_CLOCK)) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    auto *cache = (BlockCache *) malloc(sizeof(BlockCache));
+    if (!cache) {
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+    memset(cache, 0, sizeof(*cache));
+
+    // At least two buckets per page keeps the chains short.
+    uint32_t bucketBits = 1;
+    while ((1u << bucketBits) < num_pages * 2) {
+        bucketBits++;
+    }
+
+    cache->pageSize        = page_size;
+    cache->numPages        = num_pages;
+    cache->policy          = policy;
+    cache->maxReadahead    = std::min(max_readahead_pages, num_pages / 2);
+    cache->maxRequestPages = std::max(num_pages / 4, 1u);
+    cache->bucketBits      = bucketBits;
+    cache->data            = (uint8_t *) memalign(0x40, (size_t) page_size * num_pages);
+    cache->pages           = (CachePage *) malloc(num_pages * sizeof(CachePage));
+    cache->buckets         = (uint32_t *) malloc((1u << bucketBits) * sizeof(uint32_t));
+    if (!cache->data || !cache->pages || !cache->buckets) {
+        freeCache(cache);
+        return FS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    memset(cache->buckets, 0xFF, (1u << bucketBits) * sizeof(uint32_t));
+    cache->lruHead = NO_PAGE;
+    cache->lruTail = NO_PAGE;
+    for (uint32_t i = 0; i < num_pages; i++) {
+        memset(&cache->pages[i], 0, sizeof(CachePage));
+        cache->pages[i].hashNext = NO_PAGE;
+        lruPushBack(cache, i);
+    }
+    cache->lastDevice = -1;
+
+    BlockCache *old;
+    {
+        std::lock_guard<Mutex> lock(sCacheLock);
+        old    = sCache;
+        sCache = cache;
+        sCacheEnabled.store(true, std::memory_order_relaxed);
+        waitForUsers(old);
+    }
+    freeCache(old);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_DisableBlockCache() {
+    BlockCache *old;
+    {
+        std::lock_guard<Mutex> lock(sCacheLock);
+        old    = sCache;
+        sCache = nullptr;
+        sCacheEnabled.store(false, std::memory_order_relaxed);
+        waitForUsers(old);
+    }
+    freeCache(old);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_InvalidateBlockCache(int32_t device_handle) {
+    blockCacheInvalidate(device_handle);
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_GetBlockCacheStats(FSAExBlockCacheStats *outStats) {
+    if (!outStats) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    std::lock_guard<Mutex> lock(sCacheLock);
+    if (!sCache) {
+        return FS_ERROR_NOT_INIT;
+    }
+    *outStats = sCache->stats;
+    return FS_ERROR_OK;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <coreinit/filesystem_fsa.h>
+#include <stdint.h>
+
+// Uncached raw sector IO, defined in fsa.cpp.
+FSError doRawIO(FSAClientHandle clientHandle, FSACommandEnum command, const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+
+// Serves a raw read from the block cache. Returns false if the cache is disabled or the request
+// has to bypass it, outResult is only set if true is returned.
+bool blockCacheRead(FSAClientHandle clientHandle, void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle, FSError *outResult);
+
+// Brings cached pages in line with a raw write. With data == nullptr (failed write or data
+// still in flight) the affected pages are dropped instead of updated.
+void blockCacheWritten(const void *data, uint32_t size_bytes, uint32_t cnt, uint64_t blocks_offset, int device_handle);
+
+// Drops all cached pages of a device handle, -1 drops everything.
+void blockCacheInvalidate(int32_t device_handle);
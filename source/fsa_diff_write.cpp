@@ -0,0 +1,239 @@
+#include "checksum.h"
+#include "fsa_block_cache.h"
+#include "ipc_buffer_pool.h"
+#include "logger.h"
+#include "stroopwafel/fsa.h"
+#include <algorithm>
+#include <cstring>
+#include <malloc.h>
+
+namespace {
+    constexpr uint32_t DEFAULT_CHUNK_BYTES = 0x40000;
+    // Longer runs of differing sectors are split, IOS doesn't like huge single transfers.
+    constexpr uint32_t MAX_SPAN_BYTES   = 0x100000;
+    constexpr uint32_t NUM_READ_BUFFERS = 3;
+
+    struct Span {
+        uint64_t first;
+        uint32_t cnt;
+    };
+
+    struct DiffWriter {
+        FSAClientHandle clientHandle;
+        int device_handle;
+        const uint8_t *src;
+        uint32_t size_bytes;
+        uint64_t blocks_offset;
+        uint32_t maxSpanCnt;
+        // Pending span, relative to blocks_offset.
+        uint64_t spanFirst;
+        uint32_t spanCnt;
+        // Written spans, only kept for the verify pass.
+        bool keepSpans;
+        Span *spans;
+        uint32_t numSpans;
+        uint32_t spansCapacity;
+        FSAExDiffWriteResult result;
+    };
+
+    bool sectorsEqual(const uint8_t *a, const uint8_t *b, uint32_t len) {
+        if (((uintptr_t) a | (uintptr_t) b | len) & 3) {
+            return memcmp(a, b, len) == 0;
+        }
+        auto *wa       = (const uint32_t *) a;
+        auto *wb       = (const uint32_t *) b;
+        uint32_t count = len / sizeof(uint32_t);
+        uint32_t i     = 0;
+        for (; i + 8 <= count; i += 8) {
+            if ((wa[i] ^ wb[i]) | (wa[i + 1] ^ wb[i + 1]) | (wa[i + 2] ^ wb[i + 2]) | (wa[i + 3] ^ wb[i + 3]) |
+                (wa[i + 4] ^ wb[i + 4]) | (wa[i + 5] ^ wb[i + 5]) | (wa[i + 6] ^ wb[i + 6]) | (wa[i + 7] ^ wb[i + 7])) {
+                return false;
+            }
+        }
+        for (; i < count; i++) {
+            if (wa[i] != wb[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    FSError flushSpan(DiffWriter *writer) {
+        if (writer->spanCnt == 0) {
+            return FS_ERROR_OK;
+        }
+        uint64_t first  = writer->spanFirst;
+        uint32_t cnt    = writer->spanCnt;
+        writer->spanCnt = 0;
+
+        auto res = FSAEx_RawWriteEx(writer->clientHandle, writer->src + first * writer->size_bytes, writer->size_bytes, cnt, writer->blocks_offset + first, writer->device_handle);
+        if (res < 0) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to write sectors %llu-%llu: %d", (unsigned long long) (writer->blocks_offset + first), (unsigned long long) (writer->blocks_offset + first + cnt - 1), res);
+            return res;
+        }
+        writer->result.written_cnt += cnt;
+        writer->result.num_spans++;
+
+        if (writer->keepSpans) {
+            if (writer->numSpans == writer->spansCapacity) {
+                uint32_t capacity = writer->spansCapacity ? writer->spansCapacity * 2 : 64;
+                auto *spans       = (Span *) realloc(writer->spans, capacity * sizeof(Span));
+                if (!spans) {
+                    return FS_ERROR_OUT_OF_RESOURCES;
+                }
+                writer->spans         = spans;
+                writer->spansCapacity = capacity;
+            }
+            writer->spans[writer->numSpans++] = {first, cnt};
+        }
+        return FS_ERROR_OK;
+    }
+
+    FSError markDifferent(DiffWriter *writer, uint64_t sector) {
+        if (writer->spanCnt > 0 && writer->spanFirst + writer->spanCnt == sector && writer->spanCnt < writer->maxSpanCnt) {
+            writer->spanCnt++;
+            return FS_ERROR_OK;
+        }
+        auto res          = flushSpan(writer);
+        writer->spanFirst = sector;
+        writer->spanCnt   = 1;
+        return res;
+    }
+
+    // Compares a chunk of the device (starting at sector first, relative) against the source.
+    FSError compareChunk(DiffWriter *writer, const uint8_t *device, uint64_t first, uint32_t cnt) {
+        writer->result.read_cnt += cnt;
+        for (uint32_t i = 0; i < cnt; i++) {
+            uint64_t sector = first + i;
+            if (!sectorsEqual(device + i * writer->size_bytes, writer->src + sector * writer->size_bytes, writer->size_bytes)) {
+                auto res = markDifferent(writer, sector);
+                if (res < 0) {
+                    return res;
+                }
+            }
+        }
+        return FS_ERROR_OK;
+    }
+
+    // Reads back every written span, bypassing the block cache.
+    FSError verifySpans(DiffWriter *writer) {
+        IPCBuffer buffer;
+        if (!buffer.acquire(writer->maxSpanCnt * writer->size_bytes)) {
+            return FS_ERROR_OUT_OF_RESOURCES;
+        }
+        for (uint32_t i = 0; i < writer->numSpans; i++) {
+            const auto &span = writer->spans[i];
+            auto res         = doRawIO(writer->clientHandle, FSA_COMMAND_RAW_READ, buffer.data(), writer->size_bytes, span.cnt, writer->blocks_offset + span.first, writer->device_handle);
+            if (res < 0) {
+                return res;
+            }
+            if (!sectorsEqual(buffer.as<uint8_t>(), writer->src + span.first * writer->size_bytes, span.cnt * writer->size_bytes)) {
+                DEBUG_FUNCTION_LINE_ERR("Verification of sectors %llu-%llu failed", (unsigned long long) (writer->blocks_offset + span.first), (unsigned long long) (writer->blocks_offset + span.first + span.cnt - 1));
+                return FS_ERROR_DATA_CORRUPTED;
+            }
+        }
+        return FS_ERROR_OK;
+    }
+
+    // Without a manifest every chunk has to be read, so the reads are pipelined.
+    FSError diffStreamed(DiffWriter *writer, uint32_t chunk_cnt, uint64_t cnt) {
+        FSAExRawStream *stream;
+        auto res = FSAEx_RawStreamOpen(writer->clientHandle, writer->device_handle, FSAEX_RAW_STREAM_READ, writer->size_bytes, chunk_cnt, NUM_READ_BUFFERS, writer->blocks_offset, cnt, &stream);
+        if (res < 0) {
+            return res;
+        }
+        const void *chunk;
+        uint32_t chunkCnt;
+        uint64_t chunkOffset;
+        while ((res = FSAEx_RawStreamRead(stream, &chunk, &chunkCnt, &chunkOffset)) == FS_ERROR_OK) {
+            res = compareChunk(writer, (const uint8_t *) chunk, chunkOffset - writer->blocks_offset, chunkCnt);
+            if (res < 0) {
+                break;
+            }
+        }
+        auto closeRes = FSAEx_RawStreamClose(stream);
+        if (res == FS_ERROR_END_OF_FILE) {
+            res = closeRes;
+        }
+        return res;
+    }
+
+    FSError diffWithManifest(DiffWriter *writer, uint32_t chunk_cnt, uint64_t cnt, const uint32_t *manifest, uint32_t num_entries) {
+        IPCBuffer buffer;
+        if (!buffer.acquire(chunk_cnt * writer->size_bytes)) {
+            return FS_ERROR_OUT_OF_RESOURCES;
+        }
+        uint64_t numChunks = (cnt + chunk_cnt - 1) / chunk_cnt;
+        for (uint64_t i = 0; i < numChunks; i++) {
+            uint64_t first = i * chunk_cnt;
+            uint32_t n     = (uint32_t) std::min<uint64_t>(chunk_cnt, cnt - first);
+            if (i < num_entries && crc32Update(0, writer->src + first * writer->size_bytes, n * writer->size_bytes) == manifest[i]) {
+                writer->result.skipped_chunks++;
+                continue;
+            }
+            auto res = FSAEx_RawReadEx(writer->clientHandle, buffer.data(), writer->size_bytes, n, writer->blocks_offset + first, writer->device_handle);
+            if (res < 0) {
+                return res;
+            }
+            res = compareChunk(writer, buffer.as<uint8_t>(), first, n);
+            if (res < 0) {
+                return res;
+            }
+        }
+        return FS_ERROR_OK;
+    }
+
+    uint32_t defaultChunkCnt(uint32_t size_bytes, uint32_t chunk_cnt) {
+        return chunk_cnt ? chunk_cnt : std::max(DEFAULT_CHUNK_BYTES / size_bytes, 1u);
+    }
+} // namespace
+
+FSError FSAEx_BuildRawManifest(const void *data, uint32_t size_bytes, uint64_t cnt, uint32_t chunk_cnt, uint32_t *outManifest) {
+    if (!data || !outManifest || size_bytes == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    chunk_cnt = defaultChunkCnt(size_bytes, chunk_cnt);
+    auto *src = (const uint8_t *) data;
+    for (uint64_t first = 0, i = 0; first < cnt; first += chunk_cnt, i++) {
+        uint64_t n     = std::min<uint64_t>(chunk_cnt, cnt - first);
+        outManifest[i] = crc32Update(0, src + first * size_bytes, n * size_bytes);
+    }
+    return FS_ERROR_OK;
+}
+
+FSError FSAEx_RawWriteDiff(FSAClientHandle clientHandle, const void *data, uint32_t size_bytes, uint64_t cnt, uint64_t blocks_offset, int device_handle, const FSAExDiffWriteOptions *options, FSAExDiffWriteResult *outResult) {
+    FSAExDiffWriteOptions opts = {};
+    if (options) {
+        opts = *options;
+    }
+    if (!data || size_bytes == 0 || size_bytes > MAX_SPAN_BYTES || cnt == 0 || (opts.manifest == nullptr && opts.num_manifest_entries > 0)) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    uint32_t chunk_cnt = defaultChunkCnt(size_bytes, opts.chunk_cnt);
+    if ((uint64_t) chunk_cnt * size_bytes > 0xFFFFFFFF) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    DiffWriter writer    = {};
+    writer.clientHandle  = clientHandle;
+    writer.device_handle = device_handle;
+    writer.src           = (const uint8_t *) data;
+    writer.size_bytes    = size_bytes;
+    writer.blocks_offset = blocks_offset;
+    writer.maxSpanCnt    = MAX_SPAN_BYTES / size_bytes;
+    writer.keepSpans     = (opts.flags & FSAEX_DIFF_WRITE_FLAG_VERIFY) != 0;
+
+    auto res = opts.manifest ? diffWithManifest(&writer, chunk_cnt, cnt, opts.manifest, opts.num_manifest_entries) : diffStreamed(&writer, chunk_cnt, cnt);
+    if (res >= 0) {
+        res = flushSpan(&writer);
+    }
+    if (res >= 0 && writer.keepSpans) {
+        res = verifySpans(&writer);
+    }
+
+    free(writer.spans);
+    if (outResult) {
+        *outResult = writer.result;
+    }
+    return res;
+}
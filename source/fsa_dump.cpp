@@ -0,0 +1,336 @@
+#include "checksum.h"
+#include "logger.h"
+#include "stroopwafel/fsa.h"
+#include <algorithm>
+#include <atomic>
+#include <coreinit/core.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/thread.h>
+#include <cstdio>
+#include <cstring>
+#include <malloc.h>
+#include <sys/types.h>
+
+namespace {
+    constexpr uint32_t DEFAULT_CHUNK_BYTES = 0x80000;
+    constexpr uint32_t WORKER_STACK_SIZE   = 0x4000;
+    constexpr uint32_t MAX_WORKERS         = 8;
+
+    struct DumpChunk {
+        uint8_t *data;
+        // One entry per sector, non-zero if the sector only contains zeros.
+        uint8_t *zeroMap;
+        uint32_t index;
+        uint32_t cnt;
+        uint32_t zeroCnt;
+        FSError result;
+    };
+
+    struct DumpContext {
+        FSAClientHandle clientHandle;
+        int device_handle;
+        uint32_t size_bytes;
+        uint32_t chunk_cnt;
+        uint64_t blocks_offset;
+        uint64_t total_cnt;
+        uint32_t numChunks;
+        bool scanZeros;
+        std::atomic<uint32_t> nextChunk{0};
+        std::atomic<bool> abort{false};
+        // Idle chunk buffers and chunks that have been read, both carry DumpChunk pointers.
+        OSMessageQueue freeQueue;
+        OSMessageQueue doneQueue;
+    };
+
+    struct DumpWorker {
+        OSThread *thread;
+        uint8_t *stack;
+        bool started;
+    };
+
+    bool isZeroSector(const uint8_t *data, uint32_t len) {
+        // The buffers are 0x40 aligned, so whole cache lines can be or'ed together word-wise.
+        auto *words    = (const uint32_t *) data;
+        uint32_t count = len / sizeof(uint32_t);
+        uint32_t i     = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint32_t acc = words[i] | words[i + 1] | words[i + 2] | words[i + 3] | words[i + 4] | words[i + 5] | words[i + 6] | words[i + 7] |
+                           words[i + 8] | words[i + 9] | words[i + 10] | words[i + 11] | words[i + 12] | words[i + 13] | words[i + 14] | words[i + 15];
+            if (acc) {
+                return false;
+            }
+        }
+        for (; i < count; i++) {
+            if (words[i]) {
+                return false;
+            }
+        }
+        for (uint32_t j = count * sizeof(uint32_t); j < len; j++) {
+            if (data[j]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int dumpWorkerMain(int argc, const char **argv) {
+        auto *ctx = (DumpContext *) argv;
+        while (true) {
+            // Take a buffer before claiming a chunk, so the chunk the writer waits for always has a buffer.
+            OSMessage message;
+            OSReceiveMessage(&ctx->freeQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+            auto *chunk = (DumpChunk *) message.message;
+
+            uint32_t index = ctx->nextChunk.fetch_add(1, std::memory_order_relaxed);
+            if (index >= ctx->numChunks) {
+                OSSendMessage(&ctx->freeQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+                return 0;
+            }
+
+            uint64_t offset = (uint64_t) index * ctx->chunk_cnt;
+            chunk->index    = index;
+            chunk->cnt      = (uint32_t) std::min<uint64_t>(ctx->chunk_cnt, ctx->total_cnt - offset);
+            chunk->zeroCnt  = 0;
+            if (ctx->abort.load(std::memory_order_relaxed)) {
+                // Still hand the chunk over, the writer consumes every index in order.
+                chunk->result = FS_ERROR_CANCELLED;
+            } else {
+                chunk->result = FSAEx_RawReadEx(ctx->clientHandle, chunk->data, ctx->size_bytes, chunk->cnt, ctx->blocks_offset + offset, ctx->device_handle);
+                if (chunk->result >= 0 && ctx->scanZeros) {
+                    for (uint32_t i = 0; i < chunk->cnt; i++) {
+                        chunk->zeroMap[i] = isZeroSector(chunk->data + i * ctx->size_bytes, ctx->size_bytes);
+                        chunk->zeroCnt += chunk->zeroMap[i];
+                    }
+                }
+            }
+            OSSendMessage(&ctx->doneQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+        }
+    }
+
+    struct DumpOutput {
+        FILE *file;
+        bool sparse;
+        // Position of the file pointer, holes are created by seeking over zero sectors.
+        uint64_t pos;
+    };
+
+    bool writeAt(DumpOutput *out, uint64_t offset, const void *data, size_t len) {
+        if (out->pos != offset && fseeko(out->file, (off_t) offset, SEEK_SET) != 0) {
+            return false;
+        }
+        if (fwrite(data, 1, len, out->file) != len) {
+            return false;
+        }
+        out->pos = offset + len;
+        return true;
+    }
+
+    bool writeChunk(DumpOutput *out, const DumpContext *ctx, const DumpChunk *chunk) {
+        uint64_t base = (uint64_t) chunk->index * ctx->chunk_cnt * ctx->size_bytes;
+        if (!out->sparse || chunk->zeroCnt == 0) {
+            return writeAt(out, base, chunk->data, (size_t) chunk->cnt * ctx->size_bytes);
+        }
+        // Write runs of non-zero sectors, skip the rest.
+        for (uint32_t i = 0; i < chunk->cnt;) {
+            if (chunk->zeroMap[i]) {
+                i++;
+                continue;
+            }
+            uint32_t end = i + 1;
+            while (end < chunk->cnt && !chunk->zeroMap[end]) {
+                end++;
+            }
+            if (!writeAt(out, base + (uint64_t) i * ctx->size_bytes, chunk->data + i * ctx->size_bytes, (size_t) (end - i) * ctx->size_bytes)) {
+                return false;
+            }
+            i = end;
+        }
+        return true;
+    }
+
+    // Extends the file to its full size if it ends with a hole.
+    bool finishOutput(DumpOutput *out, uint64_t size) {
+        if (out->pos < size) {
+            uint8_t zero = 0;
+            return writeAt(out, size - 1, &zero, 1);
+        }
+        return true;
+    }
+} // namespace
+
+FSError FSAEx_DumpDevice(FSAClientHandle clientHandle, int device_handle, uint32_t size_bytes, uint64_t blocks_offset, uint64_t total_cnt, const char *out_path, const FSAExDumpOptions *options, FSAExDumpResult *outResult) {
+    FSAExDumpOptions opts = {};
+    if (options) {
+        opts = *options;
+    }
+    if (size_bytes == 0 || total_cnt == 0) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+
+    uint32_t chunk_cnt = opts.chunk_cnt ? opts.chunk_cnt : std::max(DEFAULT_CHUNK_BYTES / size_bytes, 1u);
+    uint64_t numChunks = (total_cnt + chunk_cnt - 1) / chunk_cnt;
+    // Leave room for the workers incrementing the chunk counter once more on exit.
+    if ((uint64_t) chunk_cnt * size_bytes > 0xFFFFFFFF || numChunks > 0xFFFF0000) {
+        return FS_ERROR_INVALID_PARAM;
+    }
+    uint32_t num_workers = std::min(opts.num_workers ? opts.num_workers : OSGetCoreCount(), MAX_WORKERS);
+    uint32_t num_buffers = opts.num_buffers ? opts.num_buffers : num_workers * 2 + 1;
+    num_buffers          = std::max(num_buffers, num_workers + 1);
+
+    DumpOutput out = {};
+    out.sparse     = (opts.flags & FSAEX_DUMP_FLAG_SPARSE) != 0;
+    if (out_path) {
+        out.file = fopen(out_path, "wb");
+        if (!out.file) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to create %s", out_path);
+            return FS_ERROR_INVALID_PATH;
+        }
+    }
+
+    DumpContext ctx;
+    ctx.clientHandle  = clientHandle;
+    ctx.device_handle = device_handle;
+    ctx.size_bytes    = size_bytes;
+    ctx.chunk_cnt     = chunk_cnt;
+    ctx.blocks_offset = blocks_offset;
+    ctx.total_cnt     = total_cnt;
+    ctx.numChunks     = (uint32_t) numChunks;
+    ctx.scanZeros     = out.sparse;
+
+    FSError result                  = FS_ERROR_OK;
+    auto *chunks                    = (DumpChunk *) calloc(num_buffers, sizeof(DumpChunk));
+    auto *pending                   = (DumpChunk **) calloc(num_buffers, sizeof(DumpChunk *));
+    auto *freeMessages              = (OSMessage *) malloc(num_buffers * sizeof(OSMessage));
+    auto *doneMessages              = (OSMessage *) malloc(num_buffers * sizeof(OSMessage));
+    DumpWorker workers[MAX_WORKERS] = {};
+    uint32_t numStarted             = 0;
+
+    if (!chunks || !pending || !freeMessages || !doneMessages) {
+        result = FS_ERROR_OUT_OF_RESOURCES;
+        goto cleanup;
+    }
+
+    OSInitMessageQueue(&ctx.freeQueue, freeMessages, (int32_t) num_buffers);
+    OSInitMessageQueue(&ctx.doneQueue, doneMessages, (int32_t) num_buffers);
+    for (uint32_t i = 0; i < num_buffers; i++) {
+        chunks[i].data    = (uint8_t *) memalign(0x40, chunk_cnt * size_bytes);
+        chunks[i].zeroMap = (uint8_t *) malloc(chunk_cnt);
+        if (!chunks[i].data || !chunks[i].zeroMap) {
+            result = FS_ERROR_OUT_OF_RESOURCES;
+            goto cleanup;
+        }
+        OSMessage message;
+        message.message = &chunks[i];
+        OSSendMessage(&ctx.freeQueue, &message, OS_MESSAGE_FLAGS_NONE);
+    }
+
+    for (uint32_t i = 0; i < num_workers; i++) {
+        auto &worker  = workers[i];
+        worker.thread = (OSThread *) memalign(0x10, sizeof(OSThread));
+        worker.stack  = (uint8_t *) memalign(0x10, WORKER_STACK_SIZE);
+        // Spread the readers over the cores, the calling thread does the hashing and writing.
+        auto affinity = (OSThreadAttributes) (OS_THREAD_ATTRIB_AFFINITY_CPU0 << (i % 3));
+        if (!worker.thread || !worker.stack ||
+            !OSCreateThread(worker.thread, dumpWorkerMain, 0, (char *) &ctx, worker.stack + WORKER_STACK_SIZE, WORKER_STACK_SIZE, 16, affinity)) {
+            break;
+        }
+        OSSetThreadName(worker.thread, "FSAEx_DumpDevice worker");
+        OSResumeThread(worker.thread);
+        worker.started = true;
+        numStarted++;
+    }
+    if (numStarted == 0) {
+        result = FS_ERROR_OUT_OF_RESOURCES;
+        goto cleanup;
+    }
+
+    {
+        bool crc          = (opts.flags & FSAEX_DUMP_FLAG_CRC32) != 0;
+        bool sha1         = (opts.flags & FSAEX_DUMP_FLAG_SHA1) != 0;
+        uint32_t crcValue = 0;
+        Sha1Context sha1Ctx;
+        sha1Init(&sha1Ctx);
+        FSAExDumpResult dumpResult = {};
+        uint64_t done              = 0;
+
+        // Chunks complete out of order. At most num_buffers consecutive chunks are in flight, so index % num_buffers is unique.
+        for (uint32_t next = 0; next < ctx.numChunks; next++) {
+            while (!pending[next % num_buffers]) {
+                OSMessage message;
+                OSReceiveMessage(&ctx.doneQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+                auto *chunk                         = (DumpChunk *) message.message;
+                pending[chunk->index % num_buffers] = chunk;
+            }
+            auto *chunk                 = pending[next % num_buffers];
+            pending[next % num_buffers] = nullptr;
+
+            if (result == FS_ERROR_OK) {
+                if (chunk->result < 0) {
+                    DEBUG_FUNCTION_LINE_ERR("Failed to read sectors %llu-%llu: %d", (unsigned long long) (blocks_offset + (uint64_t) next * chunk_cnt), (unsigned long long) (blocks_offset + (uint64_t) next * chunk_cnt + chunk->cnt - 1), chunk->result);
+                    result = chunk->result;
+                } else {
+                    uint32_t len = chunk->cnt * size_bytes;
+                    if (crc) {
+                        crcValue = crc32Update(crcValue, chunk->data, len);
+                    }
+                    if (sha1) {
+                        sha1Update(&sha1Ctx, chunk->data, len);
+                    }
+                    if (out.file && !writeChunk(&out, &ctx, chunk)) {
+                        DEBUG_FUNCTION_LINE_ERR("Failed to write chunk %u to %s", next, out_path);
+                        result = FS_ERROR_MEDIA_ERROR;
+                    }
+                    dumpResult.data_cnt += chunk->cnt - chunk->zeroCnt;
+                    dumpResult.zero_cnt += chunk->zeroCnt;
+                    done += chunk->cnt;
+                    if (opts.progress) {
+                        opts.progress(done, total_cnt, opts.progress_context);
+                    }
+                }
+                if (result != FS_ERROR_OK) {
+                    ctx.abort.store(true, std::memory_order_relaxed);
+                }
+            }
+
+            OSMessage message;
+            message.message = chunk;
+            OSSendMessage(&ctx.freeQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+        }
+
+        if (result == FS_ERROR_OK && out.file && !finishOutput(&out, total_cnt * size_bytes)) {
+            result = FS_ERROR_MEDIA_ERROR;
+        }
+        if (result == FS_ERROR_OK && outResult) {
+            if (crc) {
+                dumpResult.crc32 = crcValue;
+            }
+            if (sha1) {
+                sha1Final(&sha1Ctx, dumpResult.sha1);
+            }
+            *outResult = dumpResult;
+        }
+    }
+
+cleanup:
+    for (auto &worker : workers) {
+        if (worker.started) {
+            OSJoinThread(worker.thread, nullptr);
+        }
+        free(worker.thread);
+        free(worker.stack);
+    }
+    if (chunks) {
+        for (uint32_t i = 0; i < num_buffers; i++) {
+            free(chunks[i].data);
+            free(chunks[i].zeroMap);
+        }
+    }
+    free(chunks);
+    free(pending);
+    free(freeMessages);
+    free(doneMessages);
+    if (out.file && fclose(out.file) != 0 && result == FS_ERROR_OK) {
+        result = FS_ERROR_MEDIA_ERROR;
+    }
+    return result;
+}
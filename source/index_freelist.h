@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * Lock-free LIFO of slot indices with O(1) pop/push from any thread.
+ * The head carries a 16 bit tag in the upper half to avoid ABA problems, so at most 0xFFFF slots are supported.
+ */
+class IndexFreeList {
+public:
+    static constexpr uint32_t MAX_SLOTS = 0xFFFF;
+
+    // next must be able to hold count entries and stay alive as long as the list is used.
+    void init(std::atomic<uint16_t> *next, uint32_t count) {
+        mNext = next;
+        for (uint32_t i = 0; i < count; i++) {
+            // Stored values are index + 1 so 0 can mark the end of the list.
+            mNext[i].store(i + 1 < count ? i + 2 : 0, std::memory_order_relaxed);
+        }
+        mHead.store(count > 0 ? 1 : 0, std::memory_order_release);
+    }
+
+    // Returns -1 if the list is empty.
+    int32_t pop() {
+        uint32_t head = mHead.load(std::memory_order_acquire);
+        while (true) {
+            uint32_t index = head & 0xFFFF;
+            if (index == 0) {
+                return -1;
+            }
+            uint32_t next    = mNext[index - 1].load(std::memory_order_relaxed);
+            uint32_t newHead = ((head + 0x10000) & 0xFFFF0000) | next;
+            if (mHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return (int32_t) index - 1;
+            }
+        }
+    }
+
+    void push(uint32_t slot) {
+        uint32_t head = mHead.load(std::memory_order_relaxed);
+        while (true) {
+            mNext[slot].store(head & 0xFFFF, std::memory_order_relaxed);
+            uint32_t newHead = ((head + 0x10000) & 0xFFFF0000) | (slot + 1);
+            if (mHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed)) {
+                return;
+            }
+        }
+    }
+
+private:
+    std::atomic<uint32_t> mHead{0};
+    std::atomic<uint16_t> *mNext = nullptr;
+};
@@ -0,0 +1,93 @@
+#include "ipc_buffer_pool.h"
+#include "index_freelist.h"
+#include "spin_lock.h"
+#include <atomic>
+#include <malloc.h>
+#include <mutex>
+
+namespace {
+    struct SizeClass {
+        uint32_t size;
+        uint32_t count;
+    };
+
+    // Small requests/paths, FSA shim buffers and bulk payloads.
+    constexpr SizeClass sSizeClasses[] = {
+            {0x140, 32},
+            {0x1000, 16},
+            {0x10000, 4},
+    };
+    constexpr uint32_t NUM_CLASSES = sizeof(sSizeClasses) / sizeof(sSizeClasses[0]);
+    constexpr uint32_t MAX_COUNT   = 32;
+
+    struct Pool {
+        // Slabs are allocated on first use and kept for the lifetime of the process.
+        std::atomic<uint8_t *> slab{nullptr};
+        std::atomic<bool> failed{false};
+        SpinLock setupLock;
+        std::atomic<uint16_t> next[MAX_COUNT];
+        IndexFreeList freeList;
+    };
+
+    Pool sPools[NUM_CLASSES];
+
+    uint8_t *getSlab(uint32_t sizeClass) {
+        auto &pool = sPools[sizeClass];
+        auto *slab = pool.slab.load(std::memory_order_acquire);
+        if (slab || pool.failed.load(std::memory_order_relaxed)) {
+            return slab;
+        }
+
+        std::lock_guard<SpinLock> lock(pool.setupLock);
+        slab = pool.slab.load(std::memory_order_acquire);
+        if (slab || pool.failed.load(std::memory_order_relaxed)) {
+            return slab;
+        }
+        const auto &info = sSizeClasses[sizeClass];
+        slab             = (uint8_t *) memalign(0x40, info.size * info.count);
+        if (!slab) {
+            // Don't retry on every call, the heap fallback still works.
+            pool.failed.store(true, std::memory_order_relaxed);
+            return nullptr;
+        }
+        pool.freeList.init(pool.next, info.count);
+        pool.slab.store(slab, std::memory_order_release);
+        return slab;
+    }
+} // namespace
+
+bool IPCBuffer::acquire(uint32_t size) {
+    release();
+
+    for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+        if (size > sSizeClasses[i].size) {
+            continue;
+        }
+        auto *slab   = getSlab(i);
+        int32_t slot = slab ? sPools[i].freeList.pop() : -1;
+        if (slot < 0) {
+            // Try the next bigger class before falling back to the heap.
+            continue;
+        }
+        mData  = slab + (uint32_t) slot * sSizeClasses[i].size;
+        mClass = (int16_t) i;
+        mSlot  = (uint16_t) slot;
+        return true;
+    }
+
+    mData  = memalign(0x40, size > 0 ? (size + 0x3F) & ~0x3Fu : 0x40);
+    mClass = -1;
+    return mData != nullptr;
+}
+
+void IPCBuffer::release() {
+    if (!mData) {
+        return;
+    }
+    if (mClass < 0) {
+        free(mData);
+    } else {
+        sPools[mClass].freeList.push(mSlot);
+    }
+    mData = nullptr;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+
+inline bool isIPCAligned(const void *ptr) {
+    return ((uintptr_t) ptr & 0x3F) == 0;
+}
+
+// Output buffers also need an aligned length, otherwise invalidating the last cache line would drop data
+// that lives next to the buffer.
+inline bool isIPCAligned(const void *ptr, uint32_t len) {
+    return isIPCAligned(ptr) && (len & 0x3F) == 0;
+}
+
+/**
+ * Buffer from a process wide pool of 0x40 aligned buffers that can be handed to IOS directly.
+ * Buffers come in a few fixed size classes, each padded to whole cache lines. Acquire and release are O(1)
+ * and lock-free once a class has been set up, so release() may be called from the IPC completion context.
+ * Requests that are bigger than the biggest class or find their class exhausted fall back to memalign.
+ */
+class IPCBuffer {
+public:
+    IPCBuffer() = default;
+    ~IPCBuffer() {
+        release();
+    }
+
+    IPCBuffer(const IPCBuffer &)            = delete;
+    IPCBuffer &operator=(const IPCBuffer &) = delete;
+
+    // Releases any previously held buffer. Returns false if no memory is available.
+    bool acquire(uint32_t size);
+    void release();
+
+    void *data() const {
+        return mData;
+    }
+
+    template<typename T>
+    T *as() const {
+        return (T *) mData;
+    }
+
+private:
+    void *mData = nullptr;
+    // Index of the size class or -1 for heap allocations.
+    int16_t mClass = -1;
+    uint16_t mSlot = 0;
+};
@@ -0,0 +1,210 @@
+#include "logger.h"
+#include "spin_lock.h"
+#include <atomic>
+#include <coreinit/debug.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/thread.h>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+
+namespace stroopwafel::log {
+    namespace {
+        constexpr uint32_t RING_SIZE          = 0x80;
+        constexpr uint32_t FLUSHER_STACK_SIZE = 0x4000;
+        constexpr int32_t FLUSHER_PRIORITY    = 30;
+        constexpr uint32_t MAX_LINE_SIZE      = 0x200;
+
+        static_assert((RING_SIZE & (RING_SIZE - 1)) == 0);
+
+        enum FlusherState : uint32_t {
+            FLUSHER_STOPPED,
+            FLUSHER_STARTING,
+            FLUSHER_RUNNING,
+            FLUSHER_FAILED,
+        };
+
+        // Kind of a message sent to sWakeQueue, stored in args[0].
+        enum FlusherCommand : uint32_t {
+            FLUSHER_WAKE,
+            FLUSHER_STOP,
+        };
+
+        // Bounded multi-producer queue: a producer claims a position by bumping sEnqueuePos, the sequence of the slot
+        // tells whether it is free for that position, filled or still in use by the consumer from the previous round.
+        // Sequences are stored relative to the slot index so the zero initialized ring is ready to use.
+        Message sRing[RING_SIZE];
+        std::atomic<uint32_t> sEnqueuePos{0};
+        uint32_t sDequeuePos = 0;
+        std::atomic<uint32_t> sDropped{0};
+
+        // Consumers are the flusher thread and explicit flush() calls.
+        SpinLock sConsumerLock;
+
+        // The flusher may only be started between init() and shutdown(), so it can't outlive the library.
+        std::atomic<bool> sFlusherEnabled{false};
+        std::atomic<uint32_t> sFlusherState{FLUSHER_STOPPED};
+        alignas(8) OSThread sFlusherThread;
+        alignas(0x10) uint8_t sFlusherStack[FLUSHER_STACK_SIZE];
+        OSMessageQueue sWakeQueue;
+        OSMessage sWakeMessage;
+
+        uint32_t loadSequence(uint32_t slot) {
+            return sRing[slot].sequence.load(std::memory_order_acquire) + slot;
+        }
+
+        void storeSequence(uint32_t slot, uint32_t sequence) {
+            sRing[slot].sequence.store(sequence - slot, std::memory_order_release);
+        }
+
+        void printMessage(const Message *message) {
+            char line[MAX_LINE_SIZE];
+            int prefix = snprintf(line, sizeof(line), LOG_PREFIX_FMT, LOG_APP_TYPE, LOG_APP_NAME, message->file, message->function, (int) message->line);
+            if (prefix < 0 || prefix >= (int) sizeof(line)) {
+                prefix = 0;
+            }
+            int length = message->format(line + prefix, sizeof(line) - prefix, message);
+            // Keep the line break of truncated messages.
+            if (length >= (int) (sizeof(line) - prefix)) {
+                line[sizeof(line) - 2] = '\n';
+            }
+            OSReport("%s", line);
+        }
+
+        void drain() {
+            std::lock_guard<SpinLock> lock(sConsumerLock);
+            while (true) {
+                uint32_t pos  = sDequeuePos;
+                uint32_t slot = pos & (RING_SIZE - 1);
+                if (loadSequence(slot) != pos + 1) {
+                    break;
+                }
+                printMessage(&sRing[slot]);
+                storeSequence(slot, pos + RING_SIZE);
+                sDequeuePos = pos + 1;
+            }
+            uint32_t dropped = sDropped.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0) {
+                OSReport("[(%s)%18s] ##WARNING## %u log messages were dropped\n", LOG_APP_TYPE, LOG_APP_NAME, dropped);
+            }
+        }
+
+        int flusherMain(int argc, const char **argv) {
+            while (true) {
+                drain();
+                OSMessage message;
+                OSReceiveMessage(&sWakeQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+                if (message.args[0] == FLUSHER_STOP) {
+                    break;
+                }
+            }
+            drain();
+            return 0;
+        }
+
+        void wakeFlusher() {
+            // A pending wake-up covers this message as well, so a full queue is fine.
+            OSMessage message = {};
+            message.args[0]   = FLUSHER_WAKE;
+            OSSendMessage(&sWakeQueue, &message, OS_MESSAGE_FLAGS_NONE);
+        }
+
+        // Starts the flusher with the first message after init(). Returns false if messages have to be printed by the caller.
+        bool ensureFlusher() {
+            if (!sFlusherEnabled.load(std::memory_order_acquire)) {
+                return false;
+            }
+            uint32_t state = sFlusherState.load(std::memory_order_acquire);
+            if (state == FLUSHER_RUNNING || state == FLUSHER_STARTING) {
+                return true;
+            }
+            if (state == FLUSHER_FAILED || !sFlusherState.compare_exchange_strong(state, FLUSHER_STARTING)) {
+                return sFlusherState.load(std::memory_order_acquire) != FLUSHER_FAILED;
+            }
+            // shutdown() may have run since the check above, it waits for STARTING to be resolved.
+            if (!sFlusherEnabled.load()) {
+                sFlusherState.store(FLUSHER_STOPPED, std::memory_order_release);
+                return false;
+            }
+
+            OSInitMessageQueue(&sWakeQueue, &sWakeMessage, 1);
+            auto attributes = (OSThreadAttributes) OS_THREAD_ATTRIB_AFFINITY_ANY;
+            if (!OSCreateThread(&sFlusherThread, flusherMain, 0, nullptr, sFlusherStack + FLUSHER_STACK_SIZE, FLUSHER_STACK_SIZE, FLUSHER_PRIORITY, attributes)) {
+                sFlusherState.store(FLUSHER_FAILED, std::memory_order_release);
+                return false;
+            }
+            OSSetThreadName(&sFlusherThread, "libstroopwafel logger");
+            OSResumeThread(&sFlusherThread);
+            // Messages committed while starting didn't wake the thread, this covers them.
+            sFlusherState.store(FLUSHER_RUNNING, std::memory_order_release);
+            wakeFlusher();
+            return true;
+        }
+    } // namespace
+
+    Message *beginMessage() {
+        uint32_t pos = sEnqueuePos.load(std::memory_order_relaxed);
+        while (true) {
+            uint32_t slot = pos & (RING_SIZE - 1);
+            auto diff     = (int32_t) (loadSequence(slot) - pos);
+            if (diff == 0) {
+                if (sEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return &sRing[slot];
+                }
+            } else if (diff < 0) {
+                sDropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            } else {
+                pos = sEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void commitMessage(Message *message) {
+        auto slot = (uint32_t) (message - sRing);
+        // The slot is free for position sequence, it becomes readable at sequence + 1.
+        storeSequence(slot, loadSequence(slot) + 1);
+        if (!ensureFlusher()) {
+            drain();
+        } else if (sFlusherState.load(std::memory_order_acquire) == FLUSHER_RUNNING) {
+            wakeFlusher();
+        }
+    }
+
+    void flush() {
+        drain();
+    }
+
+    void init() {
+        sFlusherEnabled.store(true, std::memory_order_release);
+    }
+
+    void shutdown() {
+        sFlusherEnabled.store(false);
+
+        // Another thread may be starting the flusher right now, wait until it is running, has failed or gave up.
+        uint32_t state = sFlusherState.load();
+        while (state == FLUSHER_STARTING) {
+            OSYieldThread();
+            state = sFlusherState.load(std::memory_order_acquire);
+        }
+
+        if (state == FLUSHER_RUNNING) {
+            // Blocks while a wake-up is still pending, the flusher drains once more before it exits.
+            OSMessage message = {};
+            message.args[0]   = FLUSHER_STOP;
+            OSSendMessage(&sWakeQueue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+            OSJoinThread(&sFlusherThread, nullptr);
+        }
+        sFlusherState.store(FLUSHER_STOPPED, std::memory_order_release);
+        drain();
+    }
+
+    int formatArgs(char *out, uint32_t size, const char *fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        int res = vsnprintf(out, size, fmt, args);
+        va_end(args);
+        return res;
+    }
+} // namespace stroopwafel::log
@@ -1,23 +1,239 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <coreinit/debug.h>
+#include <cstdint>
 #include <cstring>
+#include <type_traits>
+#include <utility>
 
-#define __FILENAME__ ({                                \
-    const char *__filename = __FILE__;                 \
-    const char *__pos      = strrchr(__filename, '/'); \
-    if (!__pos) __pos = strrchr(__filename, '\\');     \
-    __pos ? __pos + 1 : __filename;                    \
-})
+#define LOG_LEVEL_NONE    0
+#define LOG_LEVEL_ERROR   1
+#define LOG_LEVEL_WARN    2
+#define LOG_LEVEL_INFO    3
+#define LOG_LEVEL_VERBOSE 4
+
+// Messages above this level are compiled out including their arguments, e.g. BUILD_CFLAGS=-DSTROOPWAFEL_LOG_LEVEL=LOG_LEVEL_ERROR
+#ifndef STROOPWAFEL_LOG_LEVEL
+#define STROOPWAFEL_LOG_LEVEL LOG_LEVEL_WARN
+#endif
+
+// Messages are queued and formatted by a background thread. Define as 0 to print them synchronously via OSReport instead.
+#ifndef STROOPWAFEL_LOG_DEFERRED
+#define STROOPWAFEL_LOG_DEFERRED 1
+#endif
+
+namespace stroopwafel::log {
+    constexpr const char *stripPath(const char *path) {
+        const char *name = path;
+        for (const char *p = path; *p; p++) {
+            if (*p == '/' || *p == '\\') {
+                name = p + 1;
+            }
+        }
+        return name;
+    }
+} // namespace stroopwafel::log
+
+#ifdef __FILE_NAME__
+#define __FILENAME__ __FILE_NAME__
+#else
+#define __FILENAME__ ([]() { constexpr const char *__filename = stroopwafel::log::stripPath(__FILE__); return __filename; }())
+#endif
 
 #define LOG_APP_TYPE "L"
 #define LOG_APP_NAME "libstroopwafel"
 
-#define LOG_EX(FILENAME, FUNCTION, LINE, LOG_FUNC, LOG_LEVEL, LINE_END, FMT, ARGS...)                                                        \
-    do {                                                                                                                                     \
-        LOG_FUNC("[(%s)%18s][%23s]%30s@L%04d: " LOG_LEVEL "" FMT "" LINE_END, LOG_APP_TYPE, LOG_APP_NAME, FILENAME, FUNCTION, LINE, ##ARGS); \
+#define LOG_PREFIX_FMT "[(%s)%18s][%23s]%30s@L%04d: "
+
+#define LOG_EX(FILENAME, FUNCTION, LINE, LOG_FUNC, LOG_LEVEL, LINE_END, FMT, ARGS...)                                        \
+    do {                                                                                                                     \
+        LOG_FUNC(LOG_PREFIX_FMT LOG_LEVEL "" FMT "" LINE_END, LOG_APP_TYPE, LOG_APP_NAME, FILENAME, FUNCTION, LINE, ##ARGS); \
     } while (0)
 
 #define LOG_EX_DEFAULT(LOG_FUNC, LOG_LEVEL, LINE_END, FMT, ARGS...) LOG_EX(__FILENAME__, __FUNCTION__, __LINE__, LOG_FUNC, LOG_LEVEL, LINE_END, FMT, ##ARGS)
 
-#define DEBUG_FUNCTION_LINE_ERR(FMT, ARGS...)                       LOG_EX_DEFAULT(OSReport, "##ERROR## ", "\n", FMT, ##ARGS)
-#define DEBUG_FUNCTION_LINE_WARN(FMT, ARGS...)                      LOG_EX_DEFAULT(OSReport, "##WARNING## ", "\n", FMT, ##ARGS)
+namespace stroopwafel::log {
+    constexpr uint32_t MAX_ARGS  = 8;
+    constexpr uint32_t TEXT_SIZE = 0x80;
+
+    struct Message;
+    using FormatFn = int (*)(char *out, uint32_t size, const Message *message);
+
+    /**
+     * A queued message. The format string, file and function are literals and only referenced,
+     * string arguments are copied into text as the caller's buffer may be gone when the message is printed.
+     */
+    struct Message {
+        std::atomic<uint32_t> sequence;
+        uint32_t line;
+        const char *file;
+        const char *function;
+        const char *fmt;
+        FormatFn format;
+        uint64_t args[MAX_ARGS];
+        char text[TEXT_SIZE];
+    };
+
+    /**
+     * Reserves a slot in the log ring. Never blocks, returns nullptr (and counts the message as dropped) if the ring is full.
+     */
+    Message *beginMessage();
+
+    /**
+     * Hands a slot filled after beginMessage to the flusher thread.
+     */
+    void commitMessage(Message *message);
+
+    /**
+     * Prints every queued message from the calling thread.
+     */
+    void flush();
+
+    /**
+     * Lets the next message start the flusher thread. Until then, and after shutdown, messages are printed by the
+     * thread that commits them.
+     */
+    void init();
+
+    /**
+     * Stops and joins the flusher thread and prints everything that is still queued.
+     */
+    void shutdown();
+
+    int formatArgs(char *out, uint32_t size, const char *fmt, ...);
+
+    // Only used to let the compiler check the format string of messages that are queued or compiled out.
+    __attribute__((format(printf, 1, 2))) inline void checkFormat(const char *, ...) {}
+
+    // Type an argument is stored as: strings are copied, everything else is kept by value like it is passed to printf.
+    template <typename T>
+    constexpr auto storedTag() {
+        if constexpr (std::is_same_v<T, char *> || std::is_same_v<T, const char *>) {
+            return std::type_identity<const char *>{};
+        } else if constexpr (std::is_enum_v<T>) {
+            return std::type_identity<std::underlying_type_t<T>>{};
+        } else if constexpr (std::is_floating_point_v<T>) {
+            return std::type_identity<double>{};
+        } else if constexpr (std::is_pointer_v<T>) {
+            return std::type_identity<const void *>{};
+        } else {
+            return std::type_identity<T>{};
+        }
+    }
+
+    template <typename T>
+    using StoredType = typename decltype(storedTag<std::decay_t<T>>())::type;
+
+    constexpr uint64_t NULL_STRING = ~0ull;
+
+    template <typename T>
+    void packArg(Message *message, uint32_t index, uint32_t &textUsed, const T &value) {
+        using S = StoredType<T>;
+        if constexpr (std::is_same_v<S, const char *>) {
+            const char *str = value;
+            if (!str) {
+                message->args[index] = NULL_STRING;
+                return;
+            }
+            // Out of space, the previous string ended with the terminator at the last byte.
+            if (textUsed >= TEXT_SIZE) {
+                message->args[index] = TEXT_SIZE - 1;
+                return;
+            }
+            uint32_t length = std::min<uint32_t>(strlen(str), TEXT_SIZE - textUsed - 1);
+            memcpy(message->text + textUsed, str, length);
+            message->text[textUsed + length] = '\0';
+            message->args[index]             = textUsed;
+            textUsed += length + 1;
+        } else {
+            static_assert(sizeof(S) <= sizeof(uint64_t) && std::is_trivially_copyable_v<S>, "unsupported log argument");
+            S stored = (S) value;
+            memcpy(&message->args[index], &stored, sizeof(S));
+        }
+    }
+
+    template <typename S>
+    S unpackArg(const Message *message, uint32_t index) {
+        if constexpr (std::is_same_v<S, const char *>) {
+            return message->args[index] == NULL_STRING ? "(null)" : message->text + message->args[index];
+        } else {
+            S value;
+            memcpy(&value, &message->args[index], sizeof(S));
+            return value;
+        }
+    }
+
+    template <typename... S, size_t... I>
+    int formatStored(char *out, uint32_t size, const Message *message, std::index_sequence<I...>) {
+        return formatArgs(out, size, message->fmt, unpackArg<S>(message, I)...);
+    }
+
+    template <typename... S>
+    int formatMessage(char *out, uint32_t size, const Message *message) {
+        return formatStored<S...>(out, size, message, std::index_sequence_for<S...>{});
+    }
+
+    template <typename... Args>
+    void logDeferred(const char *file, const char *function, uint32_t line, const char *fmt, const Args &...args) {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "too many log arguments");
+        Message *message = beginMessage();
+        if (!message) {
+            return;
+        }
+        message->file     = file;
+        message->function = function;
+        message->line     = line;
+        message->fmt      = fmt;
+        message->format   = formatMessage<StoredType<Args>...>;
+
+        [[maybe_unused]] uint32_t index    = 0;
+        [[maybe_unused]] uint32_t textUsed = 0;
+        (packArg(message, index++, textUsed, args), ...);
+        commitMessage(message);
+    }
+} // namespace stroopwafel::log
+
+#if STROOPWAFEL_LOG_DEFERRED
+#define LOG_DEFAULT(LOG_LEVEL, FMT, ARGS...)                                                                \
+    do {                                                                                                    \
+        if (false) {                                                                                        \
+            stroopwafel::log::checkFormat(FMT, ##ARGS);                                                     \
+        }                                                                                                   \
+        stroopwafel::log::logDeferred(__FILENAME__, __FUNCTION__, __LINE__, LOG_LEVEL "" FMT "\n", ##ARGS); \
+    } while (0)
+#else
+#define LOG_DEFAULT(LOG_LEVEL, FMT, ARGS...) LOG_EX_DEFAULT(OSReport, LOG_LEVEL, "\n", FMT, ##ARGS)
+#endif
+
+// Keeps the format checked and the arguments referenced, but generates no code.
+#define LOG_DISABLED(FMT, ARGS...)                      \
+    do {                                                \
+        if (false) {                                    \
+            stroopwafel::log::checkFormat(FMT, ##ARGS); \
+        }                                               \
+    } while (0)
+
+#if STROOPWAFEL_LOG_LEVEL >= LOG_LEVEL_ERROR
+#define DEBUG_FUNCTION_LINE_ERR(FMT, ARGS...) LOG_DEFAULT("##ERROR## ", FMT, ##ARGS)
+#else
+#define DEBUG_FUNCTION_LINE_ERR(FMT, ARGS...) LOG_DISABLED(FMT, ##ARGS)
+#endif
+
+#if STROOPWAFEL_LOG_LEVEL >= LOG_LEVEL_WARN
+#define DEBUG_FUNCTION_LINE_WARN(FMT, ARGS...) LOG_DEFAULT("##WARNING## ", FMT, ##ARGS)
+#else
+#define DEBUG_FUNCTION_LINE_WARN(FMT, ARGS...) LOG_DISABLED(FMT, ##ARGS)
+#endif
+
+#if STROOPWAFEL_LOG_LEVEL >= LOG_LEVEL_INFO
+#define DEBUG_FUNCTION_LINE_INFO(FMT, ARGS...) LOG_DEFAULT("##INFO## ", FMT, ##ARGS)
+#else
+#define DEBUG_FUNCTION_LINE_INFO(FMT, ARGS...) LOG_DISABLED(FMT, ##ARGS)
+#endif
+
+#if STROOPWAFEL_LOG_LEVEL >= LOG_LEVEL_VERBOSE
+#define DEBUG_FUNCTION_LINE_VERBOSE(FMT, ARGS...) LOG_DEFAULT("", FMT, ##ARGS)
+#else
+#define DEBUG_FUNCTION_LINE_VERBOSE(FMT, ARGS...) LOG_DISABLED(FMT, ##ARGS)
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+#include <coreinit/condition.h>
+#include <coreinit/mutex.h>
+
+/**
+ * OSMutex for sections that may block, e.g. across an IPC. Waiters sleep instead of yielding in a loop.
+ * Usable with std::lock_guard/std::unique_lock. Initialized by the constructor, so globals are ready once
+ * static initialization has run.
+ */
+class Mutex {
+public:
+    Mutex() {
+        OSInitMutex(&mMutex);
+    }
+
+    Mutex(const Mutex &)            = delete;
+    Mutex &operator=(const Mutex &) = delete;
+
+    void lock() {
+        OSLockMutex(&mMutex);
+    }
+
+    void unlock() {
+        OSUnlockMutex(&mMutex);
+    }
+
+    OSMutex *native() {
+        return &mMutex;
+    }
+
+private:
+    OSMutex mMutex;
+};
+
+/**
+ * OSCondition bound to a Mutex. notifyAll wakes every waiter, like OSSignalCond.
+ */
+class Condition {
+public:
+    Condition() {
+        OSInitCond(&mCondition);
+    }
+
+    Condition(const Condition &)            = delete;
+    Condition &operator=(const Condition &) = delete;
+
+    // The mutex has to be held (once) by the caller, it is released while waiting.
+    void wait(Mutex &mutex) {
+        OSWaitCond(&mCondition, mutex.native());
+    }
+
+    void notifyAll() {
+        OSSignalCond(&mCondition);
+    }
+
+private:
+    OSCondition mCondition;
+};
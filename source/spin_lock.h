@@ -0,0 +1,23 @@
+#pragma once
+#include <atomic>
+#include <coreinit/thread.h>
+
+/**
+ * Minimal lock for short, rarely contended sections. Waiters yield instead of burning the core.
+ * Usable with std::lock_guard and safe to use from static initializers as it needs no setup.
+ */
+class SpinLock {
+public:
+    void lock() {
+        while (mFlag.test_and_set(std::memory_order_acquire)) {
+            OSYieldThread();
+        }
+    }
+
+    void unlock() {
+        mFlag.clear(std::memory_order_release);
+    }
+
+private:
+    std::atomic_flag mFlag = ATOMIC_FLAG_INIT;
+};
@@ -0,0 +1,488 @@
+#include "index_freelist.h"
+#include "ipc_buffer_pool.h"
+#include "logger.h"
+#include "stroopwafel/commands.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel/stroopwafel.hpp"
+#include "stroopwafel_ipc.h"
+#include "stroopwafel_stats.h"
+#include <atomic>
+#include <coreinit/ios.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/thread.h>
+#include <coreinit/time.h>
+#include <cstring>
+#include <malloc.h>
+#include <new>
+#include <stdint.h>
+
+struct StroopwafelAsyncRequest {
+    // Staging buffers that are handed to IOS, they have to live as long as the request.
+    union {
+        uint32_t words[0x10];
+        char path[256];
+        StroopwafelMapMemory mapMemory;
+        StroopwafelMinutePath minutePath;
+    } ALIGN_0x40 staging;
+    ALIGN_0x40 uint32_t dest_addrs[MAX_WRITES_PER_IPC + 1];
+    IOSVec vectors[MAX_WRITES_PER_IPC + 1];
+
+    StroopwafelCompletionQueue *queue;
+    StroopwafelCompletionCallback callback;
+    void *userdata;
+    uint32_t index;
+    uint32_t token;
+    uint32_t command;
+    StroopwafelStatus status;
+
+    // Holds unaligned caller data for WriteMemory/Execute until the request has been received.
+    IPCBuffer bounce;
+
+    // Only used for requests that return data: expected length and where to copy the staged result from/to.
+    const void *copyOutSrc;
+    void *copyOut;
+    uint32_t copyOutLen;
+    int32_t expectedLen;
+
+    // Only set if statistics were enabled on submission.
+    bool stats;
+    OSTime startTime;
+    uint32_t bytesIn;
+    uint32_t bytesOut;
+} ALIGN_0x40;
+
+struct StroopwafelCompletionQueue {
+    OSMessageQueue messageQueue;
+    OSMessage *messages;
+    StroopwafelAsyncRequest *requests;
+    std::atomic<uint16_t> *freeListNext;
+    IndexFreeList freeList;
+    uint32_t capacity;
+    std::atomic<uint32_t> nextToken;
+    // Requests without a callback that have been acquired but not received yet.
+    std::atomic<uint32_t> outstanding;
+    // Every acquired request, callback requests are released in the completion context instead of being received.
+    std::atomic<uint32_t> inFlight;
+};
+
+namespace {
+    StroopwafelAsyncRequest *acquireRequest(const StroopwafelAsyncParams *asyncParams, uint32_t command) {
+        auto *queue = asyncParams->queue;
+        int32_t idx = queue->freeList.pop();
+        if (idx < 0) {
+            return nullptr;
+        }
+        queue->inFlight.fetch_add(1, std::memory_order_relaxed);
+        if (!asyncParams->callback) {
+            queue->outstanding.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        auto *request        = &queue->requests[idx];
+        request->queue       = queue;
+        request->callback    = asyncParams->callback;
+        request->userdata    = asyncParams->userdata;
+        request->index       = (uint32_t) idx;
+        request->token       = queue->nextToken.fetch_add(1, std::memory_order_relaxed);
+        request->command     = command;
+        request->status      = STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+        request->copyOutSrc  = &request->staging;
+        request->copyOut     = nullptr;
+        request->copyOutLen  = 0;
+        request->expectedLen = -1;
+        return request;
+    }
+
+    // Completion-safe, the slot may be reused as soon as it has been pushed.
+    void releaseRequest(StroopwafelAsyncRequest *request) {
+        auto *queue = request->queue;
+        bool queued = !request->callback;
+        request->bounce.release();
+        queue->freeList.push(request->index);
+        if (queued) {
+            queue->outstanding.fetch_sub(1, std::memory_order_release);
+        }
+        queue->inFlight.fetch_sub(1, std::memory_order_release);
+    }
+
+    // Hands the finished request to its callback, or to the queue if it has none. Must not block.
+    void deliverCompletion(StroopwafelAsyncRequest *request) {
+        if (request->callback) {
+            StroopwafelCompletion completion;
+            completion.token    = request->token;
+            completion.command  = request->command;
+            completion.status   = request->status;
+            completion.userdata = request->userdata;
+            request->callback(&completion);
+            releaseRequest(request);
+            return;
+        }
+
+        OSMessage message;
+        message.message = request;
+        OSSendMessage(&request->queue->messageQueue, &message, OS_MESSAGE_FLAGS_NONE);
+    }
+
+    // Called from the IPC completion context, must not block.
+    void asyncCallback(IOSError res, void *context) {
+        auto *request = (StroopwafelAsyncRequest *) context;
+
+        if (res < 0) {
+            request->status = STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+        } else if (request->expectedLen >= 0 && res != request->expectedLen) {
+            request->status = STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+        } else {
+            if (request->copyOut) {
+                memcpy(request->copyOut, request->copyOutSrc, request->copyOutLen);
+            }
+            request->status = STROOPWAFEL_RESULT_SUCCESS;
+            if (request->command == STROOPWAFEL_IOCTL_SET_FW_PATH) {
+                invalidatePathCaches();
+            } else if (request->command == STROOPWAFEL_IOCTL_GET_API_VERSION) {
+                cacheAPIVersion(request->staging.words[0]);
+            }
+        }
+
+        // A synchronous write may have tracked the range again while this one was in flight. On failure it's
+        // unknown what reached IOS, so the range is dropped either way.
+        if (request->command == STROOPWAFEL_IOCTLV_WRITE_MEMORY) {
+            for (uint32_t i = 0; i < request->vectors[0].len / sizeof(uint32_t); i++) {
+                invalidateWriteShadowDeferred(request->dest_addrs[i], request->vectors[i + 1].len);
+            }
+        } else if (request->command == STROOPWAFEL_IOCTL_MAP_MEMORY) {
+            invalidateWriteShadowDeferred(request->staging.mapMemory.vaddr, request->staging.mapMemory.size);
+        }
+
+        if (request->stats) {
+            uint32_t bytesOut = request->expectedLen >= 0 ? (res > 0 ? res : 0) : request->bytesOut;
+            recordIPCStats(request->command, request->startTime, request->bytesIn, request->status == STROOPWAFEL_RESULT_SUCCESS ? bytesOut : 0, request->status != STROOPWAFEL_RESULT_SUCCESS);
+        }
+
+        deliverCompletion(request);
+    }
+
+    void prepareStats(StroopwafelAsyncRequest *request, uint32_t bytesIn, uint32_t bytesOut) {
+        request->stats = isStatsEnabled();
+        if (request->stats) {
+            request->startTime = OSGetSystemTime();
+            request->bytesIn   = bytesIn;
+            request->bytesOut  = bytesOut;
+        }
+    }
+
+    StroopwafelStatus submitIPC(StroopwafelAsyncRequest *request, void *buffer_in, uint32_t length_in, void *buffer_io, uint32_t length_io, uint32_t *outToken) {
+        prepareStats(request, length_in, length_io);
+
+        uint32_t token = request->token;
+        auto status    = doStroopwafelIPCAsync(request->command, buffer_in, length_in, buffer_io, length_io, asyncCallback, request);
+        if (status != STROOPWAFEL_RESULT_SUCCESS) {
+            releaseRequest(request);
+            return status;
+        }
+        if (outToken) {
+            *outToken = token;
+        }
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
+
+    StroopwafelStatus submitIPCV(StroopwafelAsyncRequest *request, uint32_t num_in, uint32_t num_io, uint32_t *outToken) {
+        prepareStats(request, sumVectorLength(request->vectors, num_in), sumVectorLength(request->vectors + num_in, num_io));
+
+        uint32_t token = request->token;
+        auto status    = doStroopwafelIPCVAsync(request->command, num_in, num_io, request->vectors, asyncCallback, request);
+        if (status != STROOPWAFEL_RESULT_SUCCESS) {
+            releaseRequest(request);
+            return status;
+        }
+        if (outToken) {
+            *outToken = token;
+        }
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
+
+    bool isValidAsyncParams(const StroopwafelAsyncParams *asyncParams) {
+        return asyncParams && asyncParams->queue;
+    }
+
+    StroopwafelStatus receiveCompletion(StroopwafelCompletionQueue *queue, StroopwafelCompletion *outCompletion, OSMessageFlags flags) {
+        if (!queue || !outCompletion) {
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        if (queue->outstanding.load(std::memory_order_acquire) == 0) {
+            return STROOPWAFEL_RESULT_NOT_FOUND;
+        }
+
+        OSMessage message;
+        if (!OSReceiveMessage(&queue->messageQueue, &message, flags)) {
+            return STROOPWAFEL_RESULT_NOT_FOUND;
+        }
+
+        auto *request           = (StroopwafelAsyncRequest *) message.message;
+        outCompletion->token    = request->token;
+        outCompletion->command  = request->command;
+        outCompletion->status   = request->status;
+        outCompletion->userdata = request->userdata;
+        if (request->status != STROOPWAFEL_RESULT_SUCCESS) {
+            DEBUG_FUNCTION_LINE_ERR("Async request 0x%X failed: %s", request->command, Stroopwafel_GetStatusStr(request->status));
+        }
+
+        releaseRequest(request);
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
+} // namespace
+
+StroopwafelStatus Stroopwafel_CreateCompletionQueue(uint32_t capacity, StroopwafelCompletionQueue **outQueue) {
+    if (!outQueue || capacity == 0 || capacity > IndexFreeList::MAX_SLOTS) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *queue = (StroopwafelCompletionQueue *) malloc(sizeof(StroopwafelCompletionQueue));
+    if (!queue) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    new (queue) StroopwafelCompletionQueue();
+
+    queue->capacity     = capacity;
+    queue->messages     = (OSMessage *) calloc(capacity, sizeof(OSMessage));
+    queue->requests     = (StroopwafelAsyncRequest *) memalign(0x40, capacity * sizeof(StroopwafelAsyncRequest));
+    queue->freeListNext = (std::atomic<uint16_t> *) malloc(capacity * sizeof(std::atomic<uint16_t>));
+    if (!queue->messages || !queue->requests || !queue->freeListNext) {
+        free(queue->messages);
+        free(queue->requests);
+        free(queue->freeListNext);
+        queue->~StroopwafelCompletionQueue();
+        free(queue);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    memset((void *) queue->requests, 0, capacity * sizeof(StroopwafelAsyncRequest));
+    for (uint32_t i = 0; i < capacity; i++) {
+        new (&queue->requests[i].bounce) IPCBuffer();
+    }
+    for (uint32_t i = 0; i < capacity; i++) {
+        new (&queue->freeListNext[i]) std::atomic<uint16_t>(0);
+    }
+    queue->freeList.init(queue->freeListNext, capacity);
+    OSInitMessageQueue(&queue->messageQueue, queue->messages, (int32_t) capacity);
+
+    *outQueue = queue;
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_DestroyCompletionQueue(StroopwafelCompletionQueue *queue) {
+    if (!queue) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    // Requests still reference the staging buffers, wait until IOS is done with all of them.
+    StroopwafelCompletion completion;
+    while (receiveCompletion(queue, &completion, OS_MESSAGE_FLAGS_BLOCKING) == STROOPWAFEL_RESULT_SUCCESS) {}
+    // Callback requests never reach the message queue.
+    while (queue->inFlight.load(std::memory_order_acquire) != 0) {
+        OSYieldThread();
+    }
+
+    free(queue->messages);
+    free(queue->requests);
+    free(queue->freeListNext);
+    queue->~StroopwafelCompletionQueue();
+    free(queue);
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_WaitCompletion(StroopwafelCompletionQueue *queue, StroopwafelCompletion *outCompletion) {
+    return receiveCompletion(queue, outCompletion, OS_MESSAGE_FLAGS_BLOCKING);
+}
+
+StroopwafelStatus Stroopwafel_PollCompletion(StroopwafelCompletionQueue *queue, StroopwafelCompletion *outCompletion) {
+    return receiveCompletion(queue, outCompletion, OS_MESSAGE_FLAGS_NONE);
+}
+
+StroopwafelStatus Stroopwafel_GetAPIVersionAsync(uint32_t *outVersion, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken) {
+    if (!outVersion || !isValidAsyncParams(asyncParams)) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *request = acquireRequest(asyncParams, STROOPWAFEL_IOCTL_GET_API_VERSION);
+    if (!request) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    // A cached version completes right away, without an IPC.
+    uint32_t cached = getCachedAPIVersion();
+    if (cached != 0) {
+        *outVersion     = cached;
+        request->status = STROOPWAFEL_RESULT_SUCCESS;
+        request->stats  = false;
+        if (outToken) {
+            *outToken = request->token;
+        }
+        deliverCompletion(request);
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
+
+    constexpr uint32_t outSize = sizeof(stroopwafel::CommandTraits<STROOPWAFEL_IOCTL_GET_API_VERSION>::Output);
+    request->copyOut           = outVersion;
+    request->copyOutLen        = outSize;
+    request->expectedLen       = outSize;
+
+    return submitIPC(request, nullptr, 0, request->staging.words, outSize, outToken);
+}
+
+StroopwafelStatus Stroopwafel_SetFwPathAsync(const char *path, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken) {
+    if (!path || !isValidAsyncParams(asyncParams)) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    size_t path_len = strlen(path);
+    if (path_len >= sizeof(StroopwafelAsyncRequest::staging.path)) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *request = acquireRequest(asyncParams, STROOPWAFEL_IOCTL_SET_FW_PATH);
+    if (!request) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    memcpy(request->staging.path, path, path_len + 1);
+
+    return submitIPC(request, request->staging.path, path_len + 1, nullptr, 0, outToken);
+}
+
+StroopwafelStatus Stroopwafel_WriteMemoryAsync(uint32_t num_writes, const StroopwafelWrite *writes, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken) {
+    if (num_writes == 0 || num_writes > MAX_WRITES_PER_IPC || !writes || !isValidAsyncParams(asyncParams)) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *request = acquireRequest(asyncParams, STROOPWAFEL_IOCTLV_WRITE_MEMORY);
+    if (!request) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t bounce_size = 0;
+    for (uint32_t i = 0; i < num_writes; i++) {
+        if (!isIPCAligned(writes[i].src)) {
+            bounce_size += ROUNDUP(writes[i].length, 0x40);
+        }
+    }
+    if (bounce_size > 0 && !request->bounce.acquire(bounce_size)) {
+        releaseRequest(request);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    auto *bounce = request->bounce.as<uint8_t>();
+    for (uint32_t i = 0; i < num_writes; i++) {
+        request->dest_addrs[i]        = writes[i].dest_addr;
+        request->vectors[i + 1].vaddr = (void *) writes[i].src;
+        request->vectors[i + 1].len   = writes[i].length;
+        if (!isIPCAligned(writes[i].src)) {
+            memcpy(bounce, writes[i].src, writes[i].length);
+            request->vectors[i + 1].vaddr = bounce;
+            bounce += ROUNDUP(writes[i].length, 0x40);
+        }
+    }
+
+    request->vectors[0].vaddr = request->dest_addrs;
+    request->vectors[0].len   = num_writes * sizeof(uint32_t);
+
+    // Asynchronous writes bypass the write shadow, the range is dropped again once the write completes.
+    for (uint32_t i = 0; i < num_writes; i++) {
+        invalidateWriteShadow(writes[i].dest_addr, writes[i].length);
+    }
+
+    return submitIPCV(request, 1 + num_writes, 0, outToken);
+}
+
+StroopwafelStatus Stroopwafel_ExecuteAsync(uint32_t target_addr, const void *config, uint32_t config_len, void *output, uint32_t output_len, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken) {
+    if (!target_addr || !isValidAsyncParams(asyncParams)) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *request = acquireRequest(asyncParams, STROOPWAFEL_IOCTLV_EXECUTE);
+    if (!request) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    bool has_config    = config && config_len > 0;
+    bool has_output    = output && output_len > 0;
+    bool bounce_config = has_config && !isIPCAligned(config);
+    bool bounce_output = has_output && !isIPCAligned(output, output_len);
+
+    uint32_t output_offset = bounce_config ? ROUNDUP(config_len, 0x40) : 0;
+    uint32_t bounce_size   = output_offset + (bounce_output ? ROUNDUP(output_len, 0x40) : 0);
+    if (bounce_size > 0 && !request->bounce.acquire(bounce_size)) {
+        releaseRequest(request);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    request->staging.words[0] = target_addr;
+    request->vectors[0].vaddr = request->staging.words;
+    request->vectors[0].len   = sizeof(uint32_t);
+
+    uint32_t num_in = 1;
+    if (has_config) {
+        request->vectors[num_in].vaddr = (void *) config;
+        request->vectors[num_in].len   = config_len;
+        if (bounce_config) {
+            request->vectors[num_in].vaddr = request->bounce.data();
+            memcpy(request->bounce.data(), config, config_len);
+        }
+        num_in++;
+    }
+
+    uint32_t num_io = 0;
+    if (has_output) {
+        request->vectors[num_in].vaddr = output;
+        request->vectors[num_in].len   = output_len;
+        num_io                         = 1;
+        if (bounce_output) {
+            request->vectors[num_in].vaddr = request->bounce.as<uint8_t>() + output_offset;
+            request->copyOutSrc            = request->vectors[num_in].vaddr;
+            request->copyOut               = output;
+            request->copyOutLen            = output_len;
+        }
+    }
+
+    return submitIPCV(request, num_in, num_io, outToken);
+}
+
+StroopwafelStatus Stroopwafel_MapMemoryAsync(const StroopwafelMapMemory *info, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken) {
+    if (!info || !isValidAsyncParams(asyncParams)) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *request = acquireRequest(asyncParams, STROOPWAFEL_IOCTL_MAP_MEMORY);
+    if (!request) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    memcpy(&request->staging.mapMemory, info, sizeof(StroopwafelMapMemory));
+    invalidateWriteShadow(info->vaddr, info->size);
+
+    return submitIPC(request, &request->staging.mapMemory, sizeof(StroopwafelMapMemory), nullptr, 0, outToken);
+}
+
+namespace {
+    template <uint32_t Command>
+    StroopwafelStatus getPathAsync(typename stroopwafel::CommandTraits<Command>::Output *out, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken) {
+        using Output = typename stroopwafel::CommandTraits<Command>::Output;
+        if (!out || !isValidAsyncParams(asyncParams)) {
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+
+        auto *request = acquireRequest(asyncParams, Command);
+        if (!request) {
+            return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+        }
+        request->copyOut     = out;
+        request->copyOutLen  = sizeof(Output);
+        request->expectedLen = sizeof(Output);
+
+        return submitIPC(request, nullptr, 0, &request->staging.minutePath, sizeof(Output), outToken);
+    }
+} // namespace
+
+StroopwafelStatus Stroopwafel_GetMinutePathAsync(StroopwafelMinutePath *out, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken) {
+    return getPathAsync<STROOPWAFEL_IOCTL_GET_MINUTE_PATH>(out, asyncParams, outToken);
+}
+
+StroopwafelStatus Stroopwafel_GetPluginPathAsync(StroopwafelMinutePath *out, const StroopwafelAsyncParams *asyncParams, uint32_t *outToken) {
+    return getPathAsync<STROOPWAFEL_IOCTL_GET_PLUGIN_PATH>(out, asyncParams, outToken);
+}
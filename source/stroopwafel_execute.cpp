@@ -0,0 +1,249 @@
+#include "logger.h"
+#include "stroopwafel/commands.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel/stroopwafel.hpp"
+#include "stroopwafel_ipc.h"
+#include "stroopwafel_stats.h"
+#include <algorithm>
+#include <coreinit/ios.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/time.h>
+#include <cstring>
+#include <malloc.h>
+#include <stdint.h>
+
+namespace {
+    // Invocations of one RunPrepared call that are queued in IOS at the same time. coreinit only has a small
+    // pool of IPC request buffers, so submitting everything at once fails with QFULL for bigger batches.
+    constexpr uint32_t MAX_PREPARED_IN_FLIGHT = 8;
+
+    // One invocation. The slot and its buffers never move once allocated, so pointers handed out by
+    // Stroopwafel_GetPreparedBuffers stay valid until the handle is freed.
+    struct PreparedSlot {
+        // Block layout: target word (own cache line), config buffer, output buffer.
+        uint8_t *block;
+        uint8_t *config;
+        uint8_t *output;
+        IOSVec vectors[3];
+        uint32_t num_in;
+        uint32_t num_io;
+        StroopwafelPreparedExecute *handle;
+        uint32_t index;
+        bool inFlight;
+        IOSError result;
+        OSTime startTime;
+    };
+} // namespace
+
+struct StroopwafelPreparedExecute {
+    uint32_t target_addr;
+    uint32_t config_cap;
+    uint32_t output_cap;
+    PreparedSlot **slots;
+    uint32_t num_slots;
+    OSMessageQueue queue;
+    OSMessage messages[MAX_PREPARED_IN_FLIGHT];
+    bool stats;
+};
+
+namespace {
+    void preparedCallback(IOSError res, void *context) {
+        auto *slot   = (PreparedSlot *) context;
+        slot->result = res;
+        if (slot->handle->stats) {
+            recordIPCStats(STROOPWAFEL_IOCTLV_EXECUTE, slot->startTime, sumVectorLength(slot->vectors, slot->num_in), res >= 0 ? sumVectorLength(slot->vectors + slot->num_in, slot->num_io) : 0, res < 0);
+        }
+
+        OSMessage message;
+        message.message = slot;
+        OSSendMessage(&slot->handle->queue, &message, OS_MESSAGE_FLAGS_NONE);
+    }
+
+    // Makes sure at least count slots exist. Only called while no invocation is in flight.
+    bool ensureSlots(StroopwafelPreparedExecute *handle, uint32_t count) {
+        if (count <= handle->num_slots) {
+            return true;
+        }
+
+        auto *slots = (PreparedSlot **) realloc(handle->slots, count * sizeof(PreparedSlot *));
+        if (!slots) {
+            return false;
+        }
+        handle->slots = slots;
+
+        uint32_t config_size = ROUNDUP(handle->config_cap, 0x40);
+        uint32_t output_size = ROUNDUP(handle->output_cap, 0x40);
+        while (handle->num_slots < count) {
+            auto *slot  = (PreparedSlot *) malloc(sizeof(PreparedSlot));
+            auto *block = (uint8_t *) memalign(0x40, 0x40 + config_size + output_size);
+            if (!slot || !block) {
+                free(slot);
+                free(block);
+                break;
+            }
+            memset(slot, 0, sizeof(*slot));
+            slot->block         = block;
+            slot->config        = block + 0x40;
+            slot->output        = block + 0x40 + config_size;
+            slot->handle        = handle;
+            *(uint32_t *) block = handle->target_addr;
+
+            slot->vectors[0].vaddr = block;
+            slot->vectors[0].len   = sizeof(uint32_t);
+
+            handle->slots[handle->num_slots++] = slot;
+        }
+        return handle->num_slots >= count;
+    }
+
+    // Fills in the payload dependent part of the vectors.
+    void updateVectors(PreparedSlot *slot, uint32_t config_len, uint32_t output_len) {
+        uint32_t num_in = 1;
+        if (config_len > 0) {
+            slot->vectors[num_in].vaddr = slot->config;
+            slot->vectors[num_in].len   = config_len;
+            num_in++;
+        }
+        uint32_t num_io = 0;
+        if (output_len > 0) {
+            slot->vectors[num_in].vaddr = slot->output;
+            slot->vectors[num_in].len   = output_len;
+            num_io                      = 1;
+        }
+        slot->num_in = num_in;
+        slot->num_io = num_io;
+    }
+
+    // Waits for one invocation of RunPrepared and copies its output. Returns false if the invocation failed.
+    bool completePrepared(StroopwafelPreparedExecute *handle, uint32_t count, void *outputs, uint32_t output_len) {
+        OSMessage message;
+        OSReceiveMessage(&handle->queue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+        auto *slot     = (PreparedSlot *) message.message;
+        slot->inFlight = false;
+        if (slot->result < 0) {
+            DEBUG_FUNCTION_LINE_ERR("Prepared execute %d of %d failed with res: %d", slot->index, count, slot->result);
+            return false;
+        }
+        if (outputs) {
+            memcpy((uint8_t *) outputs + slot->index * output_len, slot->output, output_len);
+        }
+        return true;
+    }
+} // namespace
+
+StroopwafelStatus Stroopwafel_PrepareExecute(uint32_t target_addr, uint32_t config_cap, uint32_t output_cap, StroopwafelPreparedExecute **outHandle) {
+    if (!target_addr || !outHandle) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *handle = (StroopwafelPreparedExecute *) malloc(sizeof(StroopwafelPreparedExecute));
+    if (!handle) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    memset(handle, 0, sizeof(*handle));
+    handle->target_addr = target_addr;
+    handle->config_cap  = config_cap;
+    handle->output_cap  = output_cap;
+    OSInitMessageQueue(&handle->queue, handle->messages, MAX_PREPARED_IN_FLIGHT);
+
+    if (!ensureSlots(handle, 1)) {
+        Stroopwafel_FreePrepared(handle);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    *outHandle = handle;
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_FreePrepared(StroopwafelPreparedExecute *handle) {
+    if (!handle) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    for (uint32_t i = 0; i < handle->num_slots; i++) {
+        free(handle->slots[i]->block);
+        free(handle->slots[i]);
+    }
+    free(handle->slots);
+    free(handle);
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_GetPreparedBuffers(StroopwafelPreparedExecute *handle, uint32_t index, void **outConfig, void **outOutput) {
+    if (!handle || index == 0xFFFFFFFF) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    if (!ensureSlots(handle, index + 1)) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    if (outConfig) {
+        *outConfig = handle->slots[index]->config;
+    }
+    if (outOutput) {
+        *outOutput = handle->slots[index]->output;
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_RunPrepared(StroopwafelPreparedExecute *handle, uint32_t count, const void *configs, uint32_t config_len, void *outputs, uint32_t output_len) {
+    if (!handle || count == 0 || config_len > handle->config_cap || output_len > handle->output_cap) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    // Payloads written in place stay in the slot of their invocation, otherwise a window of slots is reused.
+    bool inPlace    = (!configs && config_len > 0) || (!outputs && output_len > 0);
+    uint32_t window = inPlace ? count : std::min(count, MAX_PREPARED_IN_FLIGHT);
+    if (!ensureSlots(handle, window)) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    if (count == 1) {
+        // Nothing to overlap, a plain synchronous call is cheaper.
+        auto *slot = handle->slots[0];
+        if (configs) {
+            memcpy(slot->config, configs, config_len);
+        }
+        updateVectors(slot, config_len, output_len);
+        StroopwafelStatus status = stroopwafel::callv<STROOPWAFEL_IOCTLV_EXECUTE>(slot->vectors, slot->num_in, slot->num_io);
+        if (status == STROOPWAFEL_RESULT_SUCCESS && outputs) {
+            memcpy(outputs, slot->output, output_len);
+        }
+        return status;
+    }
+
+    // Keep up to MAX_PREPARED_IN_FLIGHT invocations queued in IOS, a slot is refilled once its previous invocation
+    // completed. A failed invocation doesn't stop the others, a failed submission does.
+    handle->stats            = isStatsEnabled();
+    StroopwafelStatus status = STROOPWAFEL_RESULT_SUCCESS;
+    bool failed              = false;
+    uint32_t inFlight        = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        auto *slot = handle->slots[i % window];
+        while (inFlight == MAX_PREPARED_IN_FLIGHT || slot->inFlight) {
+            failed |= !completePrepared(handle, count, outputs, output_len);
+            inFlight--;
+        }
+
+        slot->index = i;
+        if (configs) {
+            memcpy(slot->config, (const uint8_t *) configs + i * config_len, config_len);
+        }
+        updateVectors(slot, config_len, output_len);
+        if (handle->stats) {
+            slot->startTime = OSGetSystemTime();
+        }
+        status = doStroopwafelIPCVAsync(STROOPWAFEL_IOCTLV_EXECUTE, slot->num_in, slot->num_io, slot->vectors, preparedCallback, slot);
+        if (status != STROOPWAFEL_RESULT_SUCCESS) {
+            break;
+        }
+        slot->inFlight = true;
+        inFlight++;
+    }
+
+    while (inFlight > 0) {
+        failed |= !completePrepared(handle, count, outputs, output_len);
+        inFlight--;
+    }
+    if (status == STROOPWAFEL_RESULT_SUCCESS && failed) {
+        status = STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+    }
+    return status;
+}
@@ -1,49 +1,246 @@
 #include "stroopwafel_ipc.h"
+#include "ipc_buffer_pool.h"
 #include "logger.h"
+#include "os_mutex.h"
+#include "spin_lock.h"
 #include "stroopwafel/commands.h"
 #include "stroopwafel/stroopwafel.h"
+#include "stroopwafel/stroopwafel.hpp"
+#include "stroopwafel_stats.h"
+#include "stroopwafel_trace.h"
+#include <atomic>
+#include <coreinit/core.h>
 #include <coreinit/ios.h>
+#include <coreinit/time.h>
 #include <cstring>
 #include <malloc.h>
+#include <mutex>
 #include <stdint.h>
 
-int stroopwafelHandle   = -1;
-int stroopwafelInitDone = 0;
-
 namespace {
-    // Helper to send simple IOCTL commands with one input and one output buffer.
-    // This is similar to doSimpleCustomIPCCommand from original libmocha,
-    // but adapted for /dev/stroopwafel and general IOCTL commands.
-    StroopwafelStatus doStroopwafelIPC(const uint32_t command, const void *buffer_in, uint32_t length_in, void *buffer_io, uint32_t length_io, int *actual_len) {
-        if (!stroopwafelInitDone || stroopwafelHandle < 0) {
-            return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
+    // Handles are only written while sInitLock is held. Readers only look at the first sNumHandles entries,
+    // sNumHandles is set to 0 before handles get closed.
+    std::atomic<int32_t> sHandles[STROOPWAFEL_MAX_HANDLES] = {-1, -1, -1};
+    std::atomic<uint32_t> sNumHandles{0};
+    uint32_t sInitRefCount = 0;
+    // Held across IOS_Open, the version query and joining the log flusher, so waiting threads have to sleep.
+    Mutex sInitLock;
+
+    // Picks a handle without locking. With a pool, each core sticks to its own handle.
+    int32_t getHandle() {
+        uint32_t numHandles = sNumHandles.load(std::memory_order_acquire);
+        if (numHandles == 0) {
+            return -1;
         }
+        uint32_t index = numHandles == 1 ? 0 : OSGetCoreId() % numHandles;
+        return sHandles[index].load(std::memory_order_relaxed);
+    }
+
+    struct CommandVersion {
+        uint32_t command;
+        uint32_t version;
+    };
 
-        int res = IOS_Ioctl(stroopwafelHandle, command, (void *) buffer_in, length_in, buffer_io, length_io);
-        if (res < 0) {
-            DEBUG_FUNCTION_LINE_ERR("IOS_Ioctl failed with res: %d", res);
-            return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+    template <uint32_t Command>
+    constexpr CommandVersion commandVersion() {
+        return {Command, stroopwafel::CommandTraits<Command>::version};
+    }
+
+    // Every command has to be listed here, the version it appeared in comes from its CommandTraits.
+    constexpr CommandVersion sCommandVersions[] = {
+            commandVersion<STROOPWAFEL_IOCTL_GET_API_VERSION>(),
+            commandVersion<STROOPWAFEL_IOCTL_SET_FW_PATH>(),
+            commandVersion<STROOPWAFEL_IOCTLV_WRITE_MEMORY>(),
+            commandVersion<STROOPWAFEL_IOCTLV_EXECUTE>(),
+            commandVersion<STROOPWAFEL_IOCTL_MAP_MEMORY>(),
+            commandVersion<STROOPWAFEL_IOCTL_GET_MINUTE_PATH>(),
+            commandVersion<STROOPWAFEL_IOCTL_GET_PLUGIN_PATH>(),
+            commandVersion<STROOPWAFEL_IOCTLV_READ_MEMORY>(),
+    };
+
+    // IOS may be reloaded while the library is not initialized, so the version is dropped on the last deinit like
+    // the map index. 0 means not fetched yet.
+    std::atomic<uint32_t> sAPIVersion{0};
+    // Until the version is known only the version query itself is allowed.
+    std::atomic<uint32_t> sCapabilities{STROOPWAFEL_CAPABILITY(STROOPWAFEL_IOCTL_GET_API_VERSION)};
+
+    uint32_t getCapabilitiesForVersion(uint32_t version) {
+        uint32_t capabilities = 0;
+        for (const auto &entry : sCommandVersions) {
+            if (entry.version <= version) {
+                capabilities |= STROOPWAFEL_CAPABILITY(entry.command);
+            }
         }
-        if (actual_len) {
-            *actual_len = res;
+        return capabilities;
+    }
+
+    bool hasCapability(uint32_t command) {
+        return command < 32 && (sCapabilities.load(std::memory_order_relaxed) & STROOPWAFEL_CAPABILITY(command));
+    }
+
+    // Cached results of the path queries. A cache entry is only valid if it was filled during the current
+    // generation, invalidatePathCaches() just bumps the generation so it can be called from any context.
+    struct PathCache {
+        SpinLock lock;
+        bool filled         = false;
+        uint32_t generation = 0;
+        StroopwafelMinutePath path;
+    };
+    std::atomic<uint32_t> sPathCacheGeneration{0};
+    PathCache sMinutePathCache;
+    PathCache sPluginPathCache;
+
+    void closeHandles() {
+        uint32_t numHandles = sNumHandles.exchange(0, std::memory_order_acq_rel);
+        for (uint32_t i = 0; i < numHandles; i++) {
+            IOS_Close(sHandles[i].exchange(-1, std::memory_order_relaxed));
         }
-        return STROOPWAFEL_RESULT_SUCCESS;
     }
 
-    StroopwafelStatus doStroopwafelIPCV(const uint32_t command, uint32_t num_in, uint32_t num_io, IOSVec *vector) {
-        if (!stroopwafelInitDone || stroopwafelHandle < 0) {
+    template <uint32_t Command>
+    StroopwafelStatus getCachedPath(PathCache &cache, StroopwafelMinutePath *out) {
+        if (getHandle() < 0) {
             return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
         }
 
-        int res = IOS_Ioctlv(stroopwafelHandle, command, num_in, num_io, vector);
-        if (res < 0) {
-            DEBUG_FUNCTION_LINE_ERR("IOS_Ioctlv failed with res: %d", res);
-            return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+        uint32_t generation = sPathCacheGeneration.load(std::memory_order_acquire);
+        {
+            std::lock_guard<SpinLock> lock(cache.lock);
+            if (cache.filled && cache.generation == generation) {
+                memcpy(out, &cache.path, sizeof(StroopwafelMinutePath));
+                return STROOPWAFEL_RESULT_SUCCESS;
+            }
+        }
+
+        StroopwafelStatus status = stroopwafel::call<Command>(*out);
+        if (status != STROOPWAFEL_RESULT_SUCCESS) {
+            return status;
+        }
+
+        // Don't cache the result if the fw path has been changed while the request was in flight.
+        std::lock_guard<SpinLock> lock(cache.lock);
+        if (sPathCacheGeneration.load(std::memory_order_acquire) == generation) {
+            memcpy(&cache.path, out, sizeof(StroopwafelMinutePath));
+            cache.generation = generation;
+            cache.filled     = true;
         }
         return STROOPWAFEL_RESULT_SUCCESS;
     }
 } // namespace
 
+// Transport behind stroopwafel::call for commands with one input and one output buffer.
+// Checks the handle and capabilities, and records statistics and traces for the ioctl.
+StroopwafelStatus stroopwafel::detail::ioctl(uint32_t command, const void *in, uint32_t inLen, void *out, uint32_t outLen, int *actualLen) {
+    int32_t handle = getHandle();
+    if (handle < 0) {
+        return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
+    }
+    if (!hasCapability(command)) {
+        return STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND;
+    }
+
+    bool stats   = isStatsEnabled();
+    bool trace   = isTraceEnabled();
+    OSTime start = stats || trace ? OSGetSystemTime() : 0;
+    int res      = IOS_Ioctl(handle, command, (void *) in, inLen, out, outLen);
+    if (stats) {
+        recordIPCStats(command, start, inLen, res > 0 ? res : 0, res < 0);
+    }
+    if (trace) {
+        IOSVec vectors[2] = {{(void *) in, inLen}, {out, outLen}};
+        recordIPCTrace(command, false, false, 1, 1, vectors, start, res);
+    }
+    if (res < 0) {
+        DEBUG_FUNCTION_LINE_ERR("IOS_Ioctl failed with res: %d", res);
+        return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+    }
+    if (actualLen) {
+        *actualLen = res;
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+// Same for commands that take a vector list.
+StroopwafelStatus stroopwafel::detail::ioctlv(uint32_t command, uint32_t numIn, uint32_t numIo, IOSVec *vectors) {
+    int32_t handle = getHandle();
+    if (handle < 0) {
+        return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
+    }
+    if (!hasCapability(command)) {
+        return STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND;
+    }
+
+    bool stats   = isStatsEnabled();
+    bool trace   = isTraceEnabled();
+    OSTime start = stats || trace ? OSGetSystemTime() : 0;
+    int res      = IOS_Ioctlv(handle, command, numIn, numIo, vectors);
+    if (stats) {
+        recordIPCStats(command, start, sumVectorLength(vectors, numIn), res >= 0 ? sumVectorLength(vectors + numIn, numIo) : 0, res < 0);
+    }
+    if (trace) {
+        recordIPCTrace(command, true, false, numIn, numIo, vectors, start, res);
+    }
+    if (res < 0) {
+        DEBUG_FUNCTION_LINE_ERR("IOS_Ioctlv failed with res: %d", res);
+        return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+uint32_t getCachedAPIVersion() {
+    return sAPIVersion.load(std::memory_order_relaxed);
+}
+
+void cacheAPIVersion(uint32_t version) {
+    sAPIVersion.store(version, std::memory_order_relaxed);
+}
+
+void invalidatePathCaches() {
+    sPathCacheGeneration.fetch_add(1, std::memory_order_acq_rel);
+}
+
+StroopwafelStatus doStroopwafelIPCAsync(uint32_t command, void *buffer_in, uint32_t length_in, void *buffer_io, uint32_t length_io, IOSAsyncCallbackFn callback, void *context) {
+    int32_t handle = getHandle();
+    if (handle < 0) {
+        return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
+    }
+    if (!hasCapability(command)) {
+        return STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND;
+    }
+
+    // The input has to be recorded before IOS can complete the request.
+    if (isTraceEnabled()) {
+        IOSVec vectors[2] = {{buffer_in, length_in}, {buffer_io, length_io}};
+        recordIPCTrace(command, false, true, 1, 1, vectors, OSGetSystemTime(), 0);
+    }
+    int res = IOS_IoctlAsync(handle, command, buffer_in, length_in, buffer_io, length_io, callback, context);
+    if (res < 0) {
+        DEBUG_FUNCTION_LINE_ERR("IOS_IoctlAsync failed with res: %d", res);
+        return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus doStroopwafelIPCVAsync(uint32_t command, uint32_t num_in, uint32_t num_io, IOSVec *vector, IOSAsyncCallbackFn callback, void *context) {
+    int32_t handle = getHandle();
+    if (handle < 0) {
+        return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
+    }
+    if (!hasCapability(command)) {
+        return STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND;
+    }
+
+    if (isTraceEnabled()) {
+        recordIPCTrace(command, true, true, num_in, num_io, vector, OSGetSystemTime(), 0);
+    }
+    int res = IOS_IoctlvAsync(handle, command, num_in, num_io, vector, callback, context);
+    if (res < 0) {
+        DEBUG_FUNCTION_LINE_ERR("IOS_IoctlvAsync failed with res: %d", res);
+        return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
 const char *Stroopwafel_GetStatusStr(StroopwafelStatus status) {
     switch (status) {
         case STROOPWAFEL_RESULT_SUCCESS:
@@ -76,47 +273,73 @@ const char *Stroopwafel_GetStatusStr(StroopwafelStatus status) {
 
 
 StroopwafelStatus Stroopwafel_InitLibrary() {
-    if (stroopwafelInitDone) {
+    return Stroopwafel_InitLibraryEx(1);
+}
+
+StroopwafelStatus Stroopwafel_InitLibraryEx(uint32_t num_handles) {
+    if (num_handles == 0 || num_handles > STROOPWAFEL_MAX_HANDLES) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<Mutex> lock(sInitLock);
+    if (sInitRefCount > 0) {
+        sInitRefCount++;
         return STROOPWAFEL_RESULT_SUCCESS;
     }
+    stroopwafel::log::init();
 
-    if (stroopwafelHandle < 0) {
+    uint32_t opened = 0;
+    for (; opened < num_handles; opened++) {
         int handle = IOS_Open((char *) ("/dev/stroopwafel"), static_cast<IOSOpenMode>(0));
         if (handle < 0) {
-            DEBUG_FUNCTION_LINE_ERR("Failed to open /dev/stroopwafel: %d", handle);
-            return STROOPWAFEL_RESULT_UNSUPPORTED_CFW;
+            if (opened == 0) {
+                DEBUG_FUNCTION_LINE_ERR("Failed to open /dev/stroopwafel: %d", handle);
+                stroopwafel::log::shutdown();
+                return STROOPWAFEL_RESULT_UNSUPPORTED_CFW;
+            }
+            // Additional handles are optional, continue with a smaller pool.
+            DEBUG_FUNCTION_LINE_WARN("Failed to open additional /dev/stroopwafel handle: %d", handle);
+            break;
         }
-        stroopwafelHandle = handle;
+        sHandles[opened].store(handle, std::memory_order_relaxed);
     }
-
-    stroopwafelInitDone = 1;
+    sNumHandles.store(opened, std::memory_order_release);
 
     // Check API version for compatibility
     uint32_t version         = 0;
     StroopwafelStatus status = Stroopwafel_GetAPIVersion(&version);
     if (status != STROOPWAFEL_RESULT_SUCCESS) {
-        IOS_Close(stroopwafelHandle);
-        stroopwafelHandle = -1;
+        closeHandles();
+        stroopwafel::log::shutdown();
         return status;
     }
 
     if (version > STROOPWAFEL_API_VERSION || version >> 24 != STROOPWAFEL_API_VERSION >> 24) {
-        IOS_Close(stroopwafelHandle);
-        stroopwafelHandle = -1;
+        closeHandles();
         DEBUG_FUNCTION_LINE_ERR("Unsupported API Version: 0x%08X, expected 0x%08X", version, STROOPWAFEL_API_VERSION);
+        stroopwafel::log::shutdown();
         return STROOPWAFEL_RESULT_UNSUPPORTED_API_VERSION;
     }
 
-
+    sCapabilities.store(getCapabilitiesForVersion(version), std::memory_order_relaxed);
+    sInitRefCount = 1;
     return STROOPWAFEL_RESULT_SUCCESS;
 }
 
 StroopwafelStatus Stroopwafel_DeInitLibrary() {
-    stroopwafelInitDone = 0;
+    std::lock_guard<Mutex> lock(sInitLock);
+    if (sInitRefCount == 0) {
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
 
-    if (stroopwafelHandle >= 0) {
-        IOS_Close(stroopwafelHandle);
-        stroopwafelHandle = -1;
+    if (--sInitRefCount == 0) {
+        closeHandles();
+        invalidatePathCaches();
+        resetMapIndex();
+        sAPIVersion.store(0, std::memory_order_relaxed);
+        sCapabilities.store(STROOPWAFEL_CAPABILITY(STROOPWAFEL_IOCTL_GET_API_VERSION), std::memory_order_relaxed);
+        // Stops the flusher thread, the errors of the last calls are printed before it exits.
+        stroopwafel::log::shutdown();
     }
 
     return STROOPWAFEL_RESULT_SUCCESS;
@@ -127,15 +350,22 @@ StroopwafelStatus Stroopwafel_GetAPIVersion(uint32_t *version) {
         return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
     }
 
-    ALIGN_0x40 uint32_t io_buffer[0x4]; // Buffer for output, ensure 0x40 aligned
-    int actual_len           = 0;
-    StroopwafelStatus status = doStroopwafelIPC(STROOPWAFEL_IOCTL_GET_API_VERSION, nullptr, 0, io_buffer, sizeof(uint32_t), &actual_len);
+    if (getHandle() < 0) {
+        return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
+    }
 
-    if (status == STROOPWAFEL_RESULT_SUCCESS && actual_len == sizeof(uint32_t)) {
-        *version = io_buffer[0];
+    uint32_t cached = getCachedAPIVersion();
+    if (cached != 0) {
+        *version = cached;
         return STROOPWAFEL_RESULT_SUCCESS;
     }
 
+    uint32_t fetched         = 0;
+    StroopwafelStatus status = stroopwafel::call<STROOPWAFEL_IOCTL_GET_API_VERSION>(fetched);
+    if (status == STROOPWAFEL_RESULT_SUCCESS) {
+        *version = fetched;
+        cacheAPIVersion(fetched);
+    }
     return status;
 }
 
@@ -150,32 +380,71 @@ StroopwafelStatus Stroopwafel_SetFwPath(const char *path) {
         return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
     }
 
-    // Create a 0x40 aligned buffer for the path
-    ALIGN_0x40 char aligned_path[256];
-    strncpy(aligned_path, path, sizeof(aligned_path) - 1);
-    aligned_path[sizeof(aligned_path) - 1] = '\0';
-
-    return doStroopwafelIPC(STROOPWAFEL_IOCTL_SET_FW_PATH, aligned_path, strlen(aligned_path) + 1, nullptr, 0, nullptr);
+    // Unaligned paths are bounced through the stack.
+    StroopwafelStatus status = stroopwafel::callBytes<STROOPWAFEL_IOCTL_SET_FW_PATH>(path, path_len + 1);
+    if (status == STROOPWAFEL_RESULT_SUCCESS) {
+        invalidatePathCaches();
+    }
+    return status;
 }
 
-StroopwafelStatus Stroopwafel_WriteMemory(uint32_t num_writes, const StroopwafelWrite *writes) {
-    if (num_writes == 0 || num_writes > 15 || !writes) {
+StroopwafelStatus Stroopwafel_GetCapabilities(uint32_t *outCapabilities) {
+    if (!outCapabilities) {
         return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
     }
+    if (getHandle() < 0) {
+        return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
+    }
+    *outCapabilities = sCapabilities.load(std::memory_order_relaxed);
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus writeMemoryIPC(uint32_t num_writes, const StroopwafelWrite *writes) {
+    // The destination addresses take the first 0x40 bytes, unaligned sources get bounced after that.
+    uint32_t buffer_size = 0x40;
+    for (uint32_t i = 0; i < num_writes; i++) {
+        if (!isIPCAligned(writes[i].src)) {
+            buffer_size += ROUNDUP(writes[i].length, 0x40);
+        }
+    }
 
-    ALIGN_0x40 uint32_t dest_addrs[16];
-    IOSVec vectors[16];
+    IPCBuffer buffer;
+    if (!buffer.acquire(buffer_size)) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    auto *dest_addrs = buffer.as<uint32_t>();
+    auto *bounce     = buffer.as<uint8_t>() + 0x40;
+    IOSVec vectors[MAX_WRITES_PER_IPC + 1];
 
     for (uint32_t i = 0; i < num_writes; i++) {
         dest_addrs[i]        = writes[i].dest_addr;
         vectors[i + 1].vaddr = (void *) writes[i].src;
         vectors[i + 1].len   = writes[i].length;
+        if (!isIPCAligned(writes[i].src)) {
+            memcpy(bounce, writes[i].src, writes[i].length);
+            vectors[i + 1].vaddr = bounce;
+            bounce += ROUNDUP(writes[i].length, 0x40);
+        }
     }
 
     vectors[0].vaddr = dest_addrs;
     vectors[0].len   = num_writes * sizeof(uint32_t);
 
-    return doStroopwafelIPCV(STROOPWAFEL_IOCTLV_WRITE_MEMORY, 1 + num_writes, 0, vectors);
+    return stroopwafel::callv<STROOPWAFEL_IOCTLV_WRITE_MEMORY>(vectors, 1 + num_writes, 0);
+}
+
+StroopwafelStatus Stroopwafel_WriteMemory(uint32_t num_writes, const StroopwafelWrite *writes) {
+    if (num_writes == 0 || num_writes > MAX_WRITES_PER_IPC || !writes) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    if (isWriteShadowEnabled()) {
+        // Unchanged writes don't reach the IPC path, so check the init state here.
+        if (getHandle() < 0) {
+            return STROOPWAFEL_RESULT_LIB_UNINITIALIZED;
+        }
+        return writeMemoryShadowed(num_writes, writes);
+    }
+    return writeMemoryIPC(num_writes, writes);
 }
 
 StroopwafelStatus Stroopwafel_Execute(uint32_t target_addr, const void *config, uint32_t config_len, void *output, uint32_t output_len) {
@@ -183,38 +452,48 @@ StroopwafelStatus Stroopwafel_Execute(uint32_t target_addr, const void *config,
         return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
     }
 
-    ALIGN_0x40 uint32_t target = target_addr;
+    bool has_config    = config && config_len > 0;
+    bool has_output    = output && output_len > 0;
+    bool bounce_config = has_config && !isIPCAligned(config);
+    bool bounce_output = has_output && !isIPCAligned(output, output_len);
+
+    // Layout: target address, bounced config, bounced output. Each part starts at its own cache line.
+    uint32_t config_offset = 0x40;
+    uint32_t output_offset = config_offset + (bounce_config ? ROUNDUP(config_len, 0x40) : 0);
+    IPCBuffer buffer;
+    if (!buffer.acquire(output_offset + (bounce_output ? ROUNDUP(output_len, 0x40) : 0))) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    auto *target = buffer.as<uint32_t>();
+    *target      = target_addr;
+
     IOSVec vectors[3];
-    vectors[0].vaddr = &target;
+    vectors[0].vaddr = target;
     vectors[0].len   = sizeof(uint32_t);
 
     uint32_t num_in = 1;
-    if (config && config_len > 0) {
+    if (has_config) {
         vectors[num_in].vaddr = (void *) config;
         vectors[num_in].len   = config_len;
+        if (bounce_config) {
+            vectors[num_in].vaddr = buffer.as<uint8_t>() + config_offset;
+            memcpy(vectors[num_in].vaddr, config, config_len);
+        }
         num_in++;
     }
 
     uint32_t num_io = 0;
-    if (output && output_len > 0) {
-        vectors[num_in].vaddr = output;
+    if (has_output) {
+        vectors[num_in].vaddr = bounce_output ? buffer.as<uint8_t>() + output_offset : output;
         vectors[num_in].len   = output_len;
         num_io                = 1;
     }
 
-    return doStroopwafelIPCV(STROOPWAFEL_IOCTLV_EXECUTE, num_in, num_io, vectors);
-}
-
-StroopwafelStatus Stroopwafel_MapMemory(const StroopwafelMapMemory *info) {
-    if (!info) {
-        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    StroopwafelStatus status = stroopwafel::callv<STROOPWAFEL_IOCTLV_EXECUTE>(vectors, num_in, num_io);
+    if (status == STROOPWAFEL_RESULT_SUCCESS && bounce_output) {
+        memcpy(output, buffer.as<uint8_t>() + output_offset, output_len);
     }
-
-    // Ensure 0x40 aligned buffer for IOS IPC
-    ALIGN_0x40 StroopwafelMapMemory aligned_info;
-    memcpy(&aligned_info, info, sizeof(StroopwafelMapMemory));
-
-    return doStroopwafelIPC(STROOPWAFEL_IOCTL_MAP_MEMORY, &aligned_info, sizeof(StroopwafelMapMemory), nullptr, 0, nullptr);
+    return status;
 }
 
 StroopwafelStatus Stroopwafel_GetMinutePath(StroopwafelMinutePath *out) {
@@ -222,20 +501,7 @@ StroopwafelStatus Stroopwafel_GetMinutePath(StroopwafelMinutePath *out) {
         return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
     }
 
-    ALIGN_0x40 StroopwafelMinutePath aligned_out;
-    int actual_len           = 0;
-    StroopwafelStatus status = doStroopwafelIPC(STROOPWAFEL_IOCTL_GET_MINUTE_PATH, nullptr, 0, &aligned_out, sizeof(StroopwafelMinutePath), &actual_len);
-
-    if (status != STROOPWAFEL_RESULT_SUCCESS) {
-        return status;
-    }
-
-    if (actual_len != sizeof(StroopwafelMinutePath)) {
-        return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
-    }
-
-    memcpy(out, &aligned_out, sizeof(StroopwafelMinutePath));
-    return STROOPWAFEL_RESULT_SUCCESS;
+    return getCachedPath<STROOPWAFEL_IOCTL_GET_MINUTE_PATH>(sMinutePathCache, out);
 }
 
 StroopwafelStatus Stroopwafel_GetPluginPath(StroopwafelMinutePath *out) {
@@ -243,18 +509,5 @@ StroopwafelStatus Stroopwafel_GetPluginPath(StroopwafelMinutePath *out) {
         return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
     }
 
-    ALIGN_0x40 StroopwafelMinutePath aligned_out;
-    int actual_len           = 0;
-    StroopwafelStatus status = doStroopwafelIPC(STROOPWAFEL_IOCTL_GET_PLUGIN_PATH, nullptr, 0, &aligned_out, sizeof(StroopwafelMinutePath), &actual_len);
-
-    if (status != STROOPWAFEL_RESULT_SUCCESS) {
-        return status;
-    }
-
-    if (actual_len != sizeof(StroopwafelMinutePath)) {
-        return STROOPWAFEL_RESULT_UNKNOWN_ERROR;
-    }
-
-    memcpy(out, &aligned_out, sizeof(StroopwafelMinutePath));
-    return STROOPWAFEL_RESULT_SUCCESS;
+    return getCachedPath<STROOPWAFEL_IOCTL_GET_PLUGIN_PATH>(sPluginPathCache, out);
 }
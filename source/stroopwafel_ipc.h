@@ -1,6 +1,65 @@
 #pragma once
+#include "stroopwafel/stroopwafel.h"
+#include <coreinit/ios.h>
 #include <stdint.h>
 
 #define ALIGN(align)      __attribute__((aligned(align)))
 #define ALIGN_0x40        ALIGN(0x40)
-#define ROUNDUP(x, align) (((x) + ((align) -1)) & ~((align) -1))
\ No newline at end of file
+#define ROUNDUP(x, align) (((x) + ((align) -1)) & ~((align) -1))
+
+// STROOPWAFEL_IOCTLV_WRITE_MEMORY takes one vector for the destination addresses plus one per write.
+constexpr uint32_t MAX_WRITES_PER_IPC = 15;
+// STROOPWAFEL_IOCTLV_READ_MEMORY takes one vector for the source addresses plus one output vector per read.
+constexpr uint32_t MAX_READS_PER_IPC = 15;
+
+// Touching writes are only merged up to this size, so large writes stay direct instead of being copied into staging.
+constexpr uint32_t MAX_MERGED_WRITE_BYTES = 0x10000;
+
+// Range of merged writes, used to coalesce adjacent/overlapping StroopwafelWrites.
+struct WriteRun {
+    uint32_t dest_addr;
+    uint32_t length;
+    // Range of the run's members in the sorted index array.
+    uint32_t first;
+    uint32_t count;
+};
+
+// Sorts order (indices into writes, zero length writes already removed) by address and merges writes into runs.
+// Overlapping writes always end up in the same run, touching ones only while the run stays within
+// MAX_MERGED_WRITE_BYTES. runs must be able to hold num_order entries. Returns the number of runs, 0 if
+// overlapping writes cover the whole 32 bit address space and don't fit a single run.
+uint32_t buildWriteRuns(const StroopwafelWrite *writes, uint32_t *order, uint32_t num_order, WriteRun *runs);
+// Single pass of buildWriteRuns for an order that is already sorted by address (ties in original order).
+uint32_t mergeWriteRuns(const StroopwafelWrite *writes, const uint32_t *order, uint32_t num_order, WriteRun *runs);
+// Copies the members of a run to staging in their original order, so later writes win on overlaps.
+void stageWriteRun(const WriteRun &run, const StroopwafelWrite *writes, uint32_t *order, uint8_t *staging);
+// Sends the runs via Stroopwafel_WriteMemory, MAX_WRITES_PER_IPC per request. Small or unaligned runs are staged,
+// the others are passed to IOS directly.
+StroopwafelStatus writeRuns(const StroopwafelWrite *writes, uint32_t *order, const WriteRun *runs, uint32_t num_runs);
+
+// Sends 1 to MAX_WRITES_PER_IPC writes as a single STROOPWAFEL_IOCTLV_WRITE_MEMORY, bypassing the write shadow.
+StroopwafelStatus writeMemoryIPC(uint32_t num_writes, const StroopwafelWrite *writes);
+
+// Write shadow, see Stroopwafel_EnableWriteShadow.
+bool isWriteShadowEnabled();
+// Same contract as writeMemoryIPC, but only sends what differs from the last write of the same range.
+StroopwafelStatus writeMemoryShadowed(uint32_t num_writes, const StroopwafelWrite *writes);
+// Forgets the content of a range, for writes that bypass the shadow.
+void invalidateWriteShadow(uint32_t addr, uint32_t length);
+// Same for the IPC completion context, the range is dropped by the next shadow operation.
+void invalidateWriteShadowDeferred(uint32_t addr, uint32_t length);
+
+// API version cache shared by the synchronous and asynchronous query, 0 if not fetched yet. Dropped on the last
+// deinit. Safe to call from the IPC completion context.
+uint32_t getCachedAPIVersion();
+void cacheAPIVersion(uint32_t version);
+
+// Drops the cached minute/plugin paths. Safe to call from the IPC completion context.
+void invalidatePathCaches();
+// Forgets every mapping recorded by Stroopwafel_MapMemoryBatch.
+void resetMapIndex();
+
+// Asynchronous counterparts of the internal IPC helpers. The callback is invoked from the IPC completion
+// context and receives the raw IOS result. Every buffer has to stay valid until the callback has been called.
+StroopwafelStatus doStroopwafelIPCAsync(uint32_t command, void *buffer_in, uint32_t length_in, void *buffer_io, uint32_t length_io, IOSAsyncCallbackFn callback, void *context);
+StroopwafelStatus doStroopwafelIPCVAsync(uint32_t command, uint32_t num_in, uint32_t num_io, IOSVec *vector, IOSAsyncCallbackFn callback, void *context);
@@ -0,0 +1,305 @@
+#include "ipc_buffer_pool.h"
+#include "logger.h"
+#include "os_mutex.h"
+#include "stroopwafel/commands.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel/stroopwafel.hpp"
+#include "stroopwafel_ipc.h"
+#include "stroopwafel_stats.h"
+#include <algorithm>
+#include <coreinit/ios.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/time.h>
+#include <cstring>
+#include <malloc.h>
+#include <mutex>
+#include <stdint.h>
+
+namespace {
+    constexpr uint32_t MAX_MAPS_IN_FLIGHT = 8;
+
+    // Sorted, non-overlapping list of everything that has been mapped through Stroopwafel_MapMemoryBatch.
+    // IOS may be reloaded while the library is not initialized, so the index is dropped on the last deinit.
+    StroopwafelMapMemory *sMapped = nullptr;
+    uint32_t sNumMapped           = 0;
+    uint32_t sMappedCapacity      = 0;
+    // Serializes whole map operations, so two threads can't map the same range at the same time.
+    // Held across the IPC, so it has to be a mutex that puts waiting threads to sleep.
+    Mutex sMapLock;
+
+    uint64_t regionEnd(const StroopwafelMapMemory &region) {
+        return (uint64_t) region.vaddr + region.size;
+    }
+
+    bool sameAttributes(const StroopwafelMapMemory &a, const StroopwafelMapMemory &b) {
+        return a.domain == b.domain && a.type == b.type && a.cached == b.cached;
+    }
+
+    // Same attributes and the same vaddr -> paddr translation, so overlapping parts map to the same memory.
+    bool isCompatible(const StroopwafelMapMemory &a, const StroopwafelMapMemory &b) {
+        return sameAttributes(a, b) && a.vaddr - a.paddr == b.vaddr - b.paddr;
+    }
+
+    // Merges b into a if they are compatible and overlap or touch.
+    bool tryMerge(StroopwafelMapMemory &a, const StroopwafelMapMemory &b) {
+        if (!isCompatible(a, b) || b.vaddr > regionEnd(a) || a.vaddr > regionEnd(b)) {
+            return false;
+        }
+        uint64_t end = std::max(regionEnd(a), regionEnd(b));
+        if (b.vaddr < a.vaddr) {
+            a.vaddr = b.vaddr;
+            a.paddr = b.paddr;
+        }
+        a.size = (uint32_t) (end - a.vaddr);
+        return true;
+    }
+
+    // Index of the first mapped region that ends after vaddr.
+    uint32_t findFirstMapped(uint32_t vaddr) {
+        auto *it = std::upper_bound(sMapped, sMapped + sNumMapped, vaddr, [](uint32_t value, const StroopwafelMapMemory &region) {
+            return value < regionEnd(region);
+        });
+        return it - sMapped;
+    }
+
+    bool addMapped(const StroopwafelMapMemory &region) {
+        uint32_t pos = findFirstMapped(region.vaddr);
+        // Merge with the neighbours instead of adding a new entry where possible.
+        if (pos > 0 && tryMerge(sMapped[pos - 1], region)) {
+            pos--;
+        } else if (pos == sNumMapped || !tryMerge(sMapped[pos], region)) {
+            if (sNumMapped == sMappedCapacity) {
+                uint32_t capacity = sMappedCapacity ? sMappedCapacity * 2 : 16;
+                auto *mapped      = (StroopwafelMapMemory *) realloc(sMapped, capacity * sizeof(StroopwafelMapMemory));
+                if (!mapped) {
+                    return false;
+                }
+                sMapped         = mapped;
+                sMappedCapacity = capacity;
+            }
+            memmove(&sMapped[pos + 1], &sMapped[pos], (sNumMapped - pos) * sizeof(StroopwafelMapMemory));
+            sMapped[pos] = region;
+            sNumMapped++;
+        }
+        while (pos + 1 < sNumMapped && tryMerge(sMapped[pos], sMapped[pos + 1])) {
+            memmove(&sMapped[pos + 1], &sMapped[pos + 2], (sNumMapped - pos - 2) * sizeof(StroopwafelMapMemory));
+            sNumMapped--;
+        }
+        return true;
+    }
+
+    // Splits region into the parts that are not mapped yet. Returns false if it conflicts with an existing mapping.
+    bool subtractMapped(const StroopwafelMapMemory &region, StroopwafelMapMemory *outPieces, uint32_t *numPieces) {
+        uint64_t cursor = region.vaddr;
+        uint64_t end    = regionEnd(region);
+        for (uint32_t i = findFirstMapped(region.vaddr); i < sNumMapped && sMapped[i].vaddr < end; i++) {
+            if (!isCompatible(sMapped[i], region)) {
+                DEBUG_FUNCTION_LINE_ERR("Mapping 0x%08X-0x%08X conflicts with existing mapping 0x%08X-0x%08X", region.vaddr, (uint32_t) (end - 1), sMapped[i].vaddr, (uint32_t) (regionEnd(sMapped[i]) - 1));
+                return false;
+            }
+            if (sMapped[i].vaddr > cursor) {
+                auto &piece = outPieces[(*numPieces)++];
+                piece       = region;
+                piece.vaddr = (uint32_t) cursor;
+                piece.paddr = region.paddr + (uint32_t) (cursor - region.vaddr);
+                piece.size  = sMapped[i].vaddr - (uint32_t) cursor;
+            }
+            cursor = std::max(cursor, regionEnd(sMapped[i]));
+        }
+        if (cursor < end) {
+            auto &piece = outPieces[(*numPieces)++];
+            piece       = region;
+            piece.vaddr = (uint32_t) cursor;
+            piece.paddr = region.paddr + (uint32_t) (cursor - region.vaddr);
+            piece.size  = (uint32_t) (end - cursor);
+        }
+        return true;
+    }
+
+    // Drops every entry that overlaps [vaddr, end) as a whole.
+    void removeMapped(uint32_t vaddr, uint64_t end) {
+        uint32_t first = findFirstMapped(vaddr);
+        uint32_t last  = first;
+        while (last < sNumMapped && sMapped[last].vaddr < end) {
+            last++;
+        }
+        memmove(&sMapped[first], &sMapped[last], (sNumMapped - last) * sizeof(StroopwafelMapMemory));
+        sNumMapped -= last - first;
+    }
+
+    struct MapRequest {
+        OSMessageQueue *queue;
+        // Cache line of the IPC input and index of the piece it holds.
+        StroopwafelMapMemory *info;
+        uint32_t piece;
+        IOSError result;
+        OSTime startTime;
+    };
+
+    void mapCallback(IOSError res, void *context) {
+        auto *request   = (MapRequest *) context;
+        request->result = res;
+        if (request->startTime) {
+            recordIPCStats(STROOPWAFEL_IOCTL_MAP_MEMORY, request->startTime, sizeof(StroopwafelMapMemory), 0, res < 0);
+        }
+
+        OSMessage message;
+        message.message = request;
+        OSSendMessage(request->queue, &message, OS_MESSAGE_FLAGS_NONE);
+    }
+
+    // Keeps up to MAX_MAPS_IN_FLIGHT pieces queued in IOS and records the successful ones in the index.
+    StroopwafelStatus submitPieces(const StroopwafelMapMemory *pieces, uint32_t num_pieces) {
+        // Every request in flight gets its own cache line, IOS needs the input 0x40 aligned.
+        IPCBuffer buffer;
+        if (!buffer.acquire(MAX_MAPS_IN_FLIGHT * 0x40)) {
+            return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+        }
+
+        MapRequest requests[MAX_MAPS_IN_FLIGHT];
+        MapRequest *freeRequests[MAX_MAPS_IN_FLIGHT];
+        uint32_t numFree = MAX_MAPS_IN_FLIGHT;
+        OSMessage messages[MAX_MAPS_IN_FLIGHT];
+        OSMessageQueue queue;
+        OSInitMessageQueue(&queue, messages, MAX_MAPS_IN_FLIGHT);
+        for (uint32_t i = 0; i < MAX_MAPS_IN_FLIGHT; i++) {
+            requests[i].queue = &queue;
+            requests[i].info  = (StroopwafelMapMemory *) (buffer.as<uint8_t>() + i * 0x40);
+            freeRequests[i]   = &requests[i];
+        }
+
+        // A failed mapping doesn't stop the others, a request that can't be submitted does.
+        bool stats                     = isStatsEnabled();
+        StroopwafelStatus status       = STROOPWAFEL_RESULT_SUCCESS;
+        StroopwafelStatus submitStatus = STROOPWAFEL_RESULT_SUCCESS;
+        uint32_t submitted             = 0;
+        while (numFree < MAX_MAPS_IN_FLIGHT || (submitted < num_pieces && submitStatus == STROOPWAFEL_RESULT_SUCCESS)) {
+            if (submitted < num_pieces && submitStatus == STROOPWAFEL_RESULT_SUCCESS && numFree > 0) {
+                auto *request = freeRequests[--numFree];
+                memcpy(request->info, &pieces[submitted], sizeof(StroopwafelMapMemory));
+                request->piece     = submitted++;
+                request->result    = IOS_ERROR_OK;
+                request->startTime = stats ? OSGetSystemTime() : 0;
+                submitStatus       = doStroopwafelIPCAsync(STROOPWAFEL_IOCTL_MAP_MEMORY, request->info, sizeof(StroopwafelMapMemory), nullptr, 0, mapCallback, request);
+                if (submitStatus != STROOPWAFEL_RESULT_SUCCESS) {
+                    freeRequests[numFree++] = request;
+                }
+                continue;
+            }
+
+            OSMessage message;
+            OSReceiveMessage(&queue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+            auto *request           = (MapRequest *) message.message;
+            freeRequests[numFree++] = request;
+
+            const auto &piece = pieces[request->piece];
+            invalidateWriteShadow(piece.vaddr, piece.size);
+            if (request->result < 0) {
+                DEBUG_FUNCTION_LINE_ERR("Failed to map 0x%08X (size 0x%X): %d", piece.vaddr, piece.size, request->result);
+                status = STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+            } else if (!addMapped(piece)) {
+                DEBUG_FUNCTION_LINE_WARN("Failed to track mapping 0x%08X", piece.vaddr);
+            }
+        }
+        return submitStatus != STROOPWAFEL_RESULT_SUCCESS ? submitStatus : status;
+    }
+} // namespace
+
+StroopwafelStatus Stroopwafel_MapMemoryBatch(uint32_t num_regions, const StroopwafelMapMemory *regions) {
+    if (num_regions == 0 || !regions) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    for (uint32_t i = 0; i < num_regions; i++) {
+        if (regions[i].size == 0 || regionEnd(regions[i]) > 0x100000000ULL || (uint64_t) regions[i].paddr + regions[i].size > 0x100000000ULL) {
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+    }
+
+    auto *merged = (StroopwafelMapMemory *) malloc(num_regions * sizeof(StroopwafelMapMemory));
+    if (!merged) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    memcpy(merged, regions, num_regions * sizeof(StroopwafelMapMemory));
+    std::sort(merged, merged + num_regions, [](const StroopwafelMapMemory &a, const StroopwafelMapMemory &b) {
+        return a.vaddr < b.vaddr;
+    });
+
+    // Merge touching/overlapping compatible regions of the request, overlaps that map differently are an error.
+    uint32_t num_merged = 0;
+    for (uint32_t i = 0; i < num_regions; i++) {
+        if (num_merged > 0) {
+            auto &last = merged[num_merged - 1];
+            if (tryMerge(last, merged[i])) {
+                continue;
+            }
+            if (merged[i].vaddr < regionEnd(last)) {
+                DEBUG_FUNCTION_LINE_ERR("Requested mappings 0x%08X and 0x%08X overlap with different attributes", last.vaddr, merged[i].vaddr);
+                free(merged);
+                return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+            }
+        }
+        merged[num_merged++] = merged[i];
+    }
+
+    std::lock_guard<Mutex> lock(sMapLock);
+
+    // Every existing mapping can split a region into one more piece.
+    auto *pieces = (StroopwafelMapMemory *) malloc((num_merged + sNumMapped) * sizeof(StroopwafelMapMemory));
+    if (!pieces) {
+        free(merged);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t num_pieces = 0;
+    for (uint32_t i = 0; i < num_merged; i++) {
+        if (!subtractMapped(merged[i], pieces, &num_pieces)) {
+            free(merged);
+            free(pieces);
+            return STROOPWAFEL_RESULT_ALREADY_EXISTS;
+        }
+    }
+    free(merged);
+
+    // Whatever was written to these addresses before may not be what they map to now.
+    for (uint32_t i = 0; i < num_pieces; i++) {
+        invalidateWriteShadow(pieces[i].vaddr, pieces[i].size);
+    }
+
+    StroopwafelStatus status = num_pieces > 0 ? submitPieces(pieces, num_pieces) : STROOPWAFEL_RESULT_SUCCESS;
+    free(pieces);
+    return status;
+}
+
+StroopwafelStatus Stroopwafel_MapMemory(const StroopwafelMapMemory *info) {
+    if (!info) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    invalidateWriteShadow(info->vaddr, info->size);
+    StroopwafelStatus status = stroopwafel::call<STROOPWAFEL_IOCTL_MAP_MEMORY>(*info);
+    // A write may have tracked the range again while the request was in flight.
+    invalidateWriteShadow(info->vaddr, info->size);
+    return status;
+}
+
+StroopwafelStatus Stroopwafel_InvalidateMapIndex(uint32_t vaddr, uint32_t size) {
+    if (size != 0 && (uint64_t) vaddr + size > 0x100000000ULL) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    std::lock_guard<Mutex> lock(sMapLock);
+    if (size == 0) {
+        sNumMapped = 0;
+    } else {
+        removeMapped(vaddr, (uint64_t) vaddr + size);
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+void resetMapIndex() {
+    std::lock_guard<Mutex> lock(sMapLock);
+    free(sMapped);
+    sMapped         = nullptr;
+    sNumMapped      = 0;
+    sMappedCapacity = 0;
+}
@@ -0,0 +1,284 @@
+#include "stroopwafel/patchset.h"
+#include "logger.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel_ipc.h"
+#include <cstdio>
+#include <cstring>
+#include <malloc.h>
+#include <stdint.h>
+
+namespace {
+    constexpr uint32_t HEADER_SIZE = 0x20;
+    constexpr uint32_t ENTRY_SIZE  = 0x10;
+
+    static_assert(sizeof(StroopwafelPatchSetHeader) == HEADER_SIZE);
+    static_assert(sizeof(StroopwafelPatchSetEntry) == ENTRY_SIZE);
+
+    uint32_t readBE32(const uint8_t *p) {
+        return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+    }
+
+    uint16_t readBE16(const uint8_t *p) {
+        return (uint16_t) ((p[0] << 8) | p[1]);
+    }
+
+    void writeBE32(uint8_t *p, uint32_t value) {
+        p[0] = value >> 24;
+        p[1] = value >> 16;
+        p[2] = value >> 8;
+        p[3] = value;
+    }
+
+    void writeBE16(uint8_t *p, uint16_t value) {
+        p[0] = value >> 8;
+        p[1] = value;
+    }
+
+    struct Entry {
+        uint32_t dest_addr;
+        uint32_t length;
+        const uint8_t *src;
+    };
+
+    Entry readEntry(const StroopwafelPatchSet *set, uint32_t index) {
+        const uint8_t *p = set->index + index * ENTRY_SIZE;
+        return {readBE32(p), readBE32(p + 4), set->payload + readBE32(p + 8)};
+    }
+} // namespace
+
+StroopwafelStatus Stroopwafel_OpenPatchSet(const void *data, uint32_t size, StroopwafelPatchSet *outSet) {
+    if (!data || !outSet || size < HEADER_SIZE) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *bytes = (const uint8_t *) data;
+    if (readBE32(bytes) != STROOPWAFEL_PATCHSET_MAGIC) {
+        DEBUG_FUNCTION_LINE_ERR("Invalid patch set magic");
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    if (readBE16(bytes + 4) != STROOPWAFEL_PATCHSET_VERSION) {
+        DEBUG_FUNCTION_LINE_ERR("Unsupported patch set version %d", readBE16(bytes + 4));
+        return STROOPWAFEL_RESULT_UNSUPPORTED_API_VERSION;
+    }
+
+    uint32_t header_size    = readBE16(bytes + 6);
+    uint32_t num_entries    = readBE32(bytes + 8);
+    uint32_t index_offset   = readBE32(bytes + 12);
+    uint32_t payload_offset = readBE32(bytes + 16);
+    uint32_t payload_size   = readBE32(bytes + 20);
+    if (header_size < HEADER_SIZE || header_size > size ||
+        (uint64_t) index_offset + (uint64_t) num_entries * ENTRY_SIZE > size ||
+        (uint64_t) payload_offset + payload_size > size) {
+        DEBUG_FUNCTION_LINE_ERR("Patch set is truncated or has invalid offsets");
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    StroopwafelPatchSet set;
+    set.data         = bytes;
+    set.size         = size;
+    set.num_entries  = num_entries;
+    set.index        = bytes + index_offset;
+    set.payload      = bytes + payload_offset;
+    set.payload_size = payload_size;
+    set.owned_buffer = nullptr;
+
+    uint32_t prev_addr = 0;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        const uint8_t *p       = set.index + i * ENTRY_SIZE;
+        uint32_t dest_addr     = readBE32(p);
+        uint32_t length        = readBE32(p + 4);
+        uint32_t entry_payload = readBE32(p + 8);
+        if (dest_addr < prev_addr ||
+            (uint64_t) dest_addr + length > 0x100000000ULL ||
+            (uint64_t) entry_payload + length > payload_size) {
+            DEBUG_FUNCTION_LINE_ERR("Invalid patch set entry %d", i);
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        prev_addr = dest_addr;
+    }
+
+    *outSet = set;
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_LoadPatchSet(const char *path, StroopwafelPatchSet *outSet) {
+    if (!path || !outSet) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to open %s", path);
+        return STROOPWAFEL_RESULT_NOT_FOUND;
+    }
+
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+    }
+    if (size < 0 || size > 0x7FFFFFFF || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return STROOPWAFEL_RESULT_NOT_FOUND;
+    }
+
+    // Aligned so single entries can be sent to IOS directly.
+    void *buffer = memalign(0x40, size > 0 ? size : 1);
+    if (!buffer) {
+        fclose(file);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    size_t read = fread(buffer, 1, size, file);
+    fclose(file);
+    if (read != (size_t) size) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to read %s", path);
+        free(buffer);
+        return STROOPWAFEL_RESULT_NOT_FOUND;
+    }
+
+    StroopwafelStatus status = Stroopwafel_OpenPatchSet(buffer, (uint32_t) size, outSet);
+    if (status != STROOPWAFEL_RESULT_SUCCESS) {
+        free(buffer);
+        return status;
+    }
+    outSet->owned_buffer = buffer;
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+void Stroopwafel_ClosePatchSet(StroopwafelPatchSet *set) {
+    if (!set) {
+        return;
+    }
+    free(set->owned_buffer);
+    memset(set, 0, sizeof(*set));
+}
+
+StroopwafelStatus Stroopwafel_GetPatchSetEntry(const StroopwafelPatchSet *set, uint32_t index, StroopwafelWrite *outWrite) {
+    if (!set || !outWrite || index >= set->num_entries) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    Entry entry         = readEntry(set, index);
+    outWrite->dest_addr = entry.dest_addr;
+    outWrite->src       = entry.src;
+    outWrite->length    = entry.length;
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_ApplyPatchSet(const StroopwafelPatchSet *set) {
+    if (!set || !set->data) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    if (set->num_entries == 0) {
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
+
+    auto *writes = (StroopwafelWrite *) malloc(set->num_entries * sizeof(StroopwafelWrite));
+    auto *order  = (uint32_t *) malloc(set->num_entries * sizeof(uint32_t));
+    auto *runs   = (WriteRun *) malloc(set->num_entries * sizeof(WriteRun));
+    if (!writes || !order || !runs) {
+        free(writes);
+        free(order);
+        free(runs);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t num_order = 0;
+    for (uint32_t i = 0; i < set->num_entries; i++) {
+        Entry entry = readEntry(set, i);
+        if (entry.length == 0) {
+            continue;
+        }
+        writes[num_order] = {entry.dest_addr, entry.src, entry.length};
+        order[num_order]  = num_order;
+        num_order++;
+    }
+
+    // The index is sorted by address, so it only has to be merged.
+    uint32_t num_runs        = mergeWriteRuns(writes, order, num_order, runs);
+    StroopwafelStatus status = STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    if (num_order == 0 || num_runs > 0) {
+        status = writeRuns(writes, order, runs, num_runs);
+    }
+    if (status != STROOPWAFEL_RESULT_SUCCESS) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to apply patch set: %s", Stroopwafel_GetStatusStr(status));
+    }
+
+    free(writes);
+    free(order);
+    free(runs);
+    return status;
+}
+
+StroopwafelStatus Stroopwafel_SerializePatchSet(uint32_t num_writes, const StroopwafelWrite *writes, void *outBuffer, uint32_t bufferSize, uint32_t *outSize) {
+    if (!outSize || (num_writes > 0 && !writes)) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *order = (uint32_t *) malloc((num_writes > 0 ? num_writes : 1) * sizeof(uint32_t));
+    auto *runs  = (WriteRun *) malloc((num_writes > 0 ? num_writes : 1) * sizeof(WriteRun));
+    if (!order || !runs) {
+        free(order);
+        free(runs);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t num_order = 0;
+    for (uint32_t i = 0; i < num_writes; i++) {
+        if (writes[i].length == 0) {
+            continue;
+        }
+        if (!writes[i].src || (uint64_t) writes[i].dest_addr + writes[i].length > 0x100000000ULL) {
+            free(order);
+            free(runs);
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        order[num_order++] = i;
+    }
+
+    // Overlaps are resolved here, so the stored entries are disjoint and already merged.
+    uint32_t num_runs       = buildWriteRuns(writes, order, num_order, runs);
+    if (num_order > 0 && num_runs == 0) {
+        free(order);
+        free(runs);
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    uint64_t payload_offset = ROUNDUP(HEADER_SIZE + (uint64_t) num_runs * ENTRY_SIZE, 0x40);
+    uint64_t payload_size   = 0;
+    for (uint32_t i = 0; i < num_runs; i++) {
+        payload_size += ROUNDUP((uint64_t) runs[i].length, 0x40);
+    }
+
+    StroopwafelStatus status = STROOPWAFEL_RESULT_SUCCESS;
+    uint64_t total_size      = payload_offset + payload_size;
+    if (total_size > 0xFFFFFFFF || (outBuffer && bufferSize < total_size)) {
+        status = STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    } else {
+        *outSize = (uint32_t) total_size;
+    }
+
+    if (status == STROOPWAFEL_RESULT_SUCCESS && outBuffer) {
+        auto *out = (uint8_t *) outBuffer;
+        memset(out, 0, (size_t) total_size);
+        writeBE32(out, STROOPWAFEL_PATCHSET_MAGIC);
+        writeBE16(out + 4, STROOPWAFEL_PATCHSET_VERSION);
+        writeBE16(out + 6, HEADER_SIZE);
+        writeBE32(out + 8, num_runs);
+        writeBE32(out + 12, HEADER_SIZE);
+        writeBE32(out + 16, (uint32_t) payload_offset);
+        writeBE32(out + 20, (uint32_t) payload_size);
+
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < num_runs; i++) {
+            uint8_t *entry = out + HEADER_SIZE + i * ENTRY_SIZE;
+            writeBE32(entry, runs[i].dest_addr);
+            writeBE32(entry + 4, runs[i].length);
+            writeBE32(entry + 8, offset);
+            stageWriteRun(runs[i], writes, order, out + payload_offset + offset);
+            offset += ROUNDUP(runs[i].length, 0x40);
+        }
+    }
+
+    free(order);
+    free(runs);
+    return status;
+}
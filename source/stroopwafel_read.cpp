@@ -0,0 +1,234 @@
+#include "ipc_buffer_pool.h"
+#include "logger.h"
+#include "stroopwafel/commands.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel_ipc.h"
+#include "stroopwafel_stats.h"
+#include <algorithm>
+#include <coreinit/ios.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/time.h>
+#include <cstring>
+#include <malloc.h>
+#include <stdint.h>
+
+namespace {
+    // Marks runs that are read straight into the caller's buffer.
+    constexpr uint32_t NOT_STAGED            = 0xFFFFFFFF;
+    constexpr uint32_t MAX_BATCHES_IN_FLIGHT = 8;
+
+    // Range of merged reads, every member is copied out of it once the data has arrived.
+    struct ReadRun {
+        uint32_t src_addr;
+        uint32_t length;
+        // Range of the run's members in the sorted index array.
+        uint32_t first;
+        uint32_t count;
+        uint32_t staging_offset;
+    };
+
+    struct ReadBatch {
+        OSMessageQueue *queue;
+        IOSError result;
+        OSTime startTime;
+        // Range of the batch in the run array.
+        uint32_t first_run;
+        uint32_t num_runs;
+        // Cache line of the source addresses, owned by the batch for the whole call.
+        uint32_t *src_addrs;
+        IPCBuffer staging;
+        IOSVec vectors[MAX_READS_PER_IPC + 1];
+    };
+
+    void readCallback(IOSError res, void *context) {
+        auto *batch   = (ReadBatch *) context;
+        batch->result = res;
+        if (batch->startTime) {
+            recordIPCStats(STROOPWAFEL_IOCTLV_READ_MEMORY, batch->startTime, batch->vectors[0].len, res >= 0 ? sumVectorLength(batch->vectors + 1, batch->num_runs) : 0, res < 0);
+        }
+
+        OSMessage message;
+        message.message = batch;
+        OSSendMessage(batch->queue, &message, OS_MESSAGE_FLAGS_NONE);
+    }
+
+    // Sorts order (indices into reads, zero length reads already removed) by address and merges
+    // adjacent/overlapping reads into runs. runs must be able to hold num_order entries.
+    uint32_t buildReadRuns(const StroopwafelRead *reads, uint32_t *order, uint32_t num_order, ReadRun *runs) {
+        std::sort(order, order + num_order, [reads](uint32_t a, uint32_t b) {
+            return reads[a].src_addr < reads[b].src_addr;
+        });
+
+        uint32_t num_runs = 0;
+        uint64_t run_end  = 0;
+        for (uint32_t i = 0; i < num_order; i++) {
+            const auto &read = reads[order[i]];
+            uint64_t end     = (uint64_t) read.src_addr + read.length;
+            if (num_runs > 0 && read.src_addr <= run_end && end - runs[num_runs - 1].src_addr <= 0xFFFFFFFF) {
+                auto &run = runs[num_runs - 1];
+                if (end > run_end) {
+                    run_end    = end;
+                    run.length = (uint32_t) (run_end - run.src_addr);
+                }
+                run.count++;
+                continue;
+            }
+            auto &run    = runs[num_runs++];
+            run.src_addr = read.src_addr;
+            run.length   = read.length;
+            run.first    = i;
+            run.count    = 1;
+            run_end      = end;
+        }
+        return num_runs;
+    }
+
+    bool isDirectRun(const ReadRun &run, const StroopwafelRead *reads, const uint32_t *order) {
+        return run.count == 1 && isIPCAligned(reads[order[run.first]].dest, run.length);
+    }
+
+    // Fills the vectors of the batch's runs, every staged run starts at its own 0x40 aligned offset of the batch's staging buffer.
+    StroopwafelStatus submitBatch(ReadBatch &batch, const StroopwafelRead *reads, const uint32_t *order, ReadRun *runs, bool stats) {
+        uint64_t staging_size = 0;
+        for (uint32_t i = batch.first_run; i < batch.first_run + batch.num_runs; i++) {
+            runs[i].staging_offset = NOT_STAGED;
+            if (!isDirectRun(runs[i], reads, order)) {
+                runs[i].staging_offset = (uint32_t) staging_size;
+                staging_size += ROUNDUP((uint64_t) runs[i].length, 0x40);
+            }
+        }
+        if (staging_size >= NOT_STAGED || (staging_size > 0 && !batch.staging.acquire((uint32_t) staging_size))) {
+            return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+        }
+
+        for (uint32_t i = 0; i < batch.num_runs; i++) {
+            const auto &run          = runs[batch.first_run + i];
+            batch.src_addrs[i]       = run.src_addr;
+            batch.vectors[i + 1].len = run.length;
+            if (run.staging_offset == NOT_STAGED) {
+                batch.vectors[i + 1].vaddr = reads[order[run.first]].dest;
+            } else {
+                batch.vectors[i + 1].vaddr = batch.staging.as<uint8_t>() + run.staging_offset;
+            }
+        }
+        batch.vectors[0].vaddr = batch.src_addrs;
+        batch.vectors[0].len   = batch.num_runs * sizeof(uint32_t);
+        batch.result           = IOS_ERROR_OK;
+        batch.startTime        = stats ? OSGetSystemTime() : 0;
+
+        StroopwafelStatus status = doStroopwafelIPCVAsync(STROOPWAFEL_IOCTLV_READ_MEMORY, 1, batch.num_runs, batch.vectors, readCallback, &batch);
+        if (status != STROOPWAFEL_RESULT_SUCCESS) {
+            batch.staging.release();
+        }
+        return status;
+    }
+
+    // Copies the staged runs of a successful batch to their members and frees the staging buffer for the next batch.
+    StroopwafelStatus completeBatch(ReadBatch &batch, const StroopwafelRead *reads, const uint32_t *order, const ReadRun *runs, uint32_t num_batches) {
+        StroopwafelStatus status = STROOPWAFEL_RESULT_SUCCESS;
+        if (batch.result < 0) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to read batch %d of %d: %d", batch.first_run / MAX_READS_PER_IPC, num_batches, batch.result);
+            status = STROOPWAFEL_RESULT_UNKNOWN_ERROR;
+        } else {
+            for (uint32_t i = batch.first_run; i < batch.first_run + batch.num_runs; i++) {
+                const auto &run = runs[i];
+                if (run.staging_offset == NOT_STAGED) {
+                    continue;
+                }
+                auto *staging = batch.staging.as<uint8_t>() + run.staging_offset;
+                for (uint32_t j = run.first; j < run.first + run.count; j++) {
+                    const auto &read = reads[order[j]];
+                    memcpy(read.dest, staging + (read.src_addr - run.src_addr), read.length);
+                }
+            }
+        }
+        batch.staging.release();
+        return status;
+    }
+} // namespace
+
+StroopwafelStatus Stroopwafel_ReadMemory(uint32_t num_reads, const StroopwafelRead *reads) {
+    if (num_reads == 0 || !reads) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *order = (uint32_t *) malloc(num_reads * sizeof(uint32_t));
+    auto *runs  = (ReadRun *) malloc(num_reads * sizeof(ReadRun));
+    if (!order || !runs) {
+        free(order);
+        free(runs);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t num_order = 0;
+    for (uint32_t i = 0; i < num_reads; i++) {
+        if (reads[i].length == 0) {
+            continue;
+        }
+        if (!reads[i].dest || (uint64_t) reads[i].src_addr + reads[i].length > 0x100000000ULL) {
+            free(order);
+            free(runs);
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        order[num_order++] = i;
+    }
+    if (num_order == 0) {
+        free(order);
+        free(runs);
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
+
+    uint32_t num_runs    = buildReadRuns(reads, order, num_order, runs);
+    uint32_t num_batches = (num_runs + MAX_READS_PER_IPC - 1) / MAX_READS_PER_IPC;
+
+    // Every batch in flight gets its own cache line for the source addresses and is reused for the next batch.
+    IPCBuffer addr_buffer;
+    if (!addr_buffer.acquire(MAX_BATCHES_IN_FLIGHT * 0x40)) {
+        free(order);
+        free(runs);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    ReadBatch batches[MAX_BATCHES_IN_FLIGHT];
+    ReadBatch *freeBatches[MAX_BATCHES_IN_FLIGHT];
+    uint32_t numFree = MAX_BATCHES_IN_FLIGHT;
+    OSMessage messages[MAX_BATCHES_IN_FLIGHT];
+    OSMessageQueue queue;
+    OSInitMessageQueue(&queue, messages, MAX_BATCHES_IN_FLIGHT);
+    for (uint32_t i = 0; i < MAX_BATCHES_IN_FLIGHT; i++) {
+        batches[i].queue     = &queue;
+        batches[i].src_addrs = (uint32_t *) (addr_buffer.as<uint8_t>() + i * 0x40);
+        freeBatches[i]       = &batches[i];
+    }
+
+    // Keep up to MAX_BATCHES_IN_FLIGHT batches queued in IOS, stop submitting after the first error.
+    bool stats               = isStatsEnabled();
+    StroopwafelStatus status = STROOPWAFEL_RESULT_SUCCESS;
+    uint32_t submitted       = 0;
+    while (numFree < MAX_BATCHES_IN_FLIGHT || (submitted < num_batches && status == STROOPWAFEL_RESULT_SUCCESS)) {
+        if (submitted < num_batches && status == STROOPWAFEL_RESULT_SUCCESS && numFree > 0) {
+            auto *batch      = freeBatches[--numFree];
+            batch->first_run = submitted * MAX_READS_PER_IPC;
+            batch->num_runs  = std::min(num_runs - batch->first_run, MAX_READS_PER_IPC);
+            submitted++;
+            status = submitBatch(*batch, reads, order, runs, stats);
+            if (status != STROOPWAFEL_RESULT_SUCCESS) {
+                freeBatches[numFree++] = batch;
+            }
+            continue;
+        }
+
+        OSMessage message;
+        OSReceiveMessage(&queue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+        auto *batch            = (ReadBatch *) message.message;
+        freeBatches[numFree++] = batch;
+        StroopwafelStatus res  = completeBatch(*batch, reads, order, runs, num_batches);
+        if (res != STROOPWAFEL_RESULT_SUCCESS && status == STROOPWAFEL_RESULT_SUCCESS) {
+            status = res;
+        }
+    }
+
+    free(order);
+    free(runs);
+    return status;
+}
@@ -0,0 +1,101 @@
+#include "stroopwafel_stats.h"
+#include "stroopwafel/stroopwafel.h"
+#include <atomic>
+#include <coreinit/atomic64.h>
+#include <coreinit/time.h>
+#include <cstring>
+#include <stdint.h>
+
+std::atomic<bool> gStroopwafelStatsEnabled{false};
+
+namespace {
+    // All counters are updated lock-free. 64 bit values go through the coreinit helpers as Espresso has no native 64 bit atomics.
+    struct CommandStats {
+        std::atomic<uint32_t> calls;
+        std::atomic<uint32_t> errors;
+        std::atomic<uint32_t> maxLatency;
+        std::atomic<uint32_t> histogram[STROOPWAFEL_STATS_LATENCY_BUCKETS];
+        int64_t bytesIn;
+        int64_t bytesOut;
+        int64_t totalLatency;
+    };
+
+    CommandStats sCommandStats[STROOPWAFEL_STATS_MAX_COMMANDS];
+
+    uint32_t latencyBucket(uint32_t latency) {
+        if (latency == 0) {
+            return 0;
+        }
+        uint32_t bucket = 32 - __builtin_clz(latency);
+        return bucket < STROOPWAFEL_STATS_LATENCY_BUCKETS ? bucket : STROOPWAFEL_STATS_LATENCY_BUCKETS - 1;
+    }
+} // namespace
+
+void recordIPCStats(uint32_t command, OSTime startTime, uint32_t bytesIn, uint32_t bytesOut, bool failed) {
+    if (command >= STROOPWAFEL_STATS_MAX_COMMANDS) {
+        return;
+    }
+
+    OSTime elapsed   = OSGetSystemTime() - startTime;
+    uint32_t latency = elapsed > 0 ? (uint32_t) OSTicksToMicroseconds(elapsed) : 0;
+    auto &stats      = sCommandStats[command];
+
+    stats.calls.fetch_add(1, std::memory_order_relaxed);
+    if (failed) {
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    stats.histogram[latencyBucket(latency)].fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t maxLatency = stats.maxLatency.load(std::memory_order_relaxed);
+    while (latency > maxLatency && !stats.maxLatency.compare_exchange_weak(maxLatency, latency, std::memory_order_relaxed)) {}
+
+    OSAddAtomic64(&stats.bytesIn, bytesIn);
+    OSAddAtomic64(&stats.bytesOut, bytesOut);
+    OSAddAtomic64(&stats.totalLatency, latency);
+}
+
+uint32_t sumVectorLength(const IOSVec *vector, uint32_t count) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += vector[i].len;
+    }
+    return sum;
+}
+
+StroopwafelStatus Stroopwafel_SetStatsEnabled(bool enabled) {
+    gStroopwafelStatsEnabled.store(enabled, std::memory_order_relaxed);
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_GetStats(uint32_t command, StroopwafelCommandStats *out) {
+    if (!out || command >= STROOPWAFEL_STATS_MAX_COMMANDS) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto &stats           = sCommandStats[command];
+    out->calls            = stats.calls.load(std::memory_order_relaxed);
+    out->errors           = stats.errors.load(std::memory_order_relaxed);
+    out->bytes_in         = OSGetAtomic64((uint64_t *) &stats.bytesIn);
+    out->bytes_out        = OSGetAtomic64((uint64_t *) &stats.bytesOut);
+    out->total_latency_us = OSGetAtomic64((uint64_t *) &stats.totalLatency);
+    out->max_latency_us   = stats.maxLatency.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < STROOPWAFEL_STATS_LATENCY_BUCKETS; i++) {
+        out->latency_histogram[i] = stats.histogram[i].load(std::memory_order_relaxed);
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_ResetStats() {
+    for (auto &stats : sCommandStats) {
+        stats.calls.store(0, std::memory_order_relaxed);
+        stats.errors.store(0, std::memory_order_relaxed);
+        stats.maxLatency.store(0, std::memory_order_relaxed);
+        for (auto &bucket : stats.histogram) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        OSSetAtomic64((uint64_t *) &stats.bytesIn, 0);
+        OSSetAtomic64((uint64_t *) &stats.bytesOut, 0);
+        OSSetAtomic64((uint64_t *) &stats.totalLatency, 0);
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
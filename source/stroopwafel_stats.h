@@ -0,0 +1,17 @@
+#pragma once
+#include <atomic>
+#include <coreinit/ios.h>
+#include <coreinit/time.h>
+#include <stdint.h>
+
+extern std::atomic<bool> gStroopwafelStatsEnabled;
+
+inline bool isStatsEnabled() {
+    return gStroopwafelStatsEnabled.load(std::memory_order_relaxed);
+}
+
+// Only call if isStatsEnabled() returned true when startTime was taken.
+void recordIPCStats(uint32_t command, OSTime startTime, uint32_t bytesIn, uint32_t bytesOut, bool failed);
+
+// Helpers to count the bytes of an ioctlv.
+uint32_t sumVectorLength(const IOSVec *vector, uint32_t count);
@@ -0,0 +1,276 @@
+#include "stroopwafel_trace.h"
+#include "logger.h"
+#include "spin_lock.h"
+#include "stroopwafel/trace.h"
+#include <algorithm>
+#include <atomic>
+#include <coreinit/core.h>
+#include <coreinit/time.h>
+#include <cstdio>
+#include <cstring>
+#include <malloc.h>
+#include <mutex>
+#include <stdint.h>
+
+std::atomic<bool> gStroopwafelTraceEnabled{false};
+
+namespace {
+    constexpr uint32_t HEADER_SIZE       = 0x20;
+    constexpr uint32_t RECORD_SIZE       = 0x20;
+    constexpr uint32_t MIN_BUFFER_SIZE   = 0x1000;
+    constexpr uint32_t MAX_TRACE_VECTORS = 0x10;
+
+    static_assert(sizeof(StroopwafelTraceHeader) == HEADER_SIZE);
+    static_assert(sizeof(StroopwafelTraceRecord) == RECORD_SIZE);
+
+    // Records are kept serialized, so flushing is a plain copy.
+    struct TraceRing {
+        uint8_t *data;
+        uint32_t size;
+        uint32_t flags;
+        // Oldest record and the position where the next one is written.
+        uint32_t tail;
+        uint32_t head;
+        uint32_t used;
+        uint32_t numRecords;
+        uint32_t dropped;
+        OSTime startTime;
+    };
+
+    SpinLock sTraceLock;
+    TraceRing *sTrace = nullptr;
+
+    void writeBE32(uint8_t *p, uint32_t value) {
+        p[0] = value >> 24;
+        p[1] = value >> 16;
+        p[2] = value >> 8;
+        p[3] = value;
+    }
+
+    void writeBE16(uint8_t *p, uint16_t value) {
+        p[0] = value >> 8;
+        p[1] = value;
+    }
+
+    void writeBE64(uint8_t *p, uint64_t value) {
+        writeBE32(p, value >> 32);
+        writeBE32(p + 4, (uint32_t) value);
+    }
+
+    uint32_t padded(uint32_t length) {
+        return (length + 3) & ~3u;
+    }
+
+    void ringWrite(TraceRing *ring, const void *data, uint32_t length) {
+        uint32_t first = std::min(length, ring->size - ring->head);
+        memcpy(ring->data + ring->head, data, first);
+        memcpy(ring->data, (const uint8_t *) data + first, length - first);
+        ring->head = (ring->head + length) % ring->size;
+    }
+
+    void ringSkip(TraceRing *ring, uint32_t length) {
+        uint32_t first = std::min(length, ring->size - ring->head);
+        memset(ring->data + ring->head, 0, first);
+        memset(ring->data, 0, length - first);
+        ring->head = (ring->head + length) % ring->size;
+    }
+
+    void ringRead(const TraceRing *ring, uint32_t pos, void *out, uint32_t length) {
+        uint32_t first = std::min(length, ring->size - pos);
+        memcpy(out, ring->data + pos, first);
+        memcpy((uint8_t *) out + first, ring->data, length - first);
+    }
+
+    // Drops the oldest records until length bytes are free.
+    void makeRoom(TraceRing *ring, uint32_t length) {
+        while (ring->size - ring->used < length) {
+            uint8_t sizeBytes[4];
+            ringRead(ring, ring->tail, sizeBytes, sizeof(sizeBytes));
+            uint32_t recordSize = ((uint32_t) sizeBytes[0] << 24) | ((uint32_t) sizeBytes[1] << 16) | ((uint32_t) sizeBytes[2] << 8) | sizeBytes[3];
+            ring->tail          = (ring->tail + recordSize) % ring->size;
+            ring->used -= recordSize;
+            ring->numRecords--;
+            ring->dropped++;
+        }
+    }
+
+    bool isBigEndianHost() {
+        return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+    }
+} // namespace
+
+void recordIPCTrace(uint32_t command, bool vectored, bool async, uint32_t numIn, uint32_t numIo, const IOSVec *vectors, OSTime startTime, int32_t result) {
+    OSTime now = OSGetSystemTime();
+
+    std::lock_guard<SpinLock> lock(sTraceLock);
+    auto *ring = sTrace;
+    if (!ring) {
+        return;
+    }
+    if (numIn + numIo > MAX_TRACE_VECTORS) {
+        // Doesn't fit the record format, counted so the trace doesn't look complete.
+        ring->dropped++;
+        return;
+    }
+
+    uint32_t lengthsSize = (numIn + numIo) * sizeof(uint32_t);
+    uint32_t payloadSize = 0;
+    for (uint32_t i = 0; i < numIn; i++) {
+        payloadSize += padded(vectors[i].len);
+    }
+    bool withPayload = (ring->flags & STROOPWAFEL_TRACE_FLAG_PAYLOADS) && payloadSize <= ring->size / 8;
+    uint32_t size    = RECORD_SIZE + lengthsSize + (withPayload ? payloadSize : 0);
+
+    uint8_t flags = 0;
+    if (vectored) {
+        flags |= STROOPWAFEL_TRACE_RECORD_IOCTLV;
+    }
+    if (async) {
+        flags |= STROOPWAFEL_TRACE_RECORD_ASYNC;
+    }
+    if (withPayload) {
+        flags |= STROOPWAFEL_TRACE_RECORD_PAYLOAD;
+    }
+
+    uint8_t header[RECORD_SIZE + MAX_TRACE_VECTORS * sizeof(uint32_t)] = {};
+    writeBE32(header, size);
+    writeBE64(header + 8, startTime > ring->startTime ? OSTicksToMicroseconds(startTime - ring->startTime) : 0);
+    writeBE32(header + 16, async ? 0 : (uint32_t) OSTicksToMicroseconds(now - startTime));
+    writeBE32(header + 20, (uint32_t) result);
+    header[24] = (uint8_t) command;
+    header[25] = flags;
+    header[26] = (uint8_t) numIn;
+    header[27] = (uint8_t) numIo;
+    header[28] = (uint8_t) OSGetCoreId();
+    for (uint32_t i = 0; i < numIn + numIo; i++) {
+        writeBE32(header + RECORD_SIZE + i * sizeof(uint32_t), vectors[i].len);
+    }
+
+    makeRoom(ring, size);
+    ringWrite(ring, header, RECORD_SIZE + lengthsSize);
+    if (withPayload) {
+        for (uint32_t i = 0; i < numIn; i++) {
+            ringWrite(ring, vectors[i].vaddr, vectors[i].len);
+            ringSkip(ring, padded(vectors[i].len) - vectors[i].len);
+        }
+    }
+    ring->used += size;
+    ring->numRecords++;
+}
+
+StroopwafelStatus Stroopwafel_StartTrace(uint32_t buffer_size, uint32_t flags) {
+    if (buffer_size < MIN_BUFFER_SIZE || (flags & ~STROOPWAFEL_TRACE_FLAG_PAYLOADS) != 0) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *ring = (TraceRing *) malloc(sizeof(TraceRing));
+    auto *data = (uint8_t *) malloc(buffer_size);
+    if (!ring || !data) {
+        free(ring);
+        free(data);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->data      = data;
+    ring->size      = buffer_size;
+    ring->flags     = flags;
+    ring->startTime = OSGetSystemTime();
+
+    TraceRing *old;
+    {
+        std::lock_guard<SpinLock> lock(sTraceLock);
+        old    = sTrace;
+        sTrace = ring;
+        gStroopwafelTraceEnabled.store(true, std::memory_order_relaxed);
+    }
+    if (old) {
+        free(old->data);
+        free(old);
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_StopTrace() {
+    TraceRing *old;
+    {
+        std::lock_guard<SpinLock> lock(sTraceLock);
+        old    = sTrace;
+        sTrace = nullptr;
+        gStroopwafelTraceEnabled.store(false, std::memory_order_relaxed);
+    }
+    if (old) {
+        free(old->data);
+        free(old);
+    }
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_FlushTrace(const char *path) {
+    if (!path) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    // Take the records out of the ring, the file is written without holding the lock.
+    uint8_t *records  = nullptr;
+    uint32_t capacity = 0;
+    uint32_t used, numRecords, dropped, flags;
+    while (true) {
+        uint32_t needed;
+        {
+            std::lock_guard<SpinLock> lock(sTraceLock);
+            auto *ring = sTrace;
+            if (!ring) {
+                free(records);
+                return STROOPWAFEL_RESULT_NOT_FOUND;
+            }
+            needed = ring->used;
+            if (records && needed <= capacity) {
+                ringRead(ring, ring->tail, records, ring->used);
+                used             = ring->used;
+                numRecords       = ring->numRecords;
+                dropped          = ring->dropped;
+                flags            = ring->flags;
+                ring->tail       = ring->head;
+                ring->used       = 0;
+                ring->numRecords = 0;
+                ring->dropped    = 0;
+                break;
+            }
+        }
+        // Allocated outside of the lock, repeated if more records arrived in the meantime.
+        free(records);
+        capacity = std::max(needed, 1u);
+        records  = (uint8_t *) malloc(capacity);
+        if (!records) {
+            return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+        }
+    }
+
+    if (isBigEndianHost()) {
+        flags |= STROOPWAFEL_TRACE_FLAG_BIG_ENDIAN;
+    }
+    uint8_t header[HEADER_SIZE] = {};
+    writeBE32(header, STROOPWAFEL_TRACE_MAGIC);
+    writeBE16(header + 4, STROOPWAFEL_TRACE_VERSION);
+    writeBE16(header + 6, HEADER_SIZE);
+    writeBE32(header + 8, flags);
+    writeBE32(header + 12, numRecords);
+    writeBE32(header + 16, dropped);
+
+    StroopwafelStatus status = STROOPWAFEL_RESULT_SUCCESS;
+    FILE *file               = fopen(path, "wb");
+    if (!file) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to open %s", path);
+        status = STROOPWAFEL_RESULT_NOT_FOUND;
+    } else {
+        if (fwrite(header, 1, HEADER_SIZE, file) != HEADER_SIZE || fwrite(records, 1, used, file) != used) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to write %s", path);
+            status = STROOPWAFEL_RESULT_NOT_FOUND;
+        }
+        if (fclose(file) != 0) {
+            status = STROOPWAFEL_RESULT_NOT_FOUND;
+        }
+    }
+    free(records);
+    return status;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <atomic>
+#include <coreinit/ios.h>
+#include <coreinit/time.h>
+#include <stdint.h>
+
+extern std::atomic<bool> gStroopwafelTraceEnabled;
+
+inline bool isTraceEnabled() {
+    return gStroopwafelTraceEnabled.load(std::memory_order_relaxed);
+}
+
+// Only call if isTraceEnabled() returned true when startTime was taken. An ioctl is passed as one input and one
+// output vector. Asynchronous calls are recorded on submission.
+void recordIPCTrace(uint32_t command, bool vectored, bool async, uint32_t numIn, uint32_t numIo, const IOSVec *vectors, OSTime startTime, int32_t result);
@@ -0,0 +1,377 @@
+#include "checksum.h"
+#include "logger.h"
+#include "stroopwafel/commands.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel_ipc.h"
+#include "stroopwafel_stats.h"
+#include <algorithm>
+#include <coreinit/ios.h>
+#include <coreinit/messagequeue.h>
+#include <coreinit/time.h>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+namespace {
+    constexpr uint32_t DEFAULT_CHUNK_SIZE   = 0x10000;
+    constexpr uint32_t DEFAULT_NUM_BUFFERS  = 2;
+    constexpr uint32_t MAX_UPLOAD_BUFFERS   = 8;
+    constexpr uint32_t DEFAULT_FILE_ALIGN   = 0x40;
+    constexpr uint32_t MAX_UPLOAD_PATH_SIZE = 0x200;
+
+    struct UploadChunk {
+        OSMessageQueue *queue;
+        // 0x40 bytes for the destination address, the data follows.
+        uint8_t *buffer;
+        uint32_t dest_addr;
+        uint32_t length;
+        uint32_t crc;
+        // Index of the file within the upload, errors are reported for the first file that failed.
+        uint32_t file;
+        bool inFlight;
+        IOSError result;
+        OSTime startTime;
+        IOSVec vectors[2];
+    };
+
+    // A written chunk that still has to be read back. The chunk buffer itself can be reused in the meantime.
+    struct PendingVerify {
+        uint32_t dest_addr;
+        uint32_t length;
+        uint32_t crc;
+        uint32_t file;
+    };
+
+    // Buffers are allocated once and reused for every file of a directory. Chunks stay in flight across file
+    // boundaries, finishUpload waits for all of them.
+    struct Uploader {
+        uint32_t chunkSize;
+        uint32_t numBuffers;
+        bool verify;
+        uint8_t *buffers;
+        // One chunk per pending verification, they are read back with a single ReadMemory.
+        uint8_t *verifyBuffers;
+        UploadChunk chunks[MAX_UPLOAD_BUFFERS];
+        OSMessage messages[MAX_UPLOAD_BUFFERS];
+        OSMessageQueue queue;
+        uint32_t nextChunk;
+        uint32_t inFlight;
+        PendingVerify pending[MAX_UPLOAD_BUFFERS];
+        uint32_t numPending;
+        // First error by file order, failedFile is the index of that file.
+        StroopwafelStatus status;
+        uint32_t failedFile;
+    };
+
+    void uploadCallback(IOSError res, void *context) {
+        auto *chunk   = (UploadChunk *) context;
+        chunk->result = res;
+        if (chunk->startTime) {
+            recordIPCStats(STROOPWAFEL_IOCTLV_WRITE_MEMORY, chunk->startTime, sumVectorLength(chunk->vectors, 2), 0, res < 0);
+        }
+
+        OSMessage message;
+        message.message = chunk;
+        OSSendMessage(chunk->queue, &message, OS_MESSAGE_FLAGS_NONE);
+    }
+
+    StroopwafelStatus initUploader(Uploader *up, const StroopwafelUploadOptions *options) {
+        memset(up, 0, sizeof(*up));
+        up->chunkSize  = options && options->chunk_size ? options->chunk_size : DEFAULT_CHUNK_SIZE;
+        up->numBuffers = options && options->num_buffers ? options->num_buffers : DEFAULT_NUM_BUFFERS;
+        up->verify     = options && (options->flags & STROOPWAFEL_UPLOAD_FLAG_VERIFY);
+        if ((up->chunkSize & 0x3F) != 0 || up->numBuffers < 2 || up->numBuffers > MAX_UPLOAD_BUFFERS ||
+            (options && (options->flags & ~STROOPWAFEL_UPLOAD_FLAG_VERIFY) != 0)) {
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        if (up->verify) {
+            uint32_t capabilities = 0;
+            StroopwafelStatus res = Stroopwafel_GetCapabilities(&capabilities);
+            if (res != STROOPWAFEL_RESULT_SUCCESS) {
+                return res;
+            }
+            if (!(capabilities & STROOPWAFEL_CAPABILITY(STROOPWAFEL_IOCTLV_READ_MEMORY))) {
+                return STROOPWAFEL_RESULT_UNSUPPORTED_COMMAND;
+            }
+        }
+
+        up->buffers       = (uint8_t *) memalign(0x40, up->numBuffers * (0x40 + up->chunkSize));
+        up->verifyBuffers = up->verify ? (uint8_t *) memalign(0x40, up->numBuffers * up->chunkSize) : nullptr;
+        if (!up->buffers || (up->verify && !up->verifyBuffers)) {
+            free(up->buffers);
+            free(up->verifyBuffers);
+            return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+        }
+        OSInitMessageQueue(&up->queue, up->messages, (int32_t) up->numBuffers);
+        for (uint32_t i = 0; i < up->numBuffers; i++) {
+            up->chunks[i].queue  = &up->queue;
+            up->chunks[i].buffer = up->buffers + i * (0x40 + up->chunkSize);
+        }
+        up->status = STROOPWAFEL_RESULT_SUCCESS;
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
+
+    void freeUploader(Uploader *up) {
+        free(up->buffers);
+        free(up->verifyBuffers);
+    }
+
+    // Chunks complete out of file order, so the error of the earliest file wins.
+    void failFile(Uploader *up, uint32_t file, StroopwafelStatus res) {
+        if (up->status == STROOPWAFEL_RESULT_SUCCESS || file < up->failedFile) {
+            up->status     = res;
+            up->failedFile = file;
+        }
+    }
+
+    StroopwafelStatus submitChunk(UploadChunk *chunk) {
+        *(uint32_t *) chunk->buffer = chunk->dest_addr;
+        chunk->vectors[0].vaddr     = chunk->buffer;
+        chunk->vectors[0].len       = sizeof(uint32_t);
+        chunk->vectors[1].vaddr     = chunk->buffer + 0x40;
+        chunk->vectors[1].len       = chunk->length;
+        chunk->result               = IOS_ERROR_OK;
+        chunk->startTime            = isStatsEnabled() ? OSGetSystemTime() : 0;
+
+        StroopwafelStatus res = doStroopwafelIPCVAsync(STROOPWAFEL_IOCTLV_WRITE_MEMORY, 2, 0, chunk->vectors, uploadCallback, chunk);
+        chunk->inFlight       = res == STROOPWAFEL_RESULT_SUCCESS;
+        return res;
+    }
+
+    // Reads every pending chunk back with one request and compares the CRCs.
+    void verifyPending(Uploader *up) {
+        if (up->numPending == 0) {
+            return;
+        }
+        StroopwafelRead reads[MAX_UPLOAD_BUFFERS];
+        uint32_t firstFile = up->pending[0].file;
+        for (uint32_t i = 0; i < up->numPending; i++) {
+            reads[i]  = {up->pending[i].dest_addr, up->verifyBuffers + i * up->chunkSize, up->pending[i].length};
+            firstFile = std::min(firstFile, up->pending[i].file);
+        }
+        StroopwafelStatus res = Stroopwafel_ReadMemory(up->numPending, reads);
+        if (res != STROOPWAFEL_RESULT_SUCCESS) {
+            failFile(up, firstFile, res);
+        } else {
+            for (uint32_t i = 0; i < up->numPending; i++) {
+                const auto &pending = up->pending[i];
+                if (crc32Update(0, up->verifyBuffers + i * up->chunkSize, pending.length) != pending.crc) {
+                    DEBUG_FUNCTION_LINE_ERR("Verification of %08X-%08X failed", pending.dest_addr, pending.dest_addr + pending.length - 1);
+                    failFile(up, pending.file, STROOPWAFEL_RESULT_UNKNOWN_ERROR);
+                }
+            }
+        }
+        up->numPending = 0;
+    }
+
+    // Waits for one submitted chunk. Its verification is queued, the chunk can be reused right away.
+    void completeChunk(Uploader *up) {
+        OSMessage message;
+        OSReceiveMessage(&up->queue, &message, OS_MESSAGE_FLAGS_BLOCKING);
+        auto *chunk     = (UploadChunk *) message.message;
+        chunk->inFlight = false;
+        up->inFlight--;
+        // A synchronous write may have tracked the range again while the chunk was in flight.
+        invalidateWriteShadow(chunk->dest_addr, chunk->length);
+        if (chunk->result < 0) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to write %08X-%08X: %d", chunk->dest_addr, chunk->dest_addr + chunk->length - 1, chunk->result);
+            failFile(up, chunk->file, STROOPWAFEL_RESULT_UNKNOWN_ERROR);
+            return;
+        }
+        if (up->verify) {
+            up->pending[up->numPending++] = {chunk->dest_addr, chunk->length, chunk->crc, chunk->file};
+            if (up->numPending == up->numBuffers) {
+                verifyPending(up);
+            }
+        }
+    }
+
+    // Waits for every chunk and verifies the rest. Returns the first error by file order.
+    StroopwafelStatus finishUpload(Uploader *up) {
+        while (up->inFlight > 0) {
+            completeChunk(up);
+        }
+        verifyPending(up);
+        return up->status;
+    }
+
+    const char *fileName(const char *path) {
+        const char *slash = strrchr(path, '/');
+        return slash ? slash + 1 : path;
+    }
+
+    // Submits every chunk of the file without waiting for the last ones, see finishUpload. outFile is always filled,
+    // it's only valid if no chunk of the file fails.
+    StroopwafelStatus uploadFile(Uploader *up, const char *path, uint32_t dest_addr, uint32_t fileIndex, StroopwafelUploadedFile *outFile) {
+        FILE *file = fopen(path, "rb");
+        if (!file) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to open %s", path);
+            failFile(up, fileIndex, STROOPWAFEL_RESULT_NOT_FOUND);
+            return STROOPWAFEL_RESULT_NOT_FOUND;
+        }
+
+        long size = -1;
+        if (fseek(file, 0, SEEK_END) == 0) {
+            size = ftell(file);
+        }
+        if (size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+            fclose(file);
+            failFile(up, fileIndex, STROOPWAFEL_RESULT_NOT_FOUND);
+            return STROOPWAFEL_RESULT_NOT_FOUND;
+        }
+        if ((uint64_t) dest_addr + (uint64_t) size > 0x100000000ULL) {
+            fclose(file);
+            failFile(up, fileIndex, STROOPWAFEL_RESULT_INVALID_ARGUMENT);
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        // The writes bypass the shadow.
+        invalidateWriteShadow(dest_addr, (uint32_t) size);
+
+        // The chunk that is read next is always the oldest one, so reading it overlaps with the writes of the others.
+        StroopwafelStatus status = STROOPWAFEL_RESULT_SUCCESS;
+        uint32_t crc             = 0;
+        uint32_t offset          = 0;
+        while (offset < (uint32_t) size) {
+            auto *chunk = &up->chunks[up->nextChunk];
+            while (chunk->inFlight) {
+                completeChunk(up);
+            }
+            if (up->status != STROOPWAFEL_RESULT_SUCCESS) {
+                status = up->status;
+                break;
+            }
+
+            chunk->dest_addr = dest_addr + offset;
+            chunk->length    = std::min(up->chunkSize, (uint32_t) size - offset);
+            chunk->file      = fileIndex;
+            if (fread(chunk->buffer + 0x40, 1, chunk->length, file) != chunk->length) {
+                DEBUG_FUNCTION_LINE_ERR("Failed to read %s", path);
+                status = STROOPWAFEL_RESULT_NOT_FOUND;
+                failFile(up, fileIndex, status);
+                break;
+            }
+            chunk->crc = crc32Update(0, chunk->buffer + 0x40, chunk->length);
+            crc        = crc32Update(crc, chunk->buffer + 0x40, chunk->length);
+
+            status = submitChunk(chunk);
+            if (status != STROOPWAFEL_RESULT_SUCCESS) {
+                failFile(up, fileIndex, status);
+                break;
+            }
+            up->nextChunk = (up->nextChunk + 1) % up->numBuffers;
+            up->inFlight++;
+            offset += chunk->length;
+        }
+        fclose(file);
+
+        snprintf(outFile->name, sizeof(outFile->name), "%s", fileName(path));
+        outFile->dest_addr = dest_addr;
+        outFile->size      = (uint32_t) size;
+        outFile->crc32     = crc;
+        return status;
+    }
+
+    bool hasSuffix(const char *name, const char *suffix) {
+        size_t nameLen   = strlen(name);
+        size_t suffixLen = strlen(suffix);
+        return nameLen >= suffixLen && strcasecmp(name + nameLen - suffixLen, suffix) == 0;
+    }
+} // namespace
+
+StroopwafelStatus Stroopwafel_UploadFile(const char *path, uint32_t dest_addr) {
+    return Stroopwafel_UploadFileEx(path, dest_addr, nullptr, nullptr);
+}
+
+StroopwafelStatus Stroopwafel_UploadFileEx(const char *path, uint32_t dest_addr, const StroopwafelUploadOptions *options, StroopwafelUploadedFile *outFile) {
+    if (!path) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    Uploader up;
+    StroopwafelStatus status = initUploader(&up, options);
+    if (status != STROOPWAFEL_RESULT_SUCCESS) {
+        return status;
+    }
+    StroopwafelUploadedFile uploaded;
+    uploadFile(&up, path, dest_addr, 0, &uploaded);
+    status = finishUpload(&up);
+    freeUploader(&up);
+    if (status == STROOPWAFEL_RESULT_SUCCESS && outFile) {
+        *outFile = uploaded;
+    }
+    return status;
+}
+
+StroopwafelStatus Stroopwafel_UploadDirectory(const char *dir_path, const char *suffix, uint32_t dest_addr, uint32_t alignment, const StroopwafelUploadOptions *options,
+                                              StroopwafelUploadedFile *outFiles, uint32_t max_files, uint32_t *outNumFiles) {
+    if (!dir_path || !outNumFiles || (max_files > 0 && !outFiles) || (alignment & (alignment - 1)) != 0) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    if (alignment == 0) {
+        alignment = DEFAULT_FILE_ALIGN;
+    }
+    *outNumFiles = 0;
+
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        DEBUG_FUNCTION_LINE_ERR("Failed to open %s", dir_path);
+        return STROOPWAFEL_RESULT_NOT_FOUND;
+    }
+
+    // Collect the names first, the files are uploaded in name order.
+    char path[MAX_UPLOAD_PATH_SIZE];
+    uint32_t numFiles = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] == '.' || (suffix && !hasSuffix(entry->d_name, suffix))) {
+            continue;
+        }
+        struct stat st;
+        if (snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name) >= (int) sizeof(path) || stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (numFiles < max_files) {
+            snprintf(outFiles[numFiles].name, sizeof(outFiles[numFiles].name), "%s", entry->d_name);
+        }
+        numFiles++;
+    }
+    closedir(dir);
+
+    if (numFiles > max_files) {
+        *outNumFiles = numFiles;
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    std::sort(outFiles, outFiles + numFiles, [](const StroopwafelUploadedFile &a, const StroopwafelUploadedFile &b) {
+        return strcmp(a.name, b.name) < 0;
+    });
+
+    Uploader up;
+    StroopwafelStatus status = initUploader(&up, options);
+    if (status != STROOPWAFEL_RESULT_SUCCESS) {
+        return status;
+    }
+    uint64_t addr = dest_addr;
+    for (uint32_t i = 0; i < numFiles; i++) {
+        // The first file goes exactly to dest_addr, only the following ones are aligned.
+        if (i > 0) {
+            addr = ROUNDUP(addr, (uint64_t) alignment);
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir_path, outFiles[i].name);
+        if (addr > 0xFFFFFFFF) {
+            failFile(&up, i, STROOPWAFEL_RESULT_INVALID_ARGUMENT);
+            break;
+        }
+        if (uploadFile(&up, path, (uint32_t) addr, i, &outFiles[i]) != STROOPWAFEL_RESULT_SUCCESS) {
+            break;
+        }
+        addr += outFiles[i].size;
+    }
+    // The chunks of the last files are still in flight, a failure may belong to any file submitted so far.
+    status       = finishUpload(&up);
+    *outNumFiles = status == STROOPWAFEL_RESULT_SUCCESS ? numFiles : up.failedFile;
+    freeUploader(&up);
+    return status;
+}
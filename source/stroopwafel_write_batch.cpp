@@ -0,0 +1,154 @@
+#include "ipc_buffer_pool.h"
+#include "logger.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel_ipc.h"
+#include <algorithm>
+#include <cstring>
+#include <malloc.h>
+#include <stdint.h>
+
+namespace {
+    // Single writes with an aligned source (or too large to be worth copying) are passed to IOS as they are.
+    constexpr uint32_t STAGING_DIRECT_THRESHOLD = 0x10000;
+
+    bool isDirectRun(const WriteRun &run, const StroopwafelWrite *writes, const uint32_t *order) {
+        if (run.count != 1) {
+            return false;
+        }
+        return isIPCAligned(writes[order[run.first]].src) || run.length >= STAGING_DIRECT_THRESHOLD;
+    }
+} // namespace
+
+uint32_t buildWriteRuns(const StroopwafelWrite *writes, uint32_t *order, uint32_t num_order, WriteRun *runs) {
+    std::sort(order, order + num_order, [writes](uint32_t a, uint32_t b) {
+        if (writes[a].dest_addr != writes[b].dest_addr) {
+            return writes[a].dest_addr < writes[b].dest_addr;
+        }
+        return a < b;
+    });
+    return mergeWriteRuns(writes, order, num_order, runs);
+}
+
+uint32_t mergeWriteRuns(const StroopwafelWrite *writes, const uint32_t *order, uint32_t num_order, WriteRun *runs) {
+    uint32_t num_runs = 0;
+    uint64_t run_end  = 0;
+    for (uint32_t i = 0; i < num_order; i++) {
+        const auto &write = writes[order[i]];
+        uint64_t end      = (uint64_t) write.dest_addr + write.length;
+        if (num_runs > 0 && (write.dest_addr < run_end || (write.dest_addr == run_end && end - runs[num_runs - 1].dest_addr <= MAX_MERGED_WRITE_BYTES))) {
+            // Overlapping or small and adjacent, extend the current run.
+            auto &run = runs[num_runs - 1];
+            if (end - run.dest_addr > 0xFFFFFFFF) {
+                return 0;
+            }
+            if (end > run_end) {
+                run_end    = end;
+                run.length = (uint32_t) (run_end - run.dest_addr);
+            }
+            run.count++;
+            continue;
+        }
+        auto &run     = runs[num_runs++];
+        run.dest_addr = write.dest_addr;
+        run.length    = write.length;
+        run.first     = i;
+        run.count     = 1;
+        run_end       = end;
+    }
+    return num_runs;
+}
+
+void stageWriteRun(const WriteRun &run, const StroopwafelWrite *writes, uint32_t *order, uint8_t *staging) {
+    // Apply the members in their original order so later entries win on overlaps.
+    if (run.count > 1) {
+        std::sort(order + run.first, order + run.first + run.count);
+    }
+    for (uint32_t i = run.first; i < run.first + run.count; i++) {
+        const auto &write = writes[order[i]];
+        memcpy(staging + (write.dest_addr - run.dest_addr), write.src, write.length);
+    }
+}
+
+StroopwafelStatus writeRuns(const StroopwafelWrite *writes, uint32_t *order, const WriteRun *runs, uint32_t num_runs) {
+    StroopwafelStatus status = STROOPWAFEL_RESULT_SUCCESS;
+    IPCBuffer staging_buffer;
+    uint32_t staging_size = 0;
+
+    for (uint32_t batch = 0; batch < num_runs && status == STROOPWAFEL_RESULT_SUCCESS; batch += MAX_WRITES_PER_IPC) {
+        uint32_t batch_runs = std::min(num_runs - batch, MAX_WRITES_PER_IPC);
+
+        // Every staged run starts at its own 0x40 aligned offset of the shared staging buffer.
+        uint64_t needed = 0;
+        for (uint32_t i = batch; i < batch + batch_runs; i++) {
+            if (!isDirectRun(runs[i], writes, order)) {
+                needed += ROUNDUP((uint64_t) runs[i].length, 0x40);
+            }
+        }
+        if (needed > staging_size) {
+            if (needed > 0xFFFFFFFF || !staging_buffer.acquire((uint32_t) needed)) {
+                status = STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+                break;
+            }
+            staging_size = (uint32_t) needed;
+        }
+        auto *staging = staging_buffer.as<uint8_t>();
+
+        StroopwafelWrite batch_writes[MAX_WRITES_PER_IPC];
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < batch_runs; i++) {
+            const auto &run           = runs[batch + i];
+            batch_writes[i].dest_addr = run.dest_addr;
+            batch_writes[i].length    = run.length;
+            if (isDirectRun(run, writes, order)) {
+                batch_writes[i].src = writes[order[run.first]].src;
+                continue;
+            }
+            stageWriteRun(run, writes, order, staging + offset);
+            batch_writes[i].src = staging + offset;
+            offset += ROUNDUP(run.length, 0x40);
+        }
+
+        status = Stroopwafel_WriteMemory(batch_runs, batch_writes);
+        if (status != STROOPWAFEL_RESULT_SUCCESS) {
+            DEBUG_FUNCTION_LINE_ERR("Failed to write batch %d of %d: %s", batch / MAX_WRITES_PER_IPC, (num_runs + MAX_WRITES_PER_IPC - 1) / MAX_WRITES_PER_IPC, Stroopwafel_GetStatusStr(status));
+        }
+    }
+    return status;
+}
+
+StroopwafelStatus Stroopwafel_WriteMemoryBatch(uint32_t num_writes, const StroopwafelWrite *writes) {
+    if (num_writes == 0 || !writes) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+
+    auto *order = (uint32_t *) malloc(num_writes * sizeof(uint32_t));
+    auto *runs  = (WriteRun *) malloc(num_writes * sizeof(WriteRun));
+    if (!order || !runs) {
+        free(order);
+        free(runs);
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+
+    uint32_t num_order = 0;
+    for (uint32_t i = 0; i < num_writes; i++) {
+        if (writes[i].length == 0) {
+            continue;
+        }
+        if (!writes[i].src || (uint64_t) writes[i].dest_addr + writes[i].length > 0x100000000ULL) {
+            free(order);
+            free(runs);
+            return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+        }
+        order[num_order++] = i;
+    }
+
+    uint32_t num_runs        = buildWriteRuns(writes, order, num_order, runs);
+    StroopwafelStatus status = STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    if (num_order == 0 || num_runs > 0) {
+        status = writeRuns(writes, order, runs, num_runs);
+    }
+
+    free(order);
+    free(runs);
+    return status;
+}
@@ -0,0 +1,413 @@
+#include "logger.h"
+#include "os_mutex.h"
+#include "stroopwafel/stroopwafel.h"
+#include "stroopwafel_ipc.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <malloc.h>
+#include <mutex>
+#include <stdint.h>
+
+namespace {
+    // Granularity of the change detection, partially changed ranges are only written in whole blocks.
+    constexpr uint32_t SHADOW_BLOCK_SIZE = 0x20;
+
+    struct ShadowRange {
+        uint32_t addr;
+        uint32_t length;
+        // One hash per SHADOW_BLOCK_SIZE bytes, counted from addr.
+        uint64_t *hashes;
+    };
+
+    struct WriteShadow {
+        uint32_t maxTrackedBytes;
+        uint32_t trackedBytes;
+        // Sorted by address, never overlapping.
+        ShadowRange *ranges;
+        uint32_t numRanges;
+        uint32_t capacity;
+        StroopwafelWriteShadowStats stats;
+    };
+
+    // Held for a whole write including the IPC, so the shadow matches the order in which the writes reached IOS.
+    // A mutex, as other writers block for a whole IOS round trip.
+    Mutex sShadowLock;
+    WriteShadow *sShadow = nullptr;
+    // Lets writes skip the lock entirely while the shadow is disabled.
+    std::atomic<bool> sShadowEnabled{false};
+
+    // Invalidations from the IPC completion context, which can't wait for sShadowLock. They are applied by the next
+    // operation that holds the lock. If all slots are taken, the whole shadow is dropped instead.
+    constexpr uint32_t MAX_DEFERRED_INVALIDATIONS = 32;
+
+    enum DeferredState : uint32_t {
+        DEFERRED_FREE,
+        DEFERRED_WRITING,
+        DEFERRED_READY,
+    };
+
+    struct DeferredInvalidation {
+        std::atomic<uint32_t> state;
+        uint32_t addr;
+        uint32_t length;
+    };
+
+    DeferredInvalidation sDeferred[MAX_DEFERRED_INVALIDATIONS];
+    // Ready slots plus one for a pending overflow, lets the lock holder skip the scan.
+    std::atomic<uint32_t> sNumDeferred{0};
+    std::atomic<bool> sDeferredOverflow{false};
+
+    uint32_t numBlocks(uint32_t length) {
+        return (uint32_t) (((uint64_t) length + SHADOW_BLOCK_SIZE - 1) / SHADOW_BLOCK_SIZE);
+    }
+
+    uint64_t rangeEnd(uint32_t addr, uint32_t length) {
+        return (uint64_t) addr + length;
+    }
+
+    // 64 bit so a collision, which would drop a write, is practically impossible.
+    uint64_t hashBlock(const uint8_t *data, uint32_t len) {
+        uint64_t hash = 0x9E3779B97F4A7C15ULL ^ len;
+        while (len > 0) {
+            uint64_t value = 0;
+            uint32_t chunk = len < sizeof(value) ? len : sizeof(value);
+            memcpy(&value, data, chunk);
+            hash = (hash ^ value) * 0xFF51AFD7ED558CCDULL;
+            hash ^= hash >> 32;
+            data += chunk;
+            len -= chunk;
+        }
+        return hash;
+    }
+
+    void hashBlocks(const StroopwafelWrite &write, uint64_t *outHashes) {
+        auto *src = (const uint8_t *) write.src;
+        for (uint32_t offset = 0, i = 0; offset < write.length; offset += SHADOW_BLOCK_SIZE, i++) {
+            outHashes[i] = hashBlock(src + offset, std::min(SHADOW_BLOCK_SIZE, write.length - offset));
+        }
+    }
+
+    // Index of the first range that ends after addr.
+    uint32_t findFirstRange(const WriteShadow *shadow, uint32_t addr) {
+        uint32_t low = 0, high = shadow->numRanges;
+        while (low < high) {
+            uint32_t mid = (low + high) / 2;
+            if (rangeEnd(shadow->ranges[mid].addr, shadow->ranges[mid].length) <= addr) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+    ShadowRange *findExactRange(WriteShadow *shadow, uint32_t addr, uint32_t length) {
+        uint32_t index = findFirstRange(shadow, addr);
+        if (index < shadow->numRanges && shadow->ranges[index].addr == addr && shadow->ranges[index].length == length) {
+            return &shadow->ranges[index];
+        }
+        return nullptr;
+    }
+
+    // Drops every range that overlaps [addr, addr + length), returns the index where such a range would be inserted.
+    uint32_t removeOverlapping(WriteShadow *shadow, uint32_t addr, uint64_t length) {
+        uint32_t first = findFirstRange(shadow, addr);
+        uint32_t last  = first;
+        while (last < shadow->numRanges && shadow->ranges[last].addr < addr + length) {
+            shadow->trackedBytes -= shadow->ranges[last].length;
+            free(shadow->ranges[last].hashes);
+            last++;
+        }
+        if (last != first) {
+            memmove(&shadow->ranges[first], &shadow->ranges[last], (shadow->numRanges - last) * sizeof(ShadowRange));
+            shadow->numRanges -= last - first;
+        }
+        return first;
+    }
+
+    // Records the content of a successful write. Ranges that don't fit the budget are simply not tracked.
+    void trackWrite(WriteShadow *shadow, const StroopwafelWrite &write, const uint64_t *hashes) {
+        uint32_t hashesSize = numBlocks(write.length) * sizeof(uint64_t);
+        auto *range         = findExactRange(shadow, write.dest_addr, write.length);
+        if (range) {
+            memcpy(range->hashes, hashes, hashesSize);
+            return;
+        }
+
+        uint32_t pos = removeOverlapping(shadow, write.dest_addr, write.length);
+        if (shadow->trackedBytes + (uint64_t) write.length > shadow->maxTrackedBytes) {
+            return;
+        }
+        if (shadow->numRanges == shadow->capacity) {
+            uint32_t capacity = shadow->capacity ? shadow->capacity * 2 : 64;
+            auto *ranges      = (ShadowRange *) realloc(shadow->ranges, capacity * sizeof(ShadowRange));
+            if (!ranges) {
+                return;
+            }
+            shadow->ranges   = ranges;
+            shadow->capacity = capacity;
+        }
+        auto *copy = (uint64_t *) malloc(hashesSize);
+        if (!copy) {
+            return;
+        }
+        memcpy(copy, hashes, hashesSize);
+        memmove(&shadow->ranges[pos + 1], &shadow->ranges[pos], (shadow->numRanges - pos) * sizeof(ShadowRange));
+        shadow->ranges[pos] = {write.dest_addr, write.length, copy};
+        shadow->numRanges++;
+        shadow->trackedBytes += write.length;
+    }
+
+    // Has to be called with sShadowLock held.
+    void applyDeferredInvalidations(WriteShadow *shadow) {
+        if (sNumDeferred.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+        if (sDeferredOverflow.exchange(false, std::memory_order_acquire)) {
+            removeOverlapping(shadow, 0, 0x100000000ULL);
+            sNumDeferred.fetch_sub(1, std::memory_order_relaxed);
+        }
+        for (auto &deferred : sDeferred) {
+            if (deferred.state.load(std::memory_order_acquire) != DEFERRED_READY) {
+                continue;
+            }
+            removeOverlapping(shadow, deferred.addr, deferred.length);
+            deferred.state.store(DEFERRED_FREE, std::memory_order_release);
+            sNumDeferred.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    void freeShadow(WriteShadow *shadow) {
+        if (!shadow) {
+            return;
+        }
+        for (uint32_t i = 0; i < shadow->numRanges; i++) {
+            free(shadow->ranges[i].hashes);
+        }
+        free(shadow->ranges);
+        free(shadow);
+    }
+
+    bool overlaps(const StroopwafelWrite &a, const StroopwafelWrite &b) {
+        return a.dest_addr < rangeEnd(b.dest_addr, b.length) && b.dest_addr < rangeEnd(a.dest_addr, a.length);
+    }
+
+    // Collects the writes that actually have to be sent and flushes them in batches of MAX_WRITES_PER_IPC.
+    struct PendingWrites {
+        StroopwafelWrite writes[MAX_WRITES_PER_IPC];
+        uint32_t count;
+        uint64_t bytes;
+        StroopwafelStatus status;
+
+        void add(uint32_t dest_addr, const uint8_t *src, uint32_t length) {
+            if (status != STROOPWAFEL_RESULT_SUCCESS) {
+                return;
+            }
+            writes[count++] = {dest_addr, src, length};
+            bytes += length;
+            if (count == MAX_WRITES_PER_IPC) {
+                flush();
+            }
+        }
+
+        void flush() {
+            if (count > 0 && status == STROOPWAFEL_RESULT_SUCCESS) {
+                status = writeMemoryIPC(count, writes);
+            }
+            count = 0;
+        }
+    };
+} // namespace
+
+bool isWriteShadowEnabled() {
+    return sShadowEnabled.load(std::memory_order_relaxed);
+}
+
+StroopwafelStatus writeMemoryShadowed(uint32_t num_writes, const StroopwafelWrite *writes) {
+    std::lock_guard<Mutex> lock(sShadowLock);
+    if (!sShadow) {
+        return writeMemoryIPC(num_writes, writes);
+    }
+    applyDeferredInvalidations(sShadow);
+
+    uint32_t totalBlocks = 0;
+    for (uint32_t i = 0; i < num_writes; i++) {
+        totalBlocks += numBlocks(writes[i].length);
+    }
+    auto *hashes = (uint64_t *) malloc(std::max(totalBlocks, 1u) * sizeof(uint64_t));
+    if (!hashes) {
+        // Can't tell what changed, write everything and forget what was there.
+        for (uint32_t i = 0; i < num_writes; i++) {
+            removeOverlapping(sShadow, writes[i].dest_addr, writes[i].length);
+        }
+        return writeMemoryIPC(num_writes, writes);
+    }
+
+    PendingWrites pending = {};
+    uint64_t requested    = 0;
+    uint32_t skipped      = 0;
+    uint64_t *writeHashes = hashes;
+    for (uint32_t i = 0; i < num_writes; i++) {
+        const auto &write = writes[i];
+        requested += write.length;
+        if (write.length == 0) {
+            continue;
+        }
+        hashBlocks(write, writeHashes);
+
+        // The shadow only knows the state before this call, writes that overlap each other are sent as they are.
+        bool independent = true;
+        for (uint32_t j = 0; j < num_writes && independent; j++) {
+            independent = j == i || writes[j].length == 0 || !overlaps(write, writes[j]);
+        }
+        auto *range = independent ? findExactRange(sShadow, write.dest_addr, write.length) : nullptr;
+        if (!range) {
+            pending.add(write.dest_addr, (const uint8_t *) write.src, write.length);
+            writeHashes += numBlocks(write.length);
+            continue;
+        }
+
+        // Same range as last time, only send the runs of blocks whose hash changed.
+        uint32_t blocks   = numBlocks(write.length);
+        uint32_t runStart = 0;
+        bool inRun        = false;
+        bool anyDifferent = false;
+        for (uint32_t b = 0; b <= blocks; b++) {
+            bool different = b < blocks && writeHashes[b] != range->hashes[b];
+            if (different && !inRun) {
+                runStart = b;
+                inRun    = true;
+            } else if (!different && inRun) {
+                uint32_t offset = runStart * SHADOW_BLOCK_SIZE;
+                uint32_t end    = std::min(b * SHADOW_BLOCK_SIZE, write.length);
+                pending.add(write.dest_addr + offset, (const uint8_t *) write.src + offset, end - offset);
+                inRun        = false;
+                anyDifferent = true;
+            }
+        }
+        if (!anyDifferent) {
+            skipped++;
+        }
+        writeHashes += blocks;
+    }
+    pending.flush();
+
+    // On failure it's unknown which parts reached IOS.
+    writeHashes = hashes;
+    for (uint32_t i = 0; i < num_writes; i++) {
+        if (writes[i].length == 0) {
+            continue;
+        }
+        if (pending.status == STROOPWAFEL_RESULT_SUCCESS) {
+            trackWrite(sShadow, writes[i], writeHashes);
+        } else {
+            removeOverlapping(sShadow, writes[i].dest_addr, writes[i].length);
+        }
+        writeHashes += numBlocks(writes[i].length);
+    }
+    free(hashes);
+
+    if (pending.status == STROOPWAFEL_RESULT_SUCCESS) {
+        sShadow->stats.bytes_requested += requested;
+        sShadow->stats.bytes_written += pending.bytes;
+        sShadow->stats.skipped_writes += skipped;
+    }
+    return pending.status;
+}
+
+void invalidateWriteShadow(uint32_t addr, uint32_t length) {
+    if (!isWriteShadowEnabled()) {
+        return;
+    }
+    std::lock_guard<Mutex> lock(sShadowLock);
+    if (sShadow) {
+        applyDeferredInvalidations(sShadow);
+        removeOverlapping(sShadow, addr, length);
+    }
+}
+
+void invalidateWriteShadowDeferred(uint32_t addr, uint32_t length) {
+    if (!isWriteShadowEnabled()) {
+        return;
+    }
+    for (auto &deferred : sDeferred) {
+        uint32_t expected = DEFERRED_FREE;
+        if (deferred.state.compare_exchange_strong(expected, DEFERRED_WRITING, std::memory_order_acquire)) {
+            deferred.addr   = addr;
+            deferred.length = length;
+            deferred.state.store(DEFERRED_READY, std::memory_order_release);
+            sNumDeferred.fetch_add(1, std::memory_order_release);
+            return;
+        }
+    }
+    if (!sDeferredOverflow.exchange(true, std::memory_order_release)) {
+        sNumDeferred.fetch_add(1, std::memory_order_release);
+    }
+}
+
+StroopwafelStatus Stroopwafel_EnableWriteShadow(uint32_t max_tracked_bytes) {
+    if (max_tracked_bytes == 0) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    auto *shadow = (WriteShadow *) malloc(sizeof(WriteShadow));
+    if (!shadow) {
+        return STROOPWAFEL_RESULT_OUT_OF_MEMORY;
+    }
+    memset(shadow, 0, sizeof(*shadow));
+    shadow->maxTrackedBytes = max_tracked_bytes;
+
+    WriteShadow *old;
+    {
+        std::lock_guard<Mutex> lock(sShadowLock);
+        old     = sShadow;
+        sShadow = shadow;
+        sShadowEnabled.store(true, std::memory_order_relaxed);
+    }
+    freeShadow(old);
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_DisableWriteShadow() {
+    WriteShadow *old;
+    {
+        std::lock_guard<Mutex> lock(sShadowLock);
+        old     = sShadow;
+        sShadow = nullptr;
+        sShadowEnabled.store(false, std::memory_order_relaxed);
+    }
+    freeShadow(old);
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_InvalidateWriteShadow(uint32_t addr, uint32_t length) {
+    if (length == 0) {
+        // Everything, including a range that ends at the very top of the address space.
+        std::lock_guard<Mutex> lock(sShadowLock);
+        if (sShadow) {
+            applyDeferredInvalidations(sShadow);
+            removeOverlapping(sShadow, 0, 0x100000000ULL);
+        }
+        return STROOPWAFEL_RESULT_SUCCESS;
+    }
+    if (rangeEnd(addr, length) > 0x100000000ULL) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    invalidateWriteShadow(addr, length);
+    return STROOPWAFEL_RESULT_SUCCESS;
+}
+
+StroopwafelStatus Stroopwafel_GetWriteShadowStats(StroopwafelWriteShadowStats *outStats) {
+    if (!outStats) {
+        return STROOPWAFEL_RESULT_INVALID_ARGUMENT;
+    }
+    std::lock_guard<Mutex> lock(sShadowLock);
+    if (!sShadow) {
+        return STROOPWAFEL_RESULT_NOT_FOUND;
+    }
+    applyDeferredInvalidations(sShadow);
+    *outStats               = sShadow->stats;
+    outStats->num_ranges    = sShadow->numRanges;
+    outStats->tracked_bytes = sShadow->trackedBytes;
+    return STROOPWAFEL_RESULT_SUCCESS;
+}